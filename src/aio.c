@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "aio.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define AIO_URING 1
+#endif
+#endif
+
+/* whole-chunk pread and pwrite, for the thread pool and for finishing
+ * short transfers */
+static int pread_full(int fd, uint8_t *buf, uint64_t len, uint64_t off,
+    uint64_t *syscalls) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, off);
+
+        (*syscalls)++;
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            perror("read");
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+static int pwrite_full(int fd, const uint8_t *buf, uint64_t len,
+    uint64_t off, uint64_t *syscalls) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, off);
+
+        (*syscalls)++;
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("write");
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+static uint8_t *buffer(const struct aio *aio, unsigned slot) {
+    return aio->buffers + (size_t)slot * AIO_CHUNK_SIZE;
+}
+
+/* one aio_copy or aio_read, shared by the pool threads */
+struct pool_run {
+    struct aio *aio;
+    int src_fd;
+    int dst_fd;
+    const struct aio_chunk *chunks;
+    size_t n;
+    aio_data_fn fn;
+    void *arg;
+    pthread_mutex_t lock;     /* guards everything below it */
+    size_t next;
+    unsigned inflight;
+    int failed;
+};
+
+struct pool_worker {
+    struct pool_run *run;
+    uint8_t *buf;
+    pthread_t thread;
+};
+
+static void *pool_worker(void *arg) {
+    struct pool_worker *worker = arg;
+    struct pool_run *run = worker->run;
+    struct aio_stats *stats = &run->aio->stats;
+
+    for (;;) {
+        const struct aio_chunk *chunk;
+        uint64_t syscalls = 0;
+        int rc;
+
+        pthread_mutex_lock(&run->lock);
+        if (run->failed || run->next == run->n) {
+            pthread_mutex_unlock(&run->lock);
+            return NULL;
+        }
+        chunk = &run->chunks[run->next++];
+        if (++run->inflight > stats->max_inflight) {
+            stats->max_inflight = run->inflight;
+        }
+        pthread_mutex_unlock(&run->lock);
+
+        rc = pread_full(run->src_fd, worker->buf, chunk->len,
+            chunk->src_off, &syscalls);
+        if (rc == 0 && !run->fn) {
+            rc = pwrite_full(run->dst_fd, worker->buf, chunk->len,
+                chunk->dst_off, &syscalls);
+        }
+
+        pthread_mutex_lock(&run->lock);
+        if (rc == 0 && run->fn && !run->failed) {
+            rc = run->fn(chunk, worker->buf, run->arg);
+        }
+        run->inflight--;
+        stats->syscalls += syscalls;
+        if (rc != 0) {
+            run->failed = 1;
+        } else {
+            stats->chunks++;
+            stats->bytes += chunk->len;
+        }
+        pthread_mutex_unlock(&run->lock);
+    }
+}
+
+static int pool_run(struct aio *aio, int src_fd, int dst_fd,
+    const struct aio_chunk *chunks, size_t n, aio_data_fn fn, void *arg) {
+    struct pool_worker workers[AIO_MAX_DEPTH];
+    struct pool_run run;
+    unsigned nthreads = n < aio->depth ? n : aio->depth;
+    unsigned i, started = 0;
+
+    if (n == 0) {
+        return 0;
+    }
+    memset(&run, 0, sizeof(run));
+    run.aio = aio;
+    run.src_fd = src_fd;
+    run.dst_fd = dst_fd;
+    run.chunks = chunks;
+    run.n = n;
+    run.fn = fn;
+    run.arg = arg;
+    pthread_mutex_init(&run.lock, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        workers[i].run = &run;
+        workers[i].buf = buffer(aio, i);
+        if (pthread_create(&workers[i].thread, NULL, pool_worker,
+            &workers[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    /* a short pool still gets through the work, just less of it at once */
+    if (started == 0) {
+        pool_worker(&workers[0]);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    pthread_mutex_destroy(&run.lock);
+    return run.failed ? -1 : 0;
+}
+
+#ifdef AIO_URING
+/* a submission and completion queue pair set up with the raw syscalls */
+struct aio_ring {
+    int fd;
+    unsigned sq_entries;
+    uint8_t *sq_ptr;
+    size_t sq_size;
+    uint8_t *cq_ptr;          /* sq_ptr when the kernel maps both at once */
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned pending;         /* queued, not yet submitted */
+};
+
+static void ring_destroy(struct aio_ring *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED &&
+        ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    close(ring->fd);
+    free(ring);
+}
+
+static struct aio_ring *ring_create(unsigned entries) {
+    struct io_uring_params params;
+    struct aio_ring *ring = calloc(1, sizeof(*ring));
+
+    if (!ring) {
+        return NULL;
+    }
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+    ring->sq_entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array +
+        params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring_destroy(ring);
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring_destroy(ring);
+            return NULL;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring_destroy(ring);
+        return NULL;
+    }
+
+    ring->sq_head = (unsigned *)(ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(ring->sq_ptr + params.sq_off.array);
+    ring->cq_head = (unsigned *)(ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(ring->cq_ptr + params.cq_off.cqes);
+    return ring;
+}
+
+/* queue one read or write; the caller never asks for more than fit */
+static void ring_queue(struct aio_ring *ring, int op, int fd, void *buf,
+    uint32_t len, uint64_t off, uint64_t user_data, int flags) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->flags = flags;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+}
+
+/* submit what is queued and wait for at least one completion */
+static int ring_enter(struct aio_ring *ring, struct aio_stats *stats) {
+    for (;;) {
+        int rc = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+
+        stats->syscalls++;
+        if (rc >= 0) {
+            ring->pending -= rc;
+            return 0;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            return -1;
+        }
+    }
+}
+
+/* a chunk in flight in one of the depth buffers */
+struct slot {
+    size_t chunk;
+    unsigned waiting;         /* completions still to come */
+    int cancelled;            /* its write never ran */
+};
+
+/* read, and write when copying, every chunk with up to depth of them
+ * queued; a read is linked to its write so both go in one submission
+ * and the write starts as soon as the data is in */
+static int ring_run(struct aio *aio, int src_fd, int dst_fd,
+    const struct aio_chunk *chunks, size_t n, aio_data_fn fn, void *arg) {
+    struct aio_ring *ring = aio->ring;
+    struct aio_stats *stats = &aio->stats;
+    struct slot slots[AIO_MAX_DEPTH];
+    unsigned free_slots[AIO_MAX_DEPTH];
+    unsigned nfree = aio->depth, inflight = 0, i;
+    size_t next = 0;
+    int failed = 0;
+
+    for (i = 0; i < aio->depth; i++) {
+        free_slots[i] = aio->depth - 1 - i;
+    }
+    while (inflight > 0 || (!failed && next < n)) {
+        unsigned head, tail;
+
+        while (!failed && next < n && nfree > 0) {
+            unsigned s = free_slots[--nfree];
+            const struct aio_chunk *chunk = &chunks[next];
+
+            slots[s].chunk = next++;
+            slots[s].cancelled = 0;
+            slots[s].waiting = fn ? 1 : 2;
+            ring_queue(ring, IORING_OP_READ, src_fd, buffer(aio, s),
+                chunk->len, chunk->src_off, (uint64_t)s << 1,
+                fn ? 0 : IOSQE_IO_LINK);
+            if (!fn) {
+                ring_queue(ring, IORING_OP_WRITE, dst_fd, buffer(aio, s),
+                    chunk->len, chunk->dst_off, (uint64_t)s << 1 | 1, 0);
+            }
+            if (++inflight > stats->max_inflight) {
+                stats->max_inflight = inflight;
+            }
+        }
+        if (ring_enter(ring, stats) != 0) {
+            /* nothing more will complete, and the buffers are still the
+             * kernel's; leaking them is all we can do */
+            aio->buffers = NULL;
+            return -1;
+        }
+
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head &
+                *ring->cq_mask];
+            unsigned s = cqe->user_data >> 1;
+            int is_write = cqe->user_data & 1;
+            const struct aio_chunk *chunk = &chunks[slots[s].chunk];
+            uint8_t *buf = buffer(aio, s);
+            int res = cqe->res;
+
+            if (!is_write && res != (int)chunk->len) {
+                /* a short read cuts the link; its write comes back
+                 * cancelled and the whole chunk is redone by hand */
+                if (fn && !failed) {
+                    stats->retries++;
+                    if (pread_full(src_fd, buf, chunk->len, chunk->src_off,
+                        &stats->syscalls) != 0) {
+                        failed = 1;
+                    }
+                } else if (!fn) {
+                    slots[s].cancelled = 1;
+                }
+            } else if (is_write && !failed &&
+                (res != (int)chunk->len || slots[s].cancelled)) {
+                uint32_t done = res > 0 && !slots[s].cancelled ? res : 0;
+
+                stats->retries++;
+                if ((done == 0 && pread_full(src_fd, buf, chunk->len,
+                    chunk->src_off, &stats->syscalls) != 0) ||
+                    pwrite_full(dst_fd, buf + done, chunk->len - done,
+                    chunk->dst_off + done, &stats->syscalls) != 0) {
+                    failed = 1;
+                }
+            }
+            if (--slots[s].waiting > 0) {
+                continue;
+            }
+            if (fn && !failed && fn(chunk, buf, arg) != 0) {
+                failed = 1;
+            }
+            if (!failed) {
+                stats->chunks++;
+                stats->bytes += chunk->len;
+            }
+            free_slots[nfree++] = s;
+            inflight--;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return failed ? -1 : 0;
+}
+#else
+struct aio_ring {
+    int unused;
+};
+
+static void ring_destroy(struct aio_ring *ring) {
+    free(ring);
+}
+
+static struct aio_ring *ring_create(unsigned entries) {
+    return NULL;
+}
+
+static int ring_run(struct aio *aio, int src_fd, int dst_fd,
+    const struct aio_chunk *chunks, size_t n, aio_data_fn fn, void *arg) {
+    return pool_run(aio, src_fd, dst_fd, chunks, n, fn, arg);
+}
+#endif
+
+int aio_init(struct aio *aio, unsigned depth, int threads_only) {
+    memset(aio, 0, sizeof(*aio));
+    if (depth < 1 || depth > AIO_MAX_DEPTH) {
+        fprintf(stderr, "error: queue depth must be 1 to %d\n",
+            AIO_MAX_DEPTH);
+        return -1;
+    }
+    aio->depth = depth;
+    if (!(aio->buffers = malloc((size_t)depth * AIO_CHUNK_SIZE))) {
+        fprintf(stderr, "error: out of memory for I/O buffers\n");
+        return -1;
+    }
+    /* a read and its linked write per buffer */
+    if (!threads_only) {
+        aio->ring = ring_create(2 * depth);
+    }
+    return 0;
+}
+
+void aio_destroy(struct aio *aio) {
+    if (aio->ring) {
+        ring_destroy(aio->ring);
+    }
+    free(aio->buffers);
+    aio->ring = NULL;
+    aio->buffers = NULL;
+}
+
+const char *aio_backend(const struct aio *aio) {
+    return aio->ring ? "io_uring" : "threads";
+}
+
+int aio_copy(struct aio *aio, int src_fd, int dst_fd,
+    const struct aio_chunk *chunks, size_t n) {
+    if (!aio->buffers) {
+        return -1;
+    }
+    if (aio->ring) {
+        return ring_run(aio, src_fd, dst_fd, chunks, n, NULL, NULL);
+    }
+    return pool_run(aio, src_fd, dst_fd, chunks, n, NULL, NULL);
+}
+
+int aio_read(struct aio *aio, int src_fd, const struct aio_chunk *chunks,
+    size_t n, aio_data_fn fn, void *arg) {
+    if (!aio->buffers) {
+        return -1;
+    }
+    if (aio->ring) {
+        return ring_run(aio, src_fd, -1, chunks, n, fn, arg);
+    }
+    return pool_run(aio, src_fd, -1, chunks, n, fn, arg);
+}
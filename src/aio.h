@@ -0,0 +1,59 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AIO_DEFAULT_DEPTH 32
+#define AIO_MAX_DEPTH 1024
+#define AIO_CHUNK_SIZE (256 * 1024) /* most bytes a single read covers */
+
+/* len bytes at src_off of the source, going to dst_off of the
+ * destination when copying */
+struct aio_chunk {
+    uint64_t src_off;
+    uint64_t dst_off;
+    uint32_t len;
+};
+
+/* handed each chunk's data as its read completes, in no particular
+ * order but never two at once; nonzero stops the scan */
+typedef int (*aio_data_fn)(const struct aio_chunk *chunk,
+    const uint8_t *data, void *arg);
+
+struct aio_stats {
+    uint64_t chunks;
+    uint64_t bytes;
+    uint64_t syscalls;        /* io_uring_enter, or pread and pwrite calls */
+    uint32_t max_inflight;    /* most chunks queued at once */
+    uint32_t retries;         /* short transfers finished synchronously */
+};
+
+struct aio_ring;
+
+/* keeps up to depth chunk reads in flight, through io_uring where the
+ * kernel has it and a pool of depth pread threads otherwise */
+struct aio {
+    unsigned depth;
+    struct aio_ring *ring;    /* NULL when using threads */
+    uint8_t *buffers;         /* depth chunks */
+    struct aio_stats stats;
+};
+
+/* threads_only skips io_uring even when it is available */
+int aio_init(struct aio *aio, unsigned depth, int threads_only);
+void aio_destroy(struct aio *aio);
+
+/* "io_uring" or "threads" */
+const char *aio_backend(const struct aio *aio);
+
+/* copy every chunk from src_fd to dst_fd; writes land at their own
+ * offsets as reads complete, so dst_fd must be seekable */
+int aio_copy(struct aio *aio, int src_fd, int dst_fd,
+    const struct aio_chunk *chunks, size_t n);
+
+/* read every chunk from src_fd and pass it to fn */
+int aio_read(struct aio *aio, int src_fd, const struct aio_chunk *chunks,
+    size_t n, aio_data_fn fn, void *arg);
+
+#endif /*AIO_H*/
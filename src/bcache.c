@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "bcache.h"
+
+struct bcache *bcache_create(int fd, uint64_t base, uint32_t block_size,
+    uint32_t capacity) {
+    struct bcache *cache = calloc(1, sizeof(*cache));
+    uint32_t buckets = 64;
+
+    if (!cache) {
+        return NULL;
+    }
+    while (buckets < capacity) {
+        buckets *= 2;
+    }
+    if (!(cache->hash = calloc(buckets, sizeof(*cache->hash)))) {
+        free(cache);
+        return NULL;
+    }
+    cache->mask = buckets - 1;
+    cache->fd = fd;
+    cache->base = base;
+    cache->block_size = block_size;
+    cache->capacity = capacity ? capacity : 1;
+    cache->lru.next = cache->lru.prev = &cache->lru;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    return cache;
+}
+
+void bcache_destroy(struct bcache *cache) {
+    struct bcache_block *block, *next;
+
+    if (!cache) {
+        return;
+    }
+    for (block = cache->lru.next; block != &cache->lru; block = next) {
+        next = block->next;
+        free(block->data);
+        free(block);
+    }
+    pthread_cond_destroy(&cache->loaded);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->hash);
+    free(cache);
+}
+
+static void lru_unlink(struct bcache_block *block) {
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+}
+
+static void lru_push_front(struct bcache *cache, struct bcache_block *block) {
+    block->next = cache->lru.next;
+    block->prev = &cache->lru;
+    cache->lru.next->prev = block;
+    cache->lru.next = block;
+}
+
+static void hash_remove(struct bcache *cache, struct bcache_block *block) {
+    struct bcache_block **link = &cache->hash[block->blockno & cache->mask];
+
+    while (*link != block) {
+        link = &(*link)->hnext;
+    }
+    *link = block->hnext;
+}
+
+/* drop unpinned blocks from the cold end until we're back under
+ * capacity; pinned blocks let the cache overshoot for a while */
+static void evict(struct bcache *cache) {
+    struct bcache_block *block = cache->lru.prev;
+
+    while (cache->count > cache->capacity && block != &cache->lru) {
+        struct bcache_block *prev = block->prev;
+
+        if (block->refs == 0 && block->ready) {
+            lru_unlink(block);
+            hash_remove(cache, block);
+            free(block->data);
+            free(block);
+            cache->count--;
+            cache->evictions++;
+        }
+        block = prev;
+    }
+}
+
+/* read len bytes at pos, a short read past the end of the image is zeros */
+static int64_t read_span(struct bcache *cache, uint8_t *buf, uint64_t pos,
+    uint64_t len) {
+    uint64_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pread(cache->fd, buf + done, len - done, pos + done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("pread");
+            return -1;
+        }
+        if (n == 0) {
+            memset(buf + done, 0, len - done);
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static int read_block(struct bcache *cache, struct bcache_block *block) {
+    return read_span(cache, block->data, cache->base +
+        block->blockno * cache->block_size, cache->block_size);
+}
+
+static struct bcache_block *lookup(struct bcache *cache, uint64_t blockno) {
+    struct bcache_block *block;
+
+    for (block = cache->hash[blockno & cache->mask]; block;
+        block = block->hnext) {
+        if (block->blockno == blockno) {
+            break;
+        }
+    }
+    return block;
+}
+
+/* a new pinned block, not yet read in; called locked */
+static struct bcache_block *insert(struct bcache *cache, uint64_t blockno) {
+    struct bcache_block *block = calloc(1, sizeof(*block));
+
+    if (!block || !(block->data = malloc(cache->block_size))) {
+        free(block);
+        return NULL;
+    }
+    block->blockno = blockno;
+    block->refs = 1;
+    block->hnext = cache->hash[blockno & cache->mask];
+    cache->hash[blockno & cache->mask] = block;
+    lru_push_front(cache, block);
+    cache->count++;
+    return block;
+}
+
+struct bcache_block *bcache_get(struct bcache *cache, uint64_t blockno) {
+    struct bcache_block *block;
+    int n;
+
+    pthread_mutex_lock(&cache->lock);
+    if ((block = lookup(cache, blockno))) {
+        block->refs++;
+        cache->hits++;
+        lru_unlink(block);
+        lru_push_front(cache, block);
+        /* another thread is still reading it in */
+        while (!block->ready) {
+            pthread_cond_wait(&cache->loaded, &cache->lock);
+        }
+        pthread_mutex_unlock(&cache->lock);
+        if (block->blockno != blockno) {
+            bcache_put(cache, block); /* the read failed */
+            return NULL;
+        }
+        return block;
+    }
+
+    cache->misses++;
+    if (!(block = insert(cache, blockno))) {
+        pthread_mutex_unlock(&cache->lock);
+        fprintf(stderr, "error: out of memory for block cache\n");
+        return NULL;
+    }
+    evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+
+    /* the read happens unlocked so other blocks can be served meanwhile */
+    n = read_block(cache, block);
+
+    pthread_mutex_lock(&cache->lock);
+    block->ready = 1;
+    if (n > 0) {
+        cache->bytes_read += n;
+    }
+    pthread_cond_broadcast(&cache->loaded);
+    if (n < 0) {
+        /* forget the block so the next get retries the read */
+        hash_remove(cache, block);
+        block->blockno = UINT64_MAX;
+        block->hnext = NULL;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (n < 0) {
+        bcache_put(cache, block);
+        return NULL;
+    }
+    return block;
+}
+
+void bcache_put(struct bcache *cache, struct bcache_block *block) {
+    pthread_mutex_lock(&cache->lock);
+    block->refs--;
+    if (block->blockno == UINT64_MAX && block->refs == 0) {
+        /* a failed read nobody holds any more */
+        lru_unlink(block);
+        free(block->data);
+        free(block);
+        cache->count--;
+    } else if (cache->count > cache->capacity) {
+        evict(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+uint32_t bcache_prefetch(struct bcache *cache, uint64_t first,
+    uint32_t count) {
+    struct bcache_block **fresh;
+    uint64_t lo, span_len;
+    uint32_t i, n = 0;
+    uint8_t *span;
+    int64_t got = -1;
+
+    /* never push out more than half of what the reader may still want */
+    if (count > cache->capacity / 2) {
+        count = cache->capacity / 2;
+    }
+    if (count == 0 || !(fresh = malloc(count * sizeof(*fresh)))) {
+        return 0;
+    }
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < count; i++) {
+        if (!lookup(cache, first + i)) {
+            if (!(fresh[n] = insert(cache, first + i))) {
+                break;
+            }
+            n++;
+        }
+    }
+    evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+    if (n == 0) {
+        free(fresh);
+        return 0;
+    }
+
+    /* one read from the first missing block to the last, the blocks in
+     * between that were already cached are read again and dropped */
+    lo = fresh[0]->blockno;
+    span_len = (fresh[n - 1]->blockno - lo + 1) * cache->block_size;
+    if ((span = malloc(span_len))) {
+        got = read_span(cache, span, cache->base + lo * cache->block_size,
+            span_len);
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < n; i++) {
+        struct bcache_block *block = fresh[i];
+
+        if (got >= 0) {
+            memcpy(block->data, span + (block->blockno - lo) *
+                cache->block_size, cache->block_size);
+        } else {
+            hash_remove(cache, block);
+            block->blockno = UINT64_MAX;
+            block->hnext = NULL;
+        }
+        block->ready = 1;
+    }
+    if (got > 0) {
+        cache->bytes_read += got;
+        cache->prefetched += n;
+    }
+    pthread_cond_broadcast(&cache->loaded);
+    pthread_mutex_unlock(&cache->lock);
+
+    for (i = 0; i < n; i++) {
+        bcache_put(cache, fresh[i]);
+    }
+    free(span);
+    free(fresh);
+    return got >= 0 ? n : 0;
+}
@@ -0,0 +1,53 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* one cached filesystem block. refs counts callers holding a pointer to
+ * data; only unreferenced blocks are evicted. */
+struct bcache_block {
+    uint64_t blockno;
+    uint8_t *data;
+    unsigned refs;
+    int ready;                    /* data has been read in */
+    struct bcache_block *hnext;   /* hash chain */
+    struct bcache_block *prev;    /* LRU list, most recent at the head */
+    struct bcache_block *next;
+};
+
+/* fixed-capacity LRU cache of blocks read with pread() from an image.
+ * Safe to use from several threads at once. */
+struct bcache {
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;        /* some block became ready */
+    int fd;
+    uint64_t base;                /* byte offset of block 0 in the file */
+    uint32_t block_size;
+    uint32_t capacity;            /* blocks kept when nothing is pinned */
+    uint32_t count;
+    struct bcache_block **hash;
+    uint32_t mask;
+    struct bcache_block lru;      /* list sentinel */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bytes_read;
+    uint64_t prefetched;          /* blocks brought in by bcache_prefetch */
+};
+
+struct bcache *bcache_create(int fd, uint64_t base, uint32_t block_size,
+    uint32_t capacity);
+void bcache_destroy(struct bcache *cache);
+
+/* pin block blockno, reading it in on a miss; NULL on a read error */
+struct bcache_block *bcache_get(struct bcache *cache, uint64_t blockno);
+void bcache_put(struct bcache *cache, struct bcache_block *block);
+
+/* bring the missing blocks of count from first on into the cache with a
+ * single read, ahead of anyone asking for them; returns how many were
+ * added. At most half the cache is filled this way. */
+uint32_t bcache_prefetch(struct bcache *cache, uint64_t first,
+    uint32_t count);
+
+#endif /*BCACHE_H*/
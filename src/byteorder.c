@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "byteorder.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BYTEORDER_X86 1
+#include <immintrin.h>
+#endif
+
+static uint16_t swap16(uint16_t v) {
+    return __builtin_bswap16(v);
+}
+
+static uint32_t swap32(uint32_t v) {
+    return __builtin_bswap32(v);
+}
+
+void minix_swap_superblock(struct superblock *sb) {
+    sb->ninodes = swap32(sb->ninodes);
+    sb->i_blocks = swap16(sb->i_blocks);
+    sb->z_blocks = swap16(sb->z_blocks);
+    sb->firstdata = swap16(sb->firstdata);
+    sb->log_zone_size = swap16(sb->log_zone_size);
+    sb->max_file = swap32(sb->max_file);
+    sb->zones = swap32(sb->zones);
+    sb->magic = swap16(sb->magic);
+    sb->blocksize = swap16(sb->blocksize);
+}
+
+void minix_swap_inode(struct inode *inode) {
+    uint32_t zones[DIRECT_ZONES];
+    int i;
+
+    inode->mode = swap16(inode->mode);
+    inode->links = swap16(inode->links);
+    inode->uid = swap16(inode->uid);
+    inode->gid = swap16(inode->gid);
+    inode->size = swap32(inode->size);
+    inode->atime = swap32(inode->atime);
+    inode->mtime = swap32(inode->mtime);
+    inode->c_time = swap32(inode->c_time);
+    /* the struct is packed, so go through an aligned copy */
+    memcpy(zones, inode->zone, sizeof(zones));
+    for (i = 0; i < DIRECT_ZONES; i++) {
+        zones[i] = swap32(zones[i]);
+    }
+    memcpy(inode->zone, zones, sizeof(zones));
+    inode->indirect = swap32(inode->indirect);
+    inode->two_indirect = swap32(inode->two_indirect);
+}
+
+static void swap_words_scalar(uint32_t *dst, const void *src, size_t n) {
+    const uint8_t *from = src;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t word;
+
+        memcpy(&word, from + i * sizeof(word), sizeof(word));
+        dst[i] = swap32(word);
+    }
+}
+
+#ifdef BYTEORDER_X86
+static int has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/* eight words per shuffle */
+__attribute__((target("avx2")))
+static void swap_words_avx2(uint32_t *dst, const void *src, size_t n) {
+    const __m256i reverse = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+        11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4,
+        11, 10, 9, 8, 15, 14, 13, 12);
+    const uint8_t *from = src;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i words = _mm256_loadu_si256((const __m256i *)(from +
+            i * sizeof(uint32_t)));
+
+        _mm256_storeu_si256((__m256i *)(dst + i),
+            _mm256_shuffle_epi8(words, reverse));
+    }
+    swap_words_scalar(dst + i, from + i * sizeof(uint32_t), n - i);
+}
+#endif
+
+static void (*swap_words)(uint32_t *dst, const void *src, size_t n);
+static pthread_once_t picked = PTHREAD_ONCE_INIT;
+
+static void pick_swap(void) {
+    swap_words = swap_words_scalar;
+#ifdef BYTEORDER_X86
+    if (has_avx2()) {
+        swap_words = swap_words_avx2;
+    }
+#endif
+}
+
+void minix_swap_words(uint32_t *dst, const void *src, size_t n) {
+    pthread_once(&picked, pick_swap);
+    swap_words(dst, src, n);
+}
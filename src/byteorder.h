@@ -0,0 +1,18 @@
+#ifndef BYTEORDER_H
+#define BYTEORDER_H
+
+#include <stddef.h>
+#include "minix.h"
+
+/* decoding for filesystems written with the opposite byte order
+ * (R_MAGIC_NUM). Whether an image needs it is settled once when it is
+ * opened; native images never reach these. */
+void minix_swap_superblock(struct superblock *sb);
+void minix_swap_inode(struct inode *inode);
+
+/* byte-reverse n 32-bit words from src into dst, which may be the same:
+ * zone numbers of an indirect block or a bitmap. Vectorized where the cpu
+ * allows. */
+void minix_swap_words(uint32_t *dst, const void *src, size_t n);
+
+#endif /*BYTEORDER_H*/
@@ -0,0 +1,743 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "check.h"
+#include "workq.h"
+#include "aio.h"
+#include "byteorder.h"
+
+/* a directory entry naming another directory or file, for the walk from
+ * the root once every directory has been read */
+struct edge {
+    uint32_t parent;
+    uint32_t child;
+};
+
+struct check;
+
+/* one run of the inode table and everything its worker found. Kept apart
+ * per chunk so workers never share a buffer and the report comes out in
+ * inode order whatever the thread count. */
+struct chunk {
+    struct check *check;
+    uint32_t first_block;      /* inode table blocks of this chunk */
+    uint32_t nblocks;
+    uint8_t *table;            /* those blocks, when read ahead */
+    char *text;                /* problem lines */
+    size_t len, cap;
+    struct edge *edges;
+    size_t nedges, edges_cap;
+    struct check_report counts;
+    int failed;                /* ran out of memory */
+};
+
+struct check {
+    const struct minix_image *img;
+    uint8_t *imap;             /* copies of the two bitmaps */
+    uint64_t imap_bits;
+    uint8_t *zmap;
+    uint64_t zmap_bits;
+    uint32_t first_zone;       /* sb->firstdata */
+    uint32_t *owner;           /* zone - first_zone -> inode using it */
+    uint32_t *refs;            /* directory entries naming each inode */
+    uint32_t *dotdot;          /* each directory's .. entry */
+    uint16_t *mode;            /* of the inodes in use, 0 for the rest */
+    uint16_t *links;
+    pthread_mutex_t lock;      /* guards loaded */
+    pthread_cond_t drained;
+    uint32_t loaded;           /* chunks read ahead, not yet checked */
+};
+
+static int bit_set(const uint8_t *map, uint64_t bits, uint64_t n) {
+    return n < bits && (map[n / 8] >> (n % 8)) & 1;
+}
+
+static void note(struct chunk *chunk, const char *fmt, ...) {
+    va_list ap;
+    size_t cap;
+    char *text;
+    int n;
+
+    chunk->counts.problems++;
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(chunk->text + chunk->len, chunk->cap - chunk->len,
+            fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return;
+        }
+        if ((size_t)n + 1 < chunk->cap - chunk->len) {
+            chunk->len += n;
+            chunk->text[chunk->len++] = '\n';
+            chunk->text[chunk->len] = '\0';
+            return;
+        }
+        cap = chunk->cap ? chunk->cap * 2 : 4096;
+        while (cap - chunk->len < (size_t)n + 2) {
+            cap *= 2;
+        }
+        if (!(text = realloc(chunk->text, cap))) {
+            chunk->failed = 1;
+            return;
+        }
+        chunk->text = text;
+        chunk->cap = cap;
+    }
+}
+
+static void add_edge(struct chunk *chunk, uint32_t parent, uint32_t child) {
+    if (chunk->nedges == chunk->edges_cap) {
+        size_t cap = chunk->edges_cap ? chunk->edges_cap * 2 : 256;
+        struct edge *edges = realloc(chunk->edges, cap * sizeof(*edges));
+
+        if (!edges) {
+            chunk->failed = 1;
+            return;
+        }
+        chunk->edges = edges;
+        chunk->edges_cap = cap;
+    }
+    chunk->edges[chunk->nedges].parent = parent;
+    chunk->edges[chunk->nedges].child = child;
+    chunk->nedges++;
+}
+
+/* claim zone for ino; 0 when it can't be used at all */
+static int claim_zone(struct chunk *chunk, uint32_t ino, uint32_t zone) {
+    struct check *check = chunk->check;
+    uint32_t expected = 0;
+    uint32_t index;
+
+    if (zone < check->first_zone || !minix_zone_valid(check->img, zone)) {
+        note(chunk, "inode %u: zone %u out of range", ino, zone);
+        return 0;
+    }
+    index = zone - check->first_zone;
+    if (!__atomic_compare_exchange_n(&check->owner[index], &expected, ino,
+        0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        if (expected == ino) {
+            note(chunk, "inode %u: zone %u used twice", ino, zone);
+        } else {
+            note(chunk, "inode %u: zone %u also used by inode %u", ino,
+                zone, expected);
+        }
+        return 1;
+    }
+    chunk->counts.zones_owned++;
+    /* bit 0 of the zone bitmap stands for no zone */
+    if (!bit_set(check->zmap, check->zmap_bits, (uint64_t)index + 1)) {
+        note(chunk, "inode %u: zone %u in use but marked free", ino, zone);
+    }
+    return 1;
+}
+
+static void claim_data(struct chunk *chunk, uint32_t ino, uint32_t zone,
+    uint64_t file_zone, uint64_t nzones) {
+    if (zone == 0) {
+        return;
+    }
+    if (claim_zone(chunk, ino, zone) && file_zone >= nzones) {
+        note(chunk, "inode %u: zone %u past end of file", ino, zone);
+    }
+}
+
+/* claim an indirect zone and copy out its zone numbers */
+static int read_indirect(struct chunk *chunk, uint32_t ino, uint32_t zone,
+    uint32_t *zones) {
+    const struct minix_image *img = chunk->check->img;
+    struct minix_buf buf;
+
+    if (!claim_zone(chunk, ino, zone)) {
+        return -1;
+    }
+    if (minix_get_block(img, zone << img->sb->log_zone_size, &buf) != 0) {
+        note(chunk, "inode %u: cannot read indirect zone %u", ino, zone);
+        return -1;
+    }
+    if (img->swapped) {
+        minix_swap_words(zones, buf.data, img->sb->blocksize /
+            sizeof(uint32_t));
+    } else {
+        memcpy(zones, buf.data, img->sb->blocksize);
+    }
+    minix_put_block(img, &buf);
+    return 0;
+}
+
+/* every zone pointer of the inode, whatever its size says, so zones left
+ * behind past the end of a file are still owned by it */
+static void claim_zones(struct chunk *chunk, uint32_t ino,
+    const struct inode *inode) {
+    const struct minix_image *img = chunk->check->img;
+    uint32_t per = img->sb->blocksize / sizeof(uint32_t);
+    uint64_t nzones = ((uint64_t)inode->size + img->zone_size - 1) /
+        img->zone_size;
+    uint64_t base = DIRECT_ZONES;
+    uint32_t *root, *leaf;
+    uint32_t i, j;
+
+    for (i = 0; i < DIRECT_ZONES; i++) {
+        claim_data(chunk, ino, inode->zone[i], i, nzones);
+    }
+    if (!(root = malloc(2 * (size_t)img->sb->blocksize))) {
+        chunk->failed = 1;
+        return;
+    }
+    leaf = root + per;
+
+    if (inode->indirect && read_indirect(chunk, ino, inode->indirect,
+        leaf) == 0) {
+        for (j = 0; j < per; j++) {
+            claim_data(chunk, ino, leaf[j], base + j, nzones);
+        }
+    }
+    base += per;
+    if (inode->two_indirect && read_indirect(chunk, ino,
+        inode->two_indirect, root) == 0) {
+        for (i = 0; i < per; i++) {
+            if (!root[i] || read_indirect(chunk, ino, root[i], leaf) != 0) {
+                continue;
+            }
+            for (j = 0; j < per; j++) {
+                claim_data(chunk, ino, leaf[j], base + (uint64_t)i * per + j,
+                    nzones);
+            }
+        }
+    }
+    free(root);
+}
+
+struct dir_scan {
+    struct chunk *chunk;
+    uint32_t ino;
+    int dot, dotdot;
+};
+
+static int scan_entry(const struct fileent *entry, void *arg) {
+    struct dir_scan *scan = arg;
+    struct chunk *chunk = scan->chunk;
+    struct check *check = chunk->check;
+    uint32_t target = entry->ino;
+
+    if (target > check->img->sb->ninodes) {
+        note(chunk, "inode %u: entry '%.*s' names inode %u past the inode "
+            "table", scan->ino, DIRSIZ, entry->name, target);
+        return 0;
+    }
+    __atomic_fetch_add(&check->refs[target], 1, __ATOMIC_RELAXED);
+    if (!bit_set(check->imap, check->imap_bits, target)) {
+        note(chunk, "inode %u: entry '%.*s' names free inode %u", scan->ino,
+            DIRSIZ, entry->name, target);
+    }
+
+    if (strncmp(entry->name, ".", DIRSIZ) == 0) {
+        scan->dot = 1;
+        if (target != scan->ino) {
+            note(chunk, "inode %u: . names inode %u", scan->ino, target);
+        }
+    } else if (strncmp(entry->name, "..", DIRSIZ) == 0) {
+        scan->dotdot = 1;
+        check->dotdot[scan->ino] = target;
+    } else {
+        add_edge(chunk, scan->ino, target);
+    }
+    return 0;
+}
+
+static void check_dir(struct chunk *chunk, uint32_t ino,
+    const struct inode *inode) {
+    struct dir_scan scan = { chunk, ino, 0, 0 };
+
+    if (inode->size % DIRECTORY_ENTRY_SIZE) {
+        note(chunk, "inode %u: directory size %u is not a multiple of %d",
+            ino, inode->size, DIRECTORY_ENTRY_SIZE);
+    }
+    if (minix_readdir(chunk->check->img, inode, scan_entry, &scan) < 0) {
+        note(chunk, "inode %u: directory cannot be read", ino);
+        return;
+    }
+    if (!scan.dot) {
+        note(chunk, "inode %u: directory has no . entry", ino);
+    }
+    if (!scan.dotdot) {
+        note(chunk, "inode %u: directory has no .. entry", ino);
+    }
+}
+
+static void check_inode(struct chunk *chunk, uint32_t ino,
+    const struct inode *inode) {
+    struct check *check = chunk->check;
+    uint16_t type = inode->mode & FILE_TYPE;
+
+    if (!bit_set(check->imap, check->imap_bits, ino)) {
+        return;
+    }
+    chunk->counts.inodes++;
+    if (inode->mode == 0) {
+        note(chunk, "inode %u: marked in use but has no mode", ino);
+        return;
+    }
+    check->mode[ino] = inode->mode;
+    check->links[ino] = inode->links;
+
+    /* device inodes keep the device number in zone[0] */
+    if (type != REGULAR_FILE && type != DIRECTORY && type != SYMLINK) {
+        chunk->counts.other++;
+        return;
+    }
+    claim_zones(chunk, ino, inode);
+    if (type == DIRECTORY) {
+        chunk->counts.dirs++;
+        check_dir(chunk, ino, inode);
+    } else if (type == REGULAR_FILE) {
+        chunk->counts.files++;
+    } else {
+        chunk->counts.other++;
+    }
+}
+
+/* worker: the chunk's inode table blocks in order, from its table when
+ * they were read ahead */
+static void check_chunk(void *item, void *arg) {
+    struct chunk *chunk = item;
+    struct check *check = chunk->check;
+    const struct minix_image *img = check->img;
+    uint32_t per_block = img->sb->blocksize / INODE_SIZE;
+    uint32_t b, i;
+
+    for (b = 0; b < chunk->nblocks; b++) {
+        uint32_t block = chunk->first_block + b;
+        uint32_t ino = block * per_block + 1;
+        const uint8_t *data;
+        struct minix_buf buf;
+
+        if (chunk->table) {
+            data = chunk->table + (size_t)b * img->sb->blocksize;
+        } else if (minix_get_block(img, img->inode_block + block,
+            &buf) != 0) {
+            note(chunk, "inode table block %u cannot be read",
+                img->inode_block + block);
+            continue;
+        } else {
+            data = buf.data;
+        }
+        for (i = 0; i < per_block && ino <= img->sb->ninodes; i++, ino++) {
+            struct inode inode;
+
+            minix_decode_inode(img, data + i * INODE_SIZE, &inode);
+            check_inode(chunk, ino, &inode);
+        }
+        if (!chunk->table) {
+            minix_put_block(img, &buf);
+        }
+    }
+    if (chunk->table) {
+        free(chunk->table);
+        chunk->table = NULL;
+        pthread_mutex_lock(&check->lock);
+        check->loaded--;
+        pthread_cond_signal(&check->drained);
+        pthread_mutex_unlock(&check->lock);
+    }
+}
+
+/* aio_data_fn: a piece of the inode table into its chunk's copy, where
+ * dst_off is its offset in the table */
+static int fill_table(const struct aio_chunk *piece, const uint8_t *data,
+    void *arg) {
+    struct chunk *chunks = arg;
+    const struct minix_image *img = chunks[0].check->img;
+    size_t chunk_bytes = (size_t)CHECK_CHUNK_BLOCKS * img->sb->blocksize;
+    struct chunk *chunk = &chunks[piece->dst_off / chunk_bytes];
+
+    memcpy(chunk->table + piece->dst_off % chunk_bytes, data, piece->len);
+    return 0;
+}
+
+/* give chunks[first..end) copies of their blocks, read together through
+ * aio; those that don't get one read their blocks themselves */
+static void read_tables(struct check *check, struct aio *aio,
+    struct chunk *chunks, uint32_t first, uint32_t end,
+    struct aio_chunk *reads) {
+    const struct minix_image *img = check->img;
+    uint32_t blocksize = img->sb->blocksize;
+    size_t chunk_bytes = (size_t)CHECK_CHUNK_BLOCKS * blocksize;
+    size_t n = 0, off;
+    uint32_t c;
+
+    for (c = first; c < end; c++) {
+        size_t len = (size_t)chunks[c].nblocks * blocksize;
+
+        if (!(chunks[c].table = malloc(len))) {
+            continue;
+        }
+        for (off = 0; off < len; off += AIO_CHUNK_SIZE, n++) {
+            reads[n].src_off = img->offset + ((uint64_t)img->inode_block +
+                chunks[c].first_block) * blocksize + off;
+            reads[n].dst_off = c * chunk_bytes + off;
+            reads[n].len = len - off < AIO_CHUNK_SIZE ? len - off :
+                AIO_CHUNK_SIZE;
+        }
+    }
+    if (n > 0 && aio_read(aio, img->fd, reads, n, fill_table, chunks) != 0) {
+        for (c = first; c < end; c++) {
+            free(chunks[c].table);
+            chunks[c].table = NULL;
+        }
+    }
+    pthread_mutex_lock(&check->lock);
+    for (c = first; c < end; c++) {
+        check->loaded += chunks[c].table != NULL;
+    }
+    pthread_mutex_unlock(&check->lock);
+}
+
+/* hand the chunks to the workers; with a depth, read depth of them at a
+ * time through aio first, no more than two such rounds waiting */
+static void queue_chunks(struct check *check, struct workq *queue,
+    struct chunk *chunks, uint32_t nchunks, unsigned depth) {
+    size_t pieces = (size_t)CHECK_CHUNK_BLOCKS * check->img->sb->blocksize /
+        AIO_CHUNK_SIZE + 1;
+    struct aio_chunk *reads = NULL;
+    struct aio aio;
+    uint32_t c, end;
+
+    if (depth && (aio_init(&aio, depth, 0) != 0 ||
+        !(reads = malloc(depth * pieces * sizeof(*reads))))) {
+        aio_destroy(&aio);
+        depth = 0;
+    }
+    for (c = 0; c < nchunks; c = end) {
+        end = depth && nchunks - c > depth ? c + depth : nchunks;
+        if (depth) {
+            pthread_mutex_lock(&check->lock);
+            while (check->loaded > depth) {
+                pthread_cond_wait(&check->drained, &check->lock);
+            }
+            pthread_mutex_unlock(&check->lock);
+            read_tables(check, &aio, chunks, c, end, reads);
+        }
+        for (; c < end; c++) {
+            if (workq_push(queue, &chunks[c]) != 0) {
+                chunks[c].failed = 1;
+                if (chunks[c].table) {
+                    pthread_mutex_lock(&check->lock);
+                    check->loaded--;
+                    pthread_mutex_unlock(&check->lock);
+                }
+            }
+        }
+    }
+    if (depth) {
+        aio_destroy(&aio);
+        free(reads);
+    }
+}
+
+/* copy nblocks blocks starting at first into a fresh buffer */
+static uint8_t *load_bitmap(const struct minix_image *img, uint32_t first,
+    uint32_t nblocks) {
+    uint32_t blocksize = img->sb->blocksize;
+    uint8_t *map = malloc((size_t)nblocks * blocksize);
+    uint32_t i;
+
+    if (!map) {
+        fprintf(stderr, "error: out of memory\n");
+        return NULL;
+    }
+    for (i = 0; i < nblocks; i++) {
+        struct minix_buf buf;
+
+        if (minix_get_block(img, first + i, &buf) != 0) {
+            fprintf(stderr, "error: bitmap block %u is past end of image\n",
+                first + i);
+            free(map);
+            return NULL;
+        }
+        memcpy(map + (size_t)i * blocksize, buf.data, blocksize);
+        minix_put_block(img, &buf);
+    }
+    /* bitmaps are arrays of 32-bit words, reversed with everything else */
+    if (img->swapped) {
+        minix_swap_words((uint32_t *)map, map,
+            (size_t)nblocks * blocksize / sizeof(uint32_t));
+    }
+    return map;
+}
+
+/* walk from the root over the collected entries, checking each directory
+ * is reached through its own .. and that nothing in use is left out */
+static int check_reachable(struct check *check, struct chunk *report,
+    const struct chunk *chunks, uint32_t nchunks) {
+    uint32_t ninodes = check->img->sb->ninodes;
+    uint32_t *start = calloc((size_t)ninodes + 2, sizeof(*start));
+    uint32_t *children = NULL;
+    uint32_t *queue = NULL;
+    uint8_t *seen = calloc((size_t)ninodes + 1, 1);
+    size_t total = 0, k;
+    uint32_t c, ino, head = 0, tail = 0;
+    int status = -1;
+
+    for (c = 0; c < nchunks; c++) {
+        total += chunks[c].nedges;
+    }
+    if (!start || !seen || !(children = malloc((total + 1) *
+        sizeof(*children))) || !(queue = malloc(((size_t)ninodes + 1) *
+        sizeof(*queue)))) {
+        fprintf(stderr, "error: out of memory\n");
+        goto out;
+    }
+
+    /* children of each directory, contiguous, in start[p]..start[p+1] */
+    for (c = 0; c < nchunks; c++) {
+        for (k = 0; k < chunks[c].nedges; k++) {
+            start[chunks[c].edges[k].parent + 1]++;
+        }
+    }
+    for (ino = 1; ino <= ninodes + 1; ino++) {
+        start[ino] += start[ino - 1];
+    }
+    for (c = 0; c < nchunks; c++) {
+        for (k = 0; k < chunks[c].nedges; k++) {
+            const struct edge *e = &chunks[c].edges[k];
+
+            children[start[e->parent]++] = e->child;
+        }
+    }
+    /* filling moved every start up to the next one, shift them back */
+    for (ino = ninodes + 1; ino > 0; ino--) {
+        start[ino] = start[ino - 1];
+    }
+    start[0] = 0;
+
+    if (!MINIX_ISDIR(check->mode[ROOT_INODE])) {
+        note(report, "inode %u: root is not a directory", ROOT_INODE);
+    } else {
+        seen[ROOT_INODE] = 1;
+        queue[tail++] = ROOT_INODE;
+    }
+    while (head < tail) {
+        uint32_t parent = queue[head++];
+
+        for (k = start[parent]; k < start[parent + 1]; k++) {
+            uint32_t child = children[k];
+
+            if (seen[child] || !check->mode[child]) {
+                continue;
+            }
+            seen[child] = 1;
+            if (MINIX_ISDIR(check->mode[child])) {
+                if (check->dotdot[child] != parent) {
+                    note(report, "inode %u: .. names inode %u, expected %u",
+                        child, check->dotdot[child], parent);
+                }
+                queue[tail++] = child;
+            }
+        }
+    }
+    for (ino = ROOT_INODE; ino <= ninodes; ino++) {
+        if (check->mode[ino] && !seen[ino]) {
+            note(report, "inode %u: not reachable from /", ino);
+        }
+    }
+    status = 0;
+out:
+    free(start);
+    free(children);
+    free(queue);
+    free(seen);
+    return status;
+}
+
+/* link counts, then zones marked in use that nobody owns, as ranges */
+static void check_counts(struct check *check, struct chunk *report) {
+    const struct superblock *sb = check->img->sb;
+    uint32_t nzones = sb->zones - check->first_zone;
+    uint32_t ino, i, run = 0;
+
+    for (ino = ROOT_INODE; ino <= sb->ninodes; ino++) {
+        if (check->mode[ino] && check->refs[ino] != check->links[ino]) {
+            note(report, "inode %u: link count %u, but %u entries name it",
+                ino, check->links[ino], check->refs[ino]);
+        }
+    }
+    for (i = 0; i <= nzones; i++) {
+        int marked = i < nzones &&
+            bit_set(check->zmap, check->zmap_bits, (uint64_t)i + 1);
+
+        report->counts.zones_marked += marked;
+        if (marked && !check->owner[i]) {
+            run++;
+        } else if (run) {
+            uint32_t first = check->first_zone + i - run;
+
+            if (run == 1) {
+                note(report, "zone %u: marked in use but unowned", first);
+            } else {
+                note(report, "zones %u-%u: marked in use but unowned",
+                    first, first + run - 1);
+            }
+            run = 0;
+        }
+    }
+}
+
+/* superblock fields the rest of the check relies on */
+static int check_layout(const struct minix_image *img, struct chunk *report) {
+    const struct superblock *sb = img->sb;
+    uint32_t per_block = sb->blocksize / INODE_SIZE;
+    uint64_t table_end = img->inode_block +
+        ((uint64_t)sb->ninodes + per_block - 1) / per_block;
+    uint64_t bits = (uint64_t)sb->blocksize * 8;
+
+    if (sb->i_blocks <= 0 || sb->z_blocks <= 0 || sb->ninodes == 0) {
+        fprintf(stderr, "error: corrupt superblock (i_blocks %d, z_blocks "
+            "%d, ninodes %u)\n", sb->i_blocks, sb->z_blocks, sb->ninodes);
+        return -1;
+    }
+    if ((uint64_t)sb->firstdata << sb->log_zone_size < table_end ||
+        sb->firstdata >= sb->zones) {
+        fprintf(stderr, "error: corrupt superblock (firstdata %u, zones "
+            "%u, inode table ends at block %llu)\n", sb->firstdata,
+            sb->zones, (unsigned long long)table_end);
+        return -1;
+    }
+    if (table_end * sb->blocksize > img->map_size - img->offset) {
+        fprintf(stderr, "error: inode table runs past end of image\n");
+        return -1;
+    }
+    if (sb->i_blocks * bits <= sb->ninodes) {
+        note(report, "superblock: inode bitmap too small for %u inodes",
+            sb->ninodes);
+    }
+    if (sb->z_blocks * bits < (uint64_t)sb->zones - sb->firstdata + 1) {
+        note(report, "superblock: zone bitmap too small for %u zones",
+            sb->zones);
+    }
+    if ((uint64_t)sb->zones * img->zone_size >
+        img->map_size - img->offset) {
+        note(report, "superblock: %u zones run past end of image",
+            sb->zones);
+    }
+    return 0;
+}
+
+static void add_counts(struct check_report *total,
+    const struct check_report *counts) {
+    total->inodes += counts->inodes;
+    total->files += counts->files;
+    total->dirs += counts->dirs;
+    total->other += counts->other;
+    total->zones_owned += counts->zones_owned;
+    total->zones_marked += counts->zones_marked;
+    total->problems += counts->problems;
+}
+
+int minix_check(const struct minix_image *img, int nthreads, unsigned depth,
+    FILE *out, struct check_report *report) {
+    const struct superblock *sb = img->sb;
+    uint32_t per_block = sb->blocksize / INODE_SIZE;
+    uint32_t table_blocks = (sb->ninodes + per_block - 1) / per_block;
+    uint32_t nchunks = (table_blocks + CHECK_CHUNK_BLOCKS - 1) /
+        CHECK_CHUNK_BLOCKS;
+    size_t slots = (size_t)sb->ninodes + 1;
+    struct chunk *chunks = NULL;
+    struct chunk tail;
+    struct check check;
+    struct workq queue;
+    uint32_t c;
+    int status = -1;
+
+    memset(report, 0, sizeof(*report));
+    memset(&check, 0, sizeof(check));
+    memset(&tail, 0, sizeof(tail));
+    check.img = img;
+    tail.check = &check;
+    if (check_layout(img, &tail) != 0) {
+        free(tail.text);
+        return -1;
+    }
+    pthread_mutex_init(&check.lock, NULL);
+    pthread_cond_init(&check.drained, NULL);
+    check.first_zone = sb->firstdata;
+    check.imap_bits = (uint64_t)sb->i_blocks * sb->blocksize * 8;
+    check.zmap_bits = (uint64_t)sb->z_blocks * sb->blocksize * 8;
+    if (!(check.imap = load_bitmap(img, 2, sb->i_blocks)) ||
+        !(check.zmap = load_bitmap(img, 2 + sb->i_blocks, sb->z_blocks))) {
+        goto out;
+    }
+    if (!(check.owner = calloc(sb->zones - check.first_zone,
+        sizeof(*check.owner))) ||
+        !(check.refs = calloc(slots, sizeof(*check.refs))) ||
+        !(check.dotdot = calloc(slots, sizeof(*check.dotdot))) ||
+        !(check.mode = calloc(slots, sizeof(*check.mode))) ||
+        !(check.links = calloc(slots, sizeof(*check.links))) ||
+        !(chunks = calloc(nchunks, sizeof(*chunks)))) {
+        fprintf(stderr, "error: out of memory\n");
+        goto out;
+    }
+
+    if (workq_start(&queue, nthreads, check_chunk, NULL) != 0) {
+        goto out;
+    }
+    for (c = 0; c < nchunks; c++) {
+        chunks[c].check = &check;
+        chunks[c].first_block = c * CHECK_CHUNK_BLOCKS;
+        chunks[c].nblocks = table_blocks - chunks[c].first_block;
+        if (chunks[c].nblocks > CHECK_CHUNK_BLOCKS) {
+            chunks[c].nblocks = CHECK_CHUNK_BLOCKS;
+        }
+    }
+    queue_chunks(&check, &queue, chunks, nchunks, depth);
+    workq_finish(&queue);
+
+    if (tail.text) {
+        fputs(tail.text, out);
+        tail.len = 0;
+        tail.text[0] = '\0';
+    }
+    for (c = 0; c < nchunks; c++) {
+        if (chunks[c].failed) {
+            fprintf(stderr, "error: out of memory\n");
+            goto out;
+        }
+        if (chunks[c].text) {
+            fputs(chunks[c].text, out);
+        }
+        add_counts(report, &chunks[c].counts);
+    }
+    if (check_reachable(&check, &tail, chunks, nchunks) != 0) {
+        goto out;
+    }
+    check_counts(&check, &tail);
+    if (tail.failed) {
+        fprintf(stderr, "error: out of memory\n");
+        goto out;
+    }
+    if (tail.text) {
+        fputs(tail.text, out);
+    }
+    add_counts(report, &tail.counts);
+    status = 0;
+out:
+    for (c = 0; chunks && c < nchunks; c++) {
+        free(chunks[c].table);
+        free(chunks[c].text);
+        free(chunks[c].edges);
+    }
+    free(chunks);
+    free(tail.text);
+    free(check.imap);
+    free(check.zmap);
+    free(check.owner);
+    free(check.refs);
+    free(check.dotdot);
+    free(check.mode);
+    free(check.links);
+    pthread_mutex_destroy(&check.lock);
+    pthread_cond_destroy(&check.drained);
+    return status;
+}
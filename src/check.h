@@ -0,0 +1,30 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include "minix.h"
+
+#define CHECK_CHUNK_BLOCKS 64 /* inode table blocks per work item */
+
+/* what a check found. Every problem is also printed as one line. */
+struct check_report {
+    uint32_t inodes;           /* marked in use in the inode bitmap */
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t other;            /* devices, fifos, links */
+    uint32_t zones_owned;      /* data and indirect zones some inode uses */
+    uint32_t zones_marked;     /* set in the zone bitmap */
+    uint64_t problems;
+};
+
+/* read-only consistency check of the whole filesystem: the inode table is
+ * read front to back in chunks spread over nthreads workers, each claiming
+ * the zones its inodes point at and counting the directory entries naming
+ * every inode. A nonzero depth reads depth chunks at a time ahead of the
+ * workers through aio. Zone ownership is then cross-checked against the zone
+ * bitmap, link counts against those entries, and every inode in use has to
+ * be reachable from the root. Problems go to out, one per line. Returns -1
+ * only when the check itself could not be run. */
+int minix_check(const struct minix_image *img, int nthreads, unsigned depth,
+    FILE *out, struct check_report *report);
+
+#endif /*CHECK_H*/
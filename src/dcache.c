@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dcache.h"
+
+#define DCACHE_INITIAL_BUCKETS 256
+
+struct dcache *dcache_create(void) {
+    struct dcache *cache = calloc(1, sizeof(*cache));
+
+    if (!cache) {
+        return NULL;
+    }
+    cache->buckets = calloc(DCACHE_INITIAL_BUCKETS,
+        sizeof(struct dcache_entry *));
+    if (!cache->buckets) {
+        free(cache);
+        return NULL;
+    }
+    cache->mask = DCACHE_INITIAL_BUCKETS - 1;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+static void free_entries(struct dcache *cache) {
+    uint32_t i;
+
+    for (i = 0; i <= cache->mask; i++) {
+        struct dcache_entry *entry = cache->buckets[i];
+        while (entry) {
+            struct dcache_entry *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+        cache->buckets[i] = NULL;
+    }
+    cache->count = 0;
+}
+
+void dcache_destroy(struct dcache *cache) {
+    if (!cache) {
+        return;
+    }
+    free_entries(cache);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+static uint32_t entry_hash(uint32_t parent, const char *name) {
+    return minix_name_hash(name) ^ (parent * 2654435761u);
+}
+
+int dcache_lookup(struct dcache *cache, uint32_t parent, const char *name,
+    uint32_t *ino) {
+    uint32_t hash = entry_hash(parent, name);
+    struct dcache_entry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+    for (entry = cache->buckets[hash & cache->mask]; entry;
+        entry = entry->next) {
+        if (entry->hash == hash && entry->parent == parent &&
+            strncmp(entry->name, name, DIRSIZ) == 0) {
+            cache->hits++;
+            if (entry->ino == 0) {
+                cache->negative_hits++;
+            }
+            *ino = entry->ino;
+            pthread_mutex_unlock(&cache->lock);
+            return 1;
+        }
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+/* double the bucket array once chains average more than one entry */
+static void grow(struct dcache *cache) {
+    uint32_t size = (cache->mask + 1) * 2;
+    struct dcache_entry **buckets = calloc(size, sizeof(*buckets));
+    uint32_t i;
+
+    if (!buckets) {
+        return; /* keep going with longer chains */
+    }
+    for (i = 0; i <= cache->mask; i++) {
+        struct dcache_entry *entry = cache->buckets[i];
+        while (entry) {
+            struct dcache_entry *next = entry->next;
+            entry->next = buckets[entry->hash & (size - 1)];
+            buckets[entry->hash & (size - 1)] = entry;
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->mask = size - 1;
+}
+
+void dcache_insert(struct dcache *cache, uint32_t parent, const char *name,
+    uint32_t ino) {
+    struct dcache_entry *entry;
+
+    if (!(entry = malloc(sizeof(*entry)))) {
+        return; /* it's only a cache */
+    }
+    entry->parent = parent;
+    entry->ino = ino;
+    entry->hash = entry_hash(parent, name);
+    strncpy(entry->name, name, DIRSIZ);
+    pthread_mutex_lock(&cache->lock);
+    if (cache->count >= DCACHE_MAX_ENTRIES) {
+        free_entries(cache);
+    }
+    entry->next = cache->buckets[entry->hash & cache->mask];
+    cache->buckets[entry->hash & cache->mask] = entry;
+    if (++cache->count > cache->mask + 1) {
+        grow(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
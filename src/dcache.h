@@ -0,0 +1,39 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <pthread.h>
+#include "minix.h"
+
+#define DCACHE_MAX_ENTRIES (1u << 20) /* flushed when it fills up */
+
+/* one cached lookup of name in directory parent. ino 0 records that the
+ * name does not exist there. */
+struct dcache_entry {
+    uint32_t parent;
+    uint32_t ino;
+    uint32_t hash;
+    char name[DIRSIZ];
+    struct dcache_entry *next;
+};
+
+/* safe to share between threads */
+struct dcache {
+    pthread_mutex_t lock;
+    struct dcache_entry **buckets;
+    uint32_t mask;          /* bucket count - 1 */
+    uint32_t count;
+    uint64_t hits;
+    uint64_t negative_hits; /* hits that said "no such entry" */
+    uint64_t misses;
+};
+
+struct dcache *dcache_create(void);
+void dcache_destroy(struct dcache *cache);
+
+/* 1 and *ino set on a hit (0 for a negative entry), 0 on a miss */
+int dcache_lookup(struct dcache *cache, uint32_t parent, const char *name,
+    uint32_t *ino);
+void dcache_insert(struct dcache *cache, uint32_t parent, const char *name,
+    uint32_t ino);
+
+#endif /*DCACHE_H*/
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "digest.h"
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+int digest_parse(const char *name, enum digest_algo *algo) {
+    if (strcmp(name, "sha256") == 0) {
+        *algo = DIGEST_SHA256;
+    } else if (strcmp(name, "xxh64") == 0) {
+        *algo = DIGEST_XXH64;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *digest_name(enum digest_algo algo) {
+    return algo == DIGEST_SHA256 ? "sha256" :
+        algo == DIGEST_XXH64 ? "xxh64" : "none";
+}
+
+const char *digest_impl(enum digest_algo algo) {
+#ifdef HAVE_OPENSSL
+    if (algo == DIGEST_SHA256) {
+        return "libcrypto";
+    }
+#endif
+    return algo == DIGEST_NONE ? "none" : "builtin";
+}
+
+static uint64_t load64_le(const uint8_t *p) {
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static uint32_t load32_le(const uint8_t *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+#ifndef HAVE_OPENSSL
+static uint32_t load32_be(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+        (uint32_t)p[2] << 8 | p[3];
+}
+
+/* SHA-256 (FIPS 180-4) for builds without libcrypto */
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(struct sha256_state *s, const uint8_t *p) {
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = load32_be(p + 4 * i);
+    }
+    for (; i < 64; i++) {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^
+            (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^
+            (w[i - 2] >> 10);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
+    e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
+    for (i = 0; i < 64; i++) {
+        t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+            ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+            ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+    s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+}
+
+static void sha256_init(struct sha256_state *s) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memset(s, 0, sizeof(*s));
+    memcpy(s->h, iv, sizeof(iv));
+}
+
+static void sha256_update(struct sha256_state *s, const uint8_t *p,
+    size_t len) {
+    s->length += len;
+    if (s->used) {
+        size_t take = 64 - s->used < len ? 64 - s->used : len;
+
+        memcpy(s->block + s->used, p, take);
+        s->used += take;
+        p += take;
+        len -= take;
+        if (s->used < 64) {
+            return;
+        }
+        sha256_block(s, s->block);
+        s->used = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+        sha256_block(s, p);
+    }
+    memcpy(s->block, p, len);
+    s->used = len;
+}
+
+static void sha256_final(struct sha256_state *s, uint8_t out[32]) {
+    uint64_t bits = s->length * 8;
+    int i;
+
+    s->block[s->used++] = 0x80;
+    if (s->used > 56) {
+        memset(s->block + s->used, 0, 64 - s->used);
+        sha256_block(s, s->block);
+        s->used = 0;
+    }
+    memset(s->block + s->used, 0, 56 - s->used);
+    for (i = 0; i < 8; i++) {
+        s->block[56 + i] = bits >> (56 - 8 * i);
+    }
+    sha256_block(s, s->block);
+    for (i = 0; i < 8; i++) {
+        out[4 * i] = s->h[i] >> 24;
+        out[4 * i + 1] = s->h[i] >> 16;
+        out[4 * i + 2] = s->h[i] >> 8;
+        out[4 * i + 3] = s->h[i];
+    }
+}
+#endif /* !HAVE_OPENSSL */
+
+/* XXH64 with seed 0, as xxhsum -H64 prints it */
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+#define ROL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    acc = ROL64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh64_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_init(struct xxh64_state *s) {
+    memset(s, 0, sizeof(*s));
+    s->v[0] = XXH_P1 + XXH_P2;
+    s->v[1] = XXH_P2;
+    s->v[2] = 0;
+    s->v[3] = -XXH_P1;
+}
+
+static void xxh64_stripe(struct xxh64_state *s, const uint8_t *p) {
+    s->v[0] = xxh64_round(s->v[0], load64_le(p));
+    s->v[1] = xxh64_round(s->v[1], load64_le(p + 8));
+    s->v[2] = xxh64_round(s->v[2], load64_le(p + 16));
+    s->v[3] = xxh64_round(s->v[3], load64_le(p + 24));
+}
+
+static void xxh64_update(struct xxh64_state *s, const uint8_t *p,
+    size_t len) {
+    s->length += len;
+    if (s->used) {
+        size_t take = 32 - s->used < len ? 32 - s->used : len;
+
+        memcpy(s->stripe + s->used, p, take);
+        s->used += take;
+        p += take;
+        len -= take;
+        if (s->used < 32) {
+            return;
+        }
+        xxh64_stripe(s, s->stripe);
+        s->used = 0;
+    }
+    for (; len >= 32; p += 32, len -= 32) {
+        xxh64_stripe(s, p);
+    }
+    memcpy(s->stripe, p, len);
+    s->used = len;
+}
+
+static uint64_t xxh64_final(const struct xxh64_state *s) {
+    const uint8_t *p = s->stripe, *end = s->stripe + s->used;
+    uint64_t h;
+
+    if (s->length >= 32) {
+        h = ROL64(s->v[0], 1) + ROL64(s->v[1], 7) + ROL64(s->v[2], 12) +
+            ROL64(s->v[3], 18);
+        h = xxh64_merge(h, s->v[0]);
+        h = xxh64_merge(h, s->v[1]);
+        h = xxh64_merge(h, s->v[2]);
+        h = xxh64_merge(h, s->v[3]);
+    } else {
+        h = s->v[2] + XXH_P5;
+    }
+    h += s->length;
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, load64_le(p));
+        h = ROL64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)load32_le(p) * XXH_P1;
+        h = ROL64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * XXH_P5;
+        h = ROL64(h, 11) * XXH_P1;
+    }
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+int digest_init(struct digest *d, enum digest_algo algo) {
+    memset(d, 0, sizeof(*d));
+    d->algo = algo;
+    if (algo == DIGEST_XXH64) {
+        xxh64_init(&d->u.xxh64);
+        return 0;
+    }
+#ifdef HAVE_OPENSSL
+    /* libcrypto picks SHA-NI or AVX2 code for the cpu it runs on */
+    if (!(d->u.evp = EVP_MD_CTX_new()) ||
+        EVP_DigestInit_ex(d->u.evp, EVP_sha256(), NULL) != 1) {
+        fprintf(stderr, "error: cannot set up sha256\n");
+        EVP_MD_CTX_free(d->u.evp);
+        d->algo = DIGEST_NONE;
+        return -1;
+    }
+#else
+    sha256_init(&d->u.sha256);
+#endif
+    return 0;
+}
+
+void digest_update(struct digest *d, const void *data, size_t len) {
+    if (d->algo == DIGEST_XXH64) {
+        xxh64_update(&d->u.xxh64, data, len);
+    } else if (d->algo == DIGEST_SHA256) {
+#ifdef HAVE_OPENSSL
+        EVP_DigestUpdate(d->u.evp, data, len);
+#else
+        sha256_update(&d->u.sha256, data, len);
+#endif
+    }
+}
+
+void digest_zeros(struct digest *d, uint64_t len) {
+    static const uint8_t zeros[65536];
+
+    while (len > 0) {
+        size_t chunk = len < sizeof(zeros) ? len : sizeof(zeros);
+
+        digest_update(d, zeros, chunk);
+        len -= chunk;
+    }
+}
+
+size_t digest_final_raw(struct digest *d, uint8_t raw[DIGEST_MAX_SIZE]) {
+    unsigned len = 0, i;
+
+    if (d->algo == DIGEST_XXH64) {
+        uint64_t h = xxh64_final(&d->u.xxh64);
+
+        for (i = 0; i < 8; i++) {
+            raw[i] = h >> (56 - 8 * i);
+        }
+        len = 8;
+    } else if (d->algo == DIGEST_SHA256) {
+#ifdef HAVE_OPENSSL
+        EVP_DigestFinal_ex(d->u.evp, raw, &len);
+        EVP_MD_CTX_free(d->u.evp);
+#else
+        sha256_final(&d->u.sha256, raw);
+        len = 32;
+#endif
+    }
+    d->algo = DIGEST_NONE;
+    return len;
+}
+
+void digest_final(struct digest *d, char hex[DIGEST_HEX_SIZE]) {
+    uint8_t raw[DIGEST_MAX_SIZE];
+    size_t len = digest_final_raw(d, raw), i;
+
+    for (i = 0; i < len; i++) {
+        sprintf(hex + 2 * i, "%02x", raw[i]);
+    }
+    hex[2 * len] = '\0';
+}
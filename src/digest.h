@@ -0,0 +1,58 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DIGEST_MAX_SIZE 32 /* longest digest in bytes */
+#define DIGEST_HEX_SIZE 65 /* longest hex digest and its terminator */
+
+enum digest_algo {
+    DIGEST_NONE = 0,
+    DIGEST_SHA256,     /* from libcrypto when built with it */
+    DIGEST_XXH64       /* fast, not cryptographic */
+};
+
+/* sha256 for builds without libcrypto */
+struct sha256_state {
+    uint32_t h[8];
+    uint64_t length;       /* bytes so far */
+    uint8_t block[64];
+    uint32_t used;
+};
+
+struct xxh64_state {
+    uint64_t v[4];
+    uint64_t length;
+    uint8_t stripe[32];
+    uint32_t used;
+};
+
+/* a content hash being computed over a stream of bytes */
+struct digest {
+    enum digest_algo algo;
+    union {
+        void *evp;         /* EVP_MD_CTX */
+        struct sha256_state sha256;
+        struct xxh64_state xxh64;
+    } u;
+};
+
+/* "sha256" or "xxh64", -1 for anything else */
+int digest_parse(const char *name, enum digest_algo *algo);
+const char *digest_name(enum digest_algo algo);
+/* where the implementation comes from, for -v output */
+const char *digest_impl(enum digest_algo algo);
+
+int digest_init(struct digest *d, enum digest_algo algo);
+void digest_update(struct digest *d, const void *data, size_t len);
+/* len zero bytes, for a hole */
+void digest_zeros(struct digest *d, uint64_t len);
+/* the digest in lower case hex. This also frees d, so it has to be
+ * called even when the result isn't wanted. */
+void digest_final(struct digest *d, char hex[DIGEST_HEX_SIZE]);
+/* same, as raw bytes (xxh64 big-endian, as its hex reads); returns how
+ * many */
+size_t digest_final_raw(struct digest *d, uint8_t raw[DIGEST_MAX_SIZE]);
+
+#endif /*DIGEST_H*/
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dirindex.h"
+
+struct dir_index *dir_index_create(const struct minix_image *img) {
+    struct dir_index *index = calloc(1, sizeof(*index));
+
+    if (!index) {
+        return NULL;
+    }
+    index->ninodes = img->sb->ninodes;
+    index->tables = calloc((size_t)index->ninodes + 1,
+        sizeof(struct dir_table *));
+    if (!index->tables) {
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+void dir_index_destroy(struct dir_index *index) {
+    uint32_t i;
+
+    if (!index) {
+        return;
+    }
+    for (i = 0; i <= index->ninodes; i++) {
+        free(index->tables[i]);
+    }
+    free(index->tables);
+    free(index);
+}
+
+/* entries gathered by one pass over the directory */
+struct entry_list {
+    struct fileent *entries;
+    uint32_t count;
+    uint32_t cap;
+};
+
+static int collect_entry(const struct fileent *entry, void *arg) {
+    struct entry_list *list = arg;
+
+    if (list->count == list->cap) {
+        uint32_t cap = list->cap ? list->cap * 2 : 64;
+        struct fileent *grown = realloc(list->entries,
+            cap * sizeof(*grown));
+
+        if (!grown) {
+            return 1;
+        }
+        list->entries = grown;
+        list->cap = cap;
+    }
+    list->entries[list->count++] = *entry;
+    return 0;
+}
+
+static struct dir_table *build_table(const struct minix_image *img,
+    const struct inode *dir) {
+    struct entry_list list = { NULL, 0, 0 };
+    struct dir_table *table;
+    uint32_t size = 8, i;
+
+    if (minix_readdir(img, dir, collect_entry, &list) != 0) {
+        free(list.entries);
+        return NULL;
+    }
+    /* keep the load factor at or below one half */
+    while (size < list.count * 2) {
+        size *= 2;
+    }
+    table = calloc(1, sizeof(*table) + size * sizeof(struct dir_slot));
+    if (!table) {
+        free(list.entries);
+        return NULL;
+    }
+    table->mask = size - 1;
+
+    for (i = 0; i < list.count; i++) {
+        const struct fileent *entry = &list.entries[i];
+        uint32_t hash = minix_name_hash(entry->name);
+        uint32_t slot = hash & table->mask;
+
+        /* the first of any duplicate names wins, as in a linear scan */
+        while (table->slots[slot].ino &&
+            !(table->slots[slot].hash == hash &&
+            strncmp(table->slots[slot].name, entry->name, DIRSIZ) == 0)) {
+            slot = (slot + 1) & table->mask;
+        }
+        if (!table->slots[slot].ino) {
+            table->slots[slot].hash = hash;
+            table->slots[slot].ino = entry->ino;
+            memcpy(table->slots[slot].name, entry->name, DIRSIZ);
+            table->count++;
+        }
+    }
+    free(list.entries);
+    return table;
+}
+
+int dir_index_lookup(struct dir_index *index, const struct minix_image *img,
+    uint32_t dir_ino, const struct inode *dir, const char *name,
+    uint32_t *ino) {
+    struct dir_table *table;
+    uint32_t hash, slot;
+
+    if (dir_ino > index->ninodes || strlen(name) > DIRSIZ) {
+        return -1;
+    }
+    if (!(table = index->tables[dir_ino])) {
+        if (!(table = build_table(img, dir))) {
+            return -1;
+        }
+        index->tables[dir_ino] = table;
+        index->built++;
+    }
+
+    hash = minix_name_hash(name);
+    for (slot = hash & table->mask; table->slots[slot].ino;
+        slot = (slot + 1) & table->mask) {
+        if (table->slots[slot].hash == hash &&
+            strncmp(table->slots[slot].name, name, DIRSIZ) == 0) {
+            *ino = table->slots[slot].ino;
+            return 0;
+        }
+    }
+    return -1;
+}
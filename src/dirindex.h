@@ -0,0 +1,35 @@
+#ifndef DIRINDEX_H
+#define DIRINDEX_H
+
+#include "minix.h"
+
+/* open-addressed table of one directory's entries. Names are copied in,
+ * the blocks they came from may be evicted once the table is built. */
+struct dir_slot {
+    uint32_t hash;
+    uint32_t ino;         /* 0 for an empty slot */
+    char name[DIRSIZ];    /* not NUL terminated at full length */
+};
+
+struct dir_table {
+    uint32_t mask;        /* slot count - 1, slot count is a power of 2 */
+    uint32_t count;
+    struct dir_slot slots[];
+};
+
+/* per-image index of directory tables, each built on its first lookup */
+struct dir_index {
+    uint32_t ninodes;
+    struct dir_table **tables;  /* indexed by directory inode number */
+    uint32_t built;             /* directories indexed so far */
+};
+
+struct dir_index *dir_index_create(const struct minix_image *img);
+void dir_index_destroy(struct dir_index *index);
+
+/* like minix_lookup, but hashed; dir_ino must be the number of dir */
+int dir_index_lookup(struct dir_index *index, const struct minix_image *img,
+    uint32_t dir_ino, const struct inode *dir, const char *name,
+    uint32_t *ino);
+
+#endif /*DIRINDEX_H*/
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "dirscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DIRSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef int (*find_fn)(const uint8_t *slots, uint32_t n,
+    const struct dir_key *key);
+typedef void (*live_fn)(const uint8_t *slots, uint32_t n, uint64_t *live);
+
+struct scanner {
+    const char *name;
+    find_fn find;
+    live_fn live;
+    int (*supported)(void);
+};
+
+int dir_key_init(struct dir_key *key, const char *name) {
+    size_t len = strlen(name);
+
+    if (len > DIRSIZ) {
+        return -1;
+    }
+    memset(key, 0, sizeof(*key));
+    /* compare the terminator too, unless the name fills the slot */
+    key->len = len < DIRSIZ ? len + 1 : DIRSIZ;
+    memcpy(key->bytes + sizeof(uint32_t), name, len);
+    memset(key->mask + sizeof(uint32_t), 0xff, key->len);
+    return 0;
+}
+
+static uint32_t slot_ino(const uint8_t *slot) {
+    uint32_t ino;
+
+    memcpy(&ino, slot, sizeof(ino));
+    return ino;
+}
+
+static const uint8_t *slot_at(const uint8_t *slots, uint32_t i) {
+    return slots + (size_t)i * DIRECTORY_ENTRY_SIZE;
+}
+
+static int always(void) {
+    return 1;
+}
+
+static int find_scalar(const uint8_t *slots, uint32_t n,
+    const struct dir_key *key) {
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        const uint8_t *slot = slot_at(slots, i);
+
+        if (slot_ino(slot) && memcmp(slot + sizeof(uint32_t),
+            key->bytes + sizeof(uint32_t), key->len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void live_scalar(const uint8_t *slots, uint32_t n, uint64_t *live) {
+    uint32_t i;
+
+    memset(live, 0, (n + 63) / 64 * sizeof(*live));
+    for (i = 0; i < n; i++) {
+        if (slot_ino(slot_at(slots, i))) {
+            live[i / 64] |= 1ull << (i % 64);
+        }
+    }
+}
+
+#ifdef DIRSCAN_X86
+static int has_sse2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static int has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/* a slot in four 16-byte compares, the first of which (ino and the
+ * first 12 name bytes) turns away nearly every entry on its own */
+__attribute__((target("sse2")))
+static int find_sse2(const uint8_t *slots, uint32_t n,
+    const struct dir_key *key) {
+    __m128i k[4];
+    uint32_t m[4];
+    uint32_t i, j;
+
+    for (j = 0; j < 4; j++) {
+        k[j] = _mm_load_si128((const __m128i *)(key->bytes + 16 * j));
+        m[j] = _mm_movemask_epi8(_mm_load_si128(
+            (const __m128i *)(key->mask + 16 * j)));
+    }
+    for (i = 0; i < n; i++) {
+        const uint8_t *slot = slot_at(slots, i);
+
+        for (j = 0; j < 4; j++) {
+            uint32_t same = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *)(slot + 16 * j)), k[j]));
+
+            if (~same & m[j]) {
+                break;
+            }
+        }
+        if (j == 4 && slot_ino(slot)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* eight slots at a time: gather their ino fields and first four name
+ * bytes, and only compare whole slots for live ones whose prefix
+ * matches */
+__attribute__((target("avx2")))
+static int find_avx2(const uint8_t *slots, uint32_t n,
+    const struct dir_key *key) {
+    const __m256i stride = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96,
+        112);
+    __m256i k0 = _mm256_load_si256((const __m256i *)key->bytes);
+    __m256i k1 = _mm256_load_si256((const __m256i *)(key->bytes + 32));
+    uint32_t m0 = _mm256_movemask_epi8(_mm256_load_si256(
+        (const __m256i *)key->mask));
+    uint32_t m1 = _mm256_movemask_epi8(_mm256_load_si256(
+        (const __m256i *)(key->mask + 32)));
+    uint32_t prefix, prefix_mask, i;
+    __m256i want, want_mask;
+
+    memcpy(&prefix, key->bytes + sizeof(uint32_t), sizeof(prefix));
+    memcpy(&prefix_mask, key->mask + sizeof(uint32_t), sizeof(prefix_mask));
+    want = _mm256_set1_epi32(prefix);
+    want_mask = _mm256_set1_epi32(prefix_mask);
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        const uint8_t *base = slot_at(slots, i);
+        __m256i inos = _mm256_i32gather_epi32((const int *)base, stride, 4);
+        __m256i names = _mm256_i32gather_epi32(
+            (const int *)(base + sizeof(uint32_t)), stride, 4);
+        __m256i hit = _mm256_andnot_si256(
+            _mm256_cmpeq_epi32(inos, _mm256_setzero_si256()),
+            _mm256_cmpeq_epi32(_mm256_and_si256(names, want_mask), want));
+        uint32_t candidates = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+
+        while (candidates) {
+            uint32_t j = __builtin_ctz(candidates);
+            const uint8_t *slot = slot_at(base, j);
+            uint32_t same0 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i *)slot), k0));
+            uint32_t same1 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i *)(slot + 32)), k1));
+
+            if (!(~same0 & m0) && !(~same1 & m1)) {
+                return i + j;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    if (i < n) {
+        int rest = find_scalar(slot_at(slots, i), n - i, key);
+
+        return rest < 0 ? -1 : (int)i + rest;
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static void live_avx2(const uint8_t *slots, uint32_t n, uint64_t *live) {
+    const __m256i stride = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96,
+        112);
+    uint32_t i;
+
+    memset(live, 0, (n + 63) / 64 * sizeof(*live));
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i inos = _mm256_i32gather_epi32(
+            (const int *)slot_at(slots, i), stride, 4);
+        uint32_t empty = _mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpeq_epi32(inos, _mm256_setzero_si256())));
+
+        /* i is a multiple of 8, so the byte never straddles two words */
+        live[i / 64] |= (uint64_t)(~empty & 0xff) << (i % 64);
+    }
+    for (; i < n; i++) {
+        if (slot_ino(slot_at(slots, i))) {
+            live[i / 64] |= 1ull << (i % 64);
+        }
+    }
+}
+#endif
+
+/* best first */
+static const struct scanner scanners[] = {
+#ifdef DIRSCAN_X86
+    { "avx2", find_avx2, live_avx2, has_avx2 },
+    { "sse2", find_sse2, live_scalar, has_sse2 },
+#endif
+    { "scalar", find_scalar, live_scalar, always },
+};
+
+#define NSCANNERS (sizeof(scanners) / sizeof(scanners[0]))
+
+static const struct scanner *current;
+static pthread_once_t picked = PTHREAD_ONCE_INIT;
+
+static void pick_best(void) {
+    size_t i;
+
+    for (i = 0; i < NSCANNERS; i++) {
+        if (scanners[i].supported()) {
+            current = &scanners[i];
+            return;
+        }
+    }
+}
+
+static const struct scanner *scanner(void) {
+    pthread_once(&picked, pick_best);
+    return current;
+}
+
+int dirscan_find(const uint8_t *slots, uint32_t n,
+    const struct dir_key *key) {
+    return scanner()->find(slots, n, key);
+}
+
+void dirscan_live(const uint8_t *slots, uint32_t n, uint64_t *live) {
+    scanner()->live(slots, n, live);
+}
+
+const char *dirscan_impl(void) {
+    return scanner()->name;
+}
+
+int dirscan_select(const char *name) {
+    size_t i;
+
+    pthread_once(&picked, pick_best);
+    if (!name) {
+        pick_best();
+        return 0;
+    }
+    for (i = 0; i < NSCANNERS; i++) {
+        if (strcmp(scanners[i].name, name) == 0) {
+            if (!scanners[i].supported()) {
+                return -1;
+            }
+            current = &scanners[i];
+            return 0;
+        }
+    }
+    return -1;
+}
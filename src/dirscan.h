@@ -0,0 +1,37 @@
+#ifndef DIRSCAN_H
+#define DIRSCAN_H
+
+#include "minix.h"
+
+/* most directory slots one block can hold (blocksize is 16 bits) */
+#define DIRSCAN_MAX_SLOTS (65536 / DIRECTORY_ENTRY_SIZE)
+
+/* a name laid out like a whole 64-byte directory slot, so a slot can be
+ * compared in a few vector operations. mask marks the bytes that count:
+ * the name and its terminator, not the ino field or whatever follows the
+ * terminator, matching strncmp(entry->name, name, DIRSIZ). */
+struct dir_key {
+    uint8_t bytes[DIRECTORY_ENTRY_SIZE] __attribute__((aligned(32)));
+    uint8_t mask[DIRECTORY_ENTRY_SIZE] __attribute__((aligned(32)));
+    uint32_t len;              /* name bytes compared, terminator included */
+};
+
+/* -1 when name is longer than DIRSIZ */
+int dir_key_init(struct dir_key *key, const char *name);
+
+/* index of the first live slot of n matching key, -1 when none does */
+int dirscan_find(const uint8_t *slots, uint32_t n, const struct dir_key *key);
+
+/* set bit i of live[i / 64] for every slot with a nonzero ino, clearing
+ * the rest of the (n + 63) / 64 words */
+void dirscan_live(const uint8_t *slots, uint32_t n, uint64_t *live);
+
+/* the scanner in use: "avx2", "sse2" or "scalar", picked from what the
+ * cpu supports the first time one is needed */
+const char *dirscan_impl(void);
+
+/* use a particular scanner, NULL for the best one; -1 when it isn't
+ * built in or the cpu can't run it */
+int dirscan_select(const char *name);
+
+#endif /*DIRSCAN_H*/
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include "duptable.h"
+
+#define MAX_BUCKETS 65536       /* past this the write buffers get tiny */
+#define MIN_BUFFER 16           /* records per chunk at the least */
+#define READ_RECORDS 4096       /* records read back per call */
+#define MIN_SLOTS 1024
+
+/* where some of a bucket's records went in the spill file */
+struct dup_chunk {
+    uint64_t off;
+    uint64_t records;
+};
+
+/* records of one key range: the chunks written so far and what is
+ * waiting to go after them */
+struct dup_bucket {
+    struct dup_record *buf;
+    size_t used;
+    struct dup_chunk *chunks;
+    uint32_t nchunks;
+    uint32_t chunks_cap;
+    uint64_t records;           /* in the spill file */
+};
+
+static uint64_t key_top(const uint8_t *key) {
+    uint64_t v = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        v = v << 8 | key[i];
+    }
+    return v;
+}
+
+int dup_tmpfile(const char *dir) {
+    char path[PATH_MAX];
+    int fd;
+
+    if (!dir && !(dir = getenv("TMPDIR"))) {
+        dir = "/tmp";
+    }
+    if (snprintf(path, sizeof(path), "%s/minix-dup.XXXXXX", dir) >=
+        (int)sizeof(path)) {
+        fprintf(stderr, "error: scratch directory path too long\n");
+        return -1;
+    }
+    if ((fd = mkstemp(path)) < 0) {
+        perror(path);
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+static void add_counts(struct dup_record *into,
+    const struct dup_record *rec, void *arg) {
+    (void)arg;
+    into->count += rec->count;
+    into->value += rec->value;
+}
+
+int dup_table_open(struct dup_table *t, const char *dir, uint64_t expected,
+    size_t memory, dup_merge_fn merge, void *merge_arg) {
+    /* a loaded bucket takes up to two slots per record */
+    uint64_t per_bucket = memory / (2 * sizeof(struct dup_record));
+
+    memset(t, 0, sizeof(*t));
+    t->fd = -1;
+    t->merge = merge ? merge : add_counts;
+    t->merge_arg = merge_arg;
+    t->memory = memory;
+    t->nbuckets = 1;
+    t->shift = 64;
+    while (t->nbuckets < MAX_BUCKETS &&
+        expected > per_bucket * t->nbuckets) {
+        t->nbuckets *= 2;
+        t->shift--;
+    }
+    /* a quarter of the limit goes on write buffers */
+    t->buffer_records = memory / 4 / t->nbuckets / sizeof(struct dup_record);
+    if (t->buffer_records < MIN_BUFFER) {
+        t->buffer_records = MIN_BUFFER;
+    }
+    if (!(t->buckets = calloc(t->nbuckets, sizeof(*t->buckets)))) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    if ((t->fd = dup_tmpfile(dir)) < 0) {
+        free(t->buckets);
+        t->buckets = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* append b's buffer to the spill file as one more chunk of it */
+static int flush_bucket(struct dup_table *t, struct dup_bucket *b) {
+    const uint8_t *p = (const uint8_t *)b->buf;
+    size_t left = b->used * sizeof(*b->buf);
+    uint64_t off = t->spilled;
+
+    if (b->nchunks == b->chunks_cap) {
+        uint32_t cap = b->chunks_cap ? b->chunks_cap * 2 : 8;
+        struct dup_chunk *grown = realloc(b->chunks, cap * sizeof(*grown));
+
+        if (!grown) {
+            fprintf(stderr, "error: out of memory\n");
+            return -1;
+        }
+        b->chunks = grown;
+        b->chunks_cap = cap;
+    }
+    while (left > 0) {
+        ssize_t n = pwrite(t->fd, p, left, off);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("error: writing dedup table");
+            return -1;
+        }
+        p += n;
+        off += n;
+        left -= n;
+    }
+    b->chunks[b->nchunks].off = t->spilled;
+    b->chunks[b->nchunks].records = b->used;
+    b->nchunks++;
+    t->spilled = off;
+    b->records += b->used;
+    b->used = 0;
+    return 0;
+}
+
+int dup_table_add(struct dup_table *t, const struct dup_record *rec) {
+    struct dup_bucket *b = &t->buckets[t->nbuckets == 1 ? 0 :
+        key_top(rec->key) >> t->shift];
+
+    if (!b->buf && !(b->buf = malloc(t->buffer_records * sizeof(*b->buf)))) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    b->buf[b->used++] = *rec;
+    t->records++;
+    return b->used == t->buffer_records ? flush_bucket(t, b) : 0;
+}
+
+static int by_key(const void *a, const void *b) {
+    const struct dup_record *x = a, *y = b;
+    int c = memcmp(x->key, y->key, DUP_KEY_SIZE);
+
+    if (c != 0) {
+        return c;
+    }
+    if (x->fs != y->fs) {
+        return x->fs < y->fs ? -1 : 1;
+    }
+    return x->value < y->value ? -1 : x->value > y->value;
+}
+
+/* open addressing table a bucket is merged into; a slot with count 0 is
+ * free */
+struct slots {
+    struct dup_record *slot;
+    size_t mask;
+    size_t used;
+};
+
+static size_t slot_of(const struct dup_record *rec, size_t mask) {
+    uint64_t h, low;
+
+    /* the top bits picked the bucket, so mix all of it */
+    memcpy(&low, rec->key + 8, sizeof(low));
+    h = (key_top(rec->key) ^ low ^ rec->fs) * 0x9e3779b97f4a7c15ULL;
+    return (h ^ h >> 29) & mask;
+}
+
+static void slots_put(const struct dup_table *t, struct slots *s,
+    const struct dup_record *rec) {
+    size_t i = slot_of(rec, s->mask);
+
+    while (s->slot[i].count != 0) {
+        struct dup_record *cur = &s->slot[i];
+
+        if (cur->fs == rec->fs &&
+            memcmp(cur->key, rec->key, DUP_KEY_SIZE) == 0) {
+            t->merge(cur, rec, t->merge_arg);
+            return;
+        }
+        i = (i + 1) & s->mask;
+    }
+    s->slot[i] = *rec;
+    s->used++;
+}
+
+static int slots_grow(const struct dup_table *t, struct slots *s) {
+    struct slots bigger;
+    size_t i;
+
+    bigger.mask = s->mask * 2 + 1;
+    bigger.used = 0;
+    if (!(bigger.slot = calloc(bigger.mask + 1, sizeof(*bigger.slot)))) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    for (i = 0; i <= s->mask; i++) {
+        if (s->slot[i].count != 0) {
+            slots_put(t, &bigger, &s->slot[i]);
+        }
+    }
+    free(s->slot);
+    *s = bigger;
+    return 0;
+}
+
+/* the records of b, merged, into *recs */
+static int load_bucket(const struct dup_table *t, struct dup_bucket *b,
+    struct dup_record **recs, size_t *count) {
+    struct dup_record chunk[READ_RECORDS];
+    struct slots s;
+    size_t want = MIN_SLOTS, i, n;
+    uint32_t c;
+    ssize_t got;
+
+    /* a free slot for every record, but no more than memory allows; a
+     * bucket of mostly repeats merges into far fewer */
+    while (want < b->records * 2 &&
+        want * 2 * sizeof(struct dup_record) <= t->memory) {
+        want *= 2;
+    }
+    s.mask = want - 1;
+    s.used = 0;
+    if (!(s.slot = calloc(want, sizeof(*s.slot)))) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+
+    for (c = 0; c < b->nchunks; c++) {
+        uint64_t off = b->chunks[c].off, left = b->chunks[c].records;
+
+        while (left > 0) {
+            n = left < READ_RECORDS ? left : READ_RECORDS;
+            got = pread(t->fd, chunk, n * sizeof(*chunk), off);
+            if (got != (ssize_t)(n * sizeof(*chunk))) {
+                fprintf(stderr, "error: short read from dedup table\n");
+                free(s.slot);
+                return -1;
+            }
+            for (i = 0; i < n; i++) {
+                if ((s.used + 1) * 2 > s.mask + 1 && slots_grow(t, &s) != 0) {
+                    free(s.slot);
+                    return -1;
+                }
+                slots_put(t, &s, &chunk[i]);
+            }
+            off += n * sizeof(*chunk);
+            left -= n;
+        }
+    }
+
+    /* squeeze the free slots out */
+    for (i = 0, n = 0; i <= s.mask; i++) {
+        if (s.slot[i].count != 0) {
+            s.slot[n++] = s.slot[i];
+        }
+    }
+    *recs = s.slot;
+    *count = s.used;
+    return 0;
+}
+
+int dup_table_scan(struct dup_table *t, dup_group_fn fn, void *arg) {
+    uint32_t i;
+
+    for (i = 0; i < t->nbuckets; i++) {
+        if (t->buckets[i].used > 0 &&
+            flush_bucket(t, &t->buckets[i]) != 0) {
+            return -1;
+        }
+        free(t->buckets[i].buf);
+        t->buckets[i].buf = NULL;
+    }
+    for (i = 0; i < t->nbuckets; i++) {
+        struct dup_record *recs;
+        size_t count, start, end;
+        int stop = 0;
+
+        if (load_bucket(t, &t->buckets[i], &recs, &count) != 0) {
+            return -1;
+        }
+        qsort(recs, count, sizeof(*recs), by_key);
+        for (start = 0; start < count && !stop; start = end) {
+            end = start + 1;
+            while (end < count &&
+                memcmp(recs[end].key, recs[start].key, DUP_KEY_SIZE) == 0) {
+                end++;
+            }
+            stop = fn(&recs[start], end - start, arg);
+        }
+        free(recs);
+        if (stop) {
+            break;
+        }
+    }
+    return 0;
+}
+
+void dup_table_close(struct dup_table *t) {
+    uint32_t i;
+
+    for (i = 0; t->buckets && i < t->nbuckets; i++) {
+        free(t->buckets[i].buf);
+        free(t->buckets[i].chunks);
+    }
+    free(t->buckets);
+    t->buckets = NULL;
+    if (t->fd >= 0) {
+        close(t->fd);
+        t->fd = -1;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef DUPTABLE_H
+#define DUPTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DUP_KEY_SIZE 16 /* content hash bytes a record is keyed by */
+
+/* one piece of content seen in filesystem fs. Records of the same key
+ * and fs are merged as the table is read back, so however many there
+ * are, they cost one record per filesystem in memory. */
+struct dup_record {
+    uint8_t key[DUP_KEY_SIZE];
+    uint32_t fs;
+    uint32_t count;
+    uint64_t value;
+};
+
+/* fold rec into into, which has the same key and fs */
+typedef void (*dup_merge_fn)(struct dup_record *into,
+    const struct dup_record *rec, void *arg);
+
+/* records spilled to disk in buckets by the top bits of their key, with
+ * enough buckets that any one of them, once merged, fits the memory
+ * limit. All the buckets share one spill file, each written in chunks as
+ * its buffer fills, so adding only ever appends, reading a bucket back
+ * is a pass over its chunks, and the table takes one descriptor however
+ * many buckets it has. */
+struct dup_table {
+    dup_merge_fn merge;
+    void *merge_arg;
+    int fd;                    /* the spill file */
+    uint64_t spilled;          /* bytes written to it */
+    uint32_t nbuckets;         /* a power of two */
+    uint32_t shift;            /* 64 - log2(nbuckets) */
+    size_t memory;             /* for the table of one bucket */
+    size_t buffer_records;     /* records buffered per bucket */
+    struct dup_bucket *buckets;
+    uint64_t records;          /* added so far */
+};
+
+/* a file for scratch data in dir (TMPDIR or /tmp when NULL), already
+ * unlinked so it goes away with the descriptor; -1 on failure */
+int dup_tmpfile(const char *dir);
+
+/* a table for at most expected records, using about memory bytes at a
+ * time, spilling to a file in dir. merge NULL adds up count and value. */
+int dup_table_open(struct dup_table *t, const char *dir, uint64_t expected,
+    size_t memory, dup_merge_fn merge, void *merge_arg);
+int dup_table_add(struct dup_table *t, const struct dup_record *rec);
+
+/* called with every set of records sharing a key, ordered by fs and
+ * then value. Stop early by returning nonzero. */
+typedef int (*dup_group_fn)(const struct dup_record *recs, size_t count,
+    void *arg);
+
+/* read back each bucket in turn and hand fn its groups */
+int dup_table_scan(struct dup_table *t, dup_group_fn fn, void *arg);
+void dup_table_close(struct dup_table *t);
+
+#endif /*DUPTABLE_H*/
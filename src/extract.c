@@ -0,0 +1,820 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include "extract.h"
+#include "zonemap.h"
+#include "readahead.h"
+#include "workq.h"
+#include "digest.h"
+
+/* a run being hashed is hashed and copied this much at a time, so what
+ * the hash just read is still cached when the copy reads it */
+#define DIGEST_CHUNK (1024 * 1024)
+
+/* how bytes get from the image to the destination, picked once per file
+ * from the destination type and downgraded if the kernel refuses */
+enum copy_method {
+    COPY_RANGE,  /* regular file: in-kernel copy, may share extents */
+    COPY_SEND,   /* pipe or socket: sendfile from the image fd */
+    COPY_WRITE   /* anything else: plain write() out of the image blocks */
+};
+
+static enum copy_method pick_method(int dst_fd) {
+#ifdef __linux__
+    struct stat st;
+
+    if (fstat(dst_fd, &st) == 0) {
+        if (S_ISREG(st.st_mode)) {
+            return COPY_RANGE;
+        }
+        if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)) {
+            return COPY_SEND;
+        }
+    }
+#endif
+    return COPY_WRITE;
+}
+
+/* holes can stay holes only in a regular file we are extending: seeking
+ * past EOF reads back as zeros without writing or allocating anything */
+static int sparse_destination(int dst_fd) {
+    struct stat st;
+    int flags = fcntl(dst_fd, F_GETFL);
+    off_t pos = lseek(dst_fd, 0, SEEK_CUR);
+
+    return flags >= 0 && !(flags & O_APPEND) && pos >= 0 &&
+        fstat(dst_fd, &st) == 0 && S_ISREG(st.st_mode) && pos >= st.st_size;
+}
+
+/* the kernel can't do this copy for us, fall back to write() */
+static int unsupported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS ||
+        err == EOPNOTSUPP || err == EBADF;
+}
+
+/* write a buffer to dst_fd, at *dst_off if given (advancing it) */
+static int write_all(int dst_fd, off_t *dst_off, const uint8_t *data,
+    uint64_t len, struct extract_stats *stats) {
+    while (len > 0) {
+        ssize_t n = dst_off ? pwrite(dst_fd, data, len, *dst_off) :
+            write(dst_fd, data, len);
+
+        stats->syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            return -1;
+        }
+        if (dst_off) {
+            *dst_off += n;
+        }
+        data += n;
+        len -= n;
+        stats->bytes += n;
+    }
+    return 0;
+}
+
+/* copy_run for a cached image: one block at a time through the cache,
+ * which read-ahead fills in larger reads ahead of us */
+static int copy_blocks(const struct minix_image *img, struct ra_file *ra,
+    uint64_t file_pos, int dst_fd, off_t *dst_off, uint64_t pos,
+    uint64_t len, struct digest *digest, struct extract_stats *stats) {
+    uint32_t blocksize = img->sb->blocksize;
+    uint32_t block = (pos - img->offset) / blocksize;
+
+    while (len > 0) {
+        uint64_t chunk = len < blocksize ? len : blocksize;
+        struct minix_buf buf;
+        int rc;
+
+        ra_file_read(img, ra, file_pos, chunk);
+        file_pos += chunk;
+        if (minix_get_block(img, block++, &buf) != 0) {
+            fprintf(stderr, "error: short read from image\n");
+            return -1;
+        }
+        if (digest) {
+            digest_update(digest, buf.data, chunk);
+        }
+        rc = 0;
+        if (dst_fd >= 0) {
+            rc = write_all(dst_fd, dst_off, buf.data, chunk, stats);
+        } else {
+            stats->bytes += chunk;
+        }
+        minix_put_block(img, &buf);
+        if (rc != 0) {
+            return -1;
+        }
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* copy_run for a mapped image, letting the kernel move the bytes when
+ * the destination allows */
+static int copy_mapped(const struct minix_image *img,
+    enum copy_method *method, int dst_fd, off_t *dst_off, uint64_t pos,
+    uint64_t len, struct extract_stats *stats) {
+    while (len > 0) {
+        ssize_t n;
+#ifdef __linux__
+        off_t src = pos;
+
+        if (*method == COPY_RANGE) {
+            n = copy_file_range(img->fd, &src, dst_fd, dst_off, len, 0);
+        } else if (*method == COPY_SEND && !dst_off) {
+            n = sendfile(dst_fd, img->fd, &src, len);
+        } else
+#endif
+        if (dst_off) {
+            n = pwrite(dst_fd, img->map + pos, len, *dst_off);
+            if (n > 0) {
+                *dst_off += n;
+            }
+        } else {
+            n = write(dst_fd, img->map + pos, len);
+        }
+        stats->syscalls++;
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (*method != COPY_WRITE && unsupported(errno)) {
+                *method = COPY_WRITE;
+                continue;
+            }
+            perror("write");
+            return -1;
+        }
+        if (n == 0) {
+            fprintf(stderr, "error: short read from image\n");
+            return -1;
+        }
+        pos += n;
+        len -= n;
+        stats->bytes += n;
+    }
+    return 0;
+}
+
+/* move len bytes starting at absolute image offset pos to dst_fd, at
+ * *dst_off if given (advancing it) or else at the file position. ra, if
+ * given, is told these are the bytes at file_pos of the file. digest, if
+ * given, is fed the bytes too; with dst_fd -1 that is all that happens
+ * to them. */
+static int copy_run(const struct minix_image *img, enum copy_method *method,
+    struct ra_file *ra, uint64_t file_pos, int dst_fd, off_t *dst_off,
+    uint64_t pos, uint64_t len, struct digest *digest,
+    struct extract_stats *stats) {
+    if (!img->map) {
+        return copy_blocks(img, ra, file_pos, dst_fd, dst_off, pos, len,
+            digest, stats);
+    }
+    ra_file_read(img, ra, file_pos, len);
+    if (!digest) {
+        return copy_mapped(img, method, dst_fd, dst_off, pos, len, stats);
+    }
+    while (len > 0) {
+        uint64_t piece = len < DIGEST_CHUNK ? len : DIGEST_CHUNK;
+
+        digest_update(digest, img->map + pos, piece);
+        if (dst_fd < 0) {
+            stats->bytes += piece;
+        } else if (copy_mapped(img, method, dst_fd, dst_off, pos, piece,
+            stats) != 0) {
+            return -1;
+        }
+        pos += piece;
+        len -= piece;
+    }
+    return 0;
+}
+
+/* len bytes of a hole: a seek on a sparse destination, zeros otherwise */
+static int emit_hole(int dst_fd, int sparse, uint64_t len,
+    struct digest *digest, struct extract_stats *stats) {
+    static const uint8_t zeros[65536];
+
+    stats->hole_bytes += len;
+    if (digest) {
+        digest_zeros(digest, len);
+    }
+    if (dst_fd < 0) {
+        return 0;
+    }
+    if (sparse) {
+        stats->syscalls++;
+        if (lseek(dst_fd, len, SEEK_CUR) < 0) {
+            perror("lseek");
+            return -1;
+        }
+        return 0;
+    }
+    while (len > 0) {
+        ssize_t n = write(dst_fd, zeros, len < sizeof(zeros) ?
+            len : sizeof(zeros));
+
+        stats->syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+/* copy one extent of a file of size bytes, or skip over it if a hole */
+static int extract_extent(const struct minix_image *img,
+    const struct zone_extent *ext, uint64_t size, enum copy_method *method,
+    struct ra_file *ra, int dst_fd, int sparse, struct digest *digest,
+    struct extract_stats *stats) {
+    uint64_t pos = ext->file_zone * img->zone_size;
+    uint64_t len = (uint64_t)ext->length * img->zone_size;
+
+    if (pos >= size) {
+        return 0;
+    }
+    if (len > size - pos) {
+        len = size - pos;
+    }
+    if (ext->hole) {
+        return emit_hole(dst_fd, sparse, len, digest, stats);
+    }
+    if (copy_run(img, method, ra, pos, dst_fd, NULL, img->offset +
+        (uint64_t)ext->start * img->zone_size, len, digest, stats) != 0) {
+        return -1;
+    }
+    stats->runs++;
+    return 0;
+}
+
+/* a file ending in a hole needs its size set explicitly */
+static int finish_sparse(int dst_fd, struct extract_stats *stats) {
+    off_t end = lseek(dst_fd, 0, SEEK_CUR);
+
+    stats->syscalls++;
+    if (end < 0 || ftruncate(dst_fd, end) != 0) {
+        perror("ftruncate");
+        return -1;
+    }
+    return 0;
+}
+
+int minix_extract_digest(const struct minix_image *img,
+    const struct inode *inode, int dst_fd, struct digest *digest,
+    struct extract_stats *stats) {
+    struct extract_stats local;
+    enum copy_method method = pick_method(dst_fd);
+    int sparse = sparse_destination(dst_fd);
+    int trailing_hole = 0;
+    struct zone_map map;
+    struct zone_extent ext;
+    struct ra_file ra;
+    int rc;
+
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    /* each extent is already a maximal contiguous run or hole */
+    zone_map_init(&map, img, inode);
+    ra_file_init(&ra, img, inode);
+    while ((rc = zone_map_next(&map, &ext)) == 1) {
+        trailing_hole = ext.hole;
+        if (extract_extent(img, &ext, inode->size, &method, &ra, dst_fd,
+            sparse, digest, stats) != 0) {
+            rc = -1;
+            break;
+        }
+    }
+    stats->indirect_reads = map.indirect_reads;
+    zone_map_release(&map);
+    ra_file_release(&ra);
+    if (rc < 0) {
+        return -1;
+    }
+    if (sparse && trailing_hole) {
+        return finish_sparse(dst_fd, stats);
+    }
+    return 0;
+}
+
+int minix_extract(const struct minix_image *img, const struct inode *inode,
+    int dst_fd, struct extract_stats *stats) {
+    return minix_extract_digest(img, inode, dst_fd, NULL, stats);
+}
+
+int minix_extract_extents(const struct minix_image *img, uint64_t size,
+    const struct zone_extent *extents, uint32_t count, int dst_fd,
+    struct extract_stats *stats) {
+    struct extract_stats local;
+    enum copy_method method = pick_method(dst_fd);
+    int sparse = sparse_destination(dst_fd);
+    struct ra_file ra;
+    uint32_t i;
+
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+    ra_file_init_extents(&ra, img, size, extents, count);
+    for (i = 0; i < count; i++) {
+        if ((!extents[i].hole && (!minix_zone_valid(img, extents[i].start) ||
+            !minix_zone_valid(img, extents[i].start + extents[i].length -
+            1))) ||
+            extract_extent(img, &extents[i], size, &method, &ra, dst_fd,
+            sparse, NULL, stats) != 0) {
+            ra_file_release(&ra);
+            return -1;
+        }
+    }
+    ra_file_release(&ra);
+    if (sparse && count > 0 && extents[count - 1].hole) {
+        return finish_sparse(dst_fd, stats);
+    }
+    return 0;
+}
+
+/* append the chunks covering len bytes of the image at src, bound for
+ * dst, to *chunks */
+static int add_chunks(struct aio_chunk **chunks, size_t *n, size_t *cap,
+    uint64_t src, uint64_t dst, uint64_t len) {
+    while (len > 0) {
+        uint32_t part = len < AIO_CHUNK_SIZE ? len : AIO_CHUNK_SIZE;
+
+        if (*n == *cap) {
+            size_t grown_cap = *cap ? *cap * 2 : 64;
+            struct aio_chunk *grown = realloc(*chunks,
+                grown_cap * sizeof(*grown));
+
+            if (!grown) {
+                fprintf(stderr, "error: out of memory\n");
+                return -1;
+            }
+            *chunks = grown;
+            *cap = grown_cap;
+        }
+        (*chunks)[*n].src_off = src;
+        (*chunks)[*n].dst_off = dst;
+        (*chunks)[*n].len = part;
+        (*n)++;
+        src += part;
+        dst += part;
+        len -= part;
+    }
+    return 0;
+}
+
+int minix_extract_async(const struct minix_image *img,
+    const struct inode *inode, int dst_fd, struct aio *aio,
+    struct extract_stats *stats) {
+    struct extract_stats local;
+    struct aio_stats before = aio->stats;
+    struct aio_chunk *chunks = NULL;
+    size_t n = 0, cap = 0;
+    int trailing_hole = 0;
+    struct zone_map map;
+    struct zone_extent ext;
+    off_t base;
+    int rc;
+
+    if (!sparse_destination(dst_fd)) {
+        return minix_extract(img, inode, dst_fd, stats);
+    }
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+    base = lseek(dst_fd, 0, SEEK_CUR);
+
+    /* holes are simply never written */
+    zone_map_init(&map, img, inode);
+    while ((rc = zone_map_next(&map, &ext)) == 1) {
+        uint64_t pos = ext.file_zone * img->zone_size;
+        uint64_t len = (uint64_t)ext.length * img->zone_size;
+
+        if (pos >= inode->size) {
+            continue;
+        }
+        if (len > inode->size - pos) {
+            len = inode->size - pos;
+        }
+        trailing_hole = ext.hole;
+        if (ext.hole) {
+            stats->hole_bytes += len;
+            continue;
+        }
+        stats->runs++;
+        if (add_chunks(&chunks, &n, &cap, img->offset +
+            (uint64_t)ext.start * img->zone_size, base + pos, len) != 0) {
+            rc = -1;
+            break;
+        }
+    }
+    stats->indirect_reads = map.indirect_reads;
+    zone_map_release(&map);
+    if (rc == 0) {
+        rc = aio_copy(aio, img->fd, dst_fd, chunks, n);
+    }
+    free(chunks);
+    stats->bytes = aio->stats.bytes - before.bytes;
+    stats->syscalls = aio->stats.syscalls - before.syscalls;
+    if (rc != 0) {
+        return -1;
+    }
+
+    /* the writes went by offset, leave the file position at the end */
+    stats->syscalls++;
+    if (lseek(dst_fd, base + inode->size, SEEK_SET) < 0) {
+        perror("lseek");
+        return -1;
+    }
+    if (trailing_hole) {
+        return finish_sparse(dst_fd, stats);
+    }
+    return 0;
+}
+
+/* one data extent of a batch, positioned in both image and file */
+struct batch_extent {
+    uint32_t zone;        /* first disk zone */
+    uint32_t job;         /* index into the jobs array */
+    uint64_t file_pos;    /* byte offset within the file */
+    uint64_t len;         /* bytes, clamped to the file size */
+};
+
+static int by_zone(const void *a, const void *b) {
+    const struct batch_extent *x = a, *y = b;
+
+    return x->zone < y->zone ? -1 : x->zone > y->zone;
+}
+
+int minix_extract_batch(const struct minix_image *img,
+    const struct extract_job *jobs, uint32_t njobs,
+    struct extract_stats *stats) {
+    struct extract_stats local;
+    struct batch_extent *extents = NULL;
+    uint32_t count = 0, cap = 0, i;
+    enum copy_method method = COPY_RANGE;
+    int status = 0;
+
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    /* gather the data extents of every file */
+    for (i = 0; i < njobs; i++) {
+        const struct inode *inode = jobs[i].inode;
+        struct zone_map map;
+        struct zone_extent ext;
+        int rc;
+
+        zone_map_init(&map, img, inode);
+        while ((rc = zone_map_next(&map, &ext)) == 1) {
+            uint64_t pos = ext.file_zone * img->zone_size;
+            uint64_t len = (uint64_t)ext.length * img->zone_size;
+
+            if (len > inode->size - pos) {
+                len = inode->size - pos;
+            }
+            if (ext.hole) {
+                stats->hole_bytes += len;
+                continue;
+            }
+            if (count == cap) {
+                struct batch_extent *grown;
+
+                cap = cap ? cap * 2 : 256;
+                if (!(grown = realloc(extents, cap * sizeof(*grown)))) {
+                    fprintf(stderr, "error: out of memory\n");
+                    zone_map_release(&map);
+                    free(extents);
+                    return -1;
+                }
+                extents = grown;
+            }
+            extents[count].zone = ext.start;
+            extents[count].job = i;
+            extents[count].file_pos = pos;
+            extents[count].len = len;
+            count++;
+        }
+        stats->indirect_reads += map.indirect_reads;
+        zone_map_release(&map);
+        if (rc < 0) {
+            status = -1;
+        }
+    }
+
+    /* one sweep across the image in disk order */
+    qsort(extents, count, sizeof(*extents), by_zone);
+    for (i = 0; i < count; i++) {
+        off_t dst_off = extents[i].file_pos;
+
+        if (copy_run(img, &method, NULL, 0, jobs[extents[i].job].dst_fd,
+            &dst_off, img->offset + (uint64_t)extents[i].zone *
+            img->zone_size, extents[i].len, NULL, stats) != 0) {
+            status = -1;
+        }
+        stats->runs++;
+    }
+    free(extents);
+
+    /* holes and trailing holes come from setting the final size */
+    for (i = 0; i < njobs; i++) {
+        stats->syscalls++;
+        if (ftruncate(jobs[i].dst_fd, jobs[i].inode->size) != 0) {
+            perror("ftruncate");
+            status = -1;
+        }
+    }
+    return status;
+}
+
+static void add_stats(struct extract_stats *total,
+    const struct extract_stats *stats) {
+    total->bytes += stats->bytes;
+    total->hole_bytes += stats->hole_bytes;
+    total->runs += stats->runs;
+    total->syscalls += stats->syscalls;
+    total->indirect_reads += stats->indirect_reads;
+}
+
+/* one file of a recursive extraction, handed to a worker */
+struct tree_job {
+    struct inode inode;
+    char *dst;
+};
+
+/* shared by the walking thread and the extraction workers */
+struct tree {
+    const struct minix_image *img;
+    struct workq queue;
+    int threaded;                 /* else the walker extracts files itself */
+    pthread_mutex_t lock;         /* guards total, status and idle */
+    struct extract_stats total;
+    int status;
+    struct aio *aios;             /* one per worker with a queue depth */
+    struct aio **idle;            /* those no worker holds */
+    int naios;
+    int nidle;
+    /* walker-only state, merged into the above once the workers are
+     * done */
+    int walk_status;
+    uint32_t dirs;
+    uint8_t *seen;                /* directories already walked */
+    char path[PATH_MAX];
+    size_t len;
+    size_t base;                  /* length of the dstdir part of path */
+    size_t root_len;              /* digest->root less trailing slashes */
+    int verbose;
+    const struct tree_digest *digest;
+};
+
+static void extract_tree_file(void *item, void *arg) {
+    struct tree_job *job = item;
+    struct tree *tree = arg;
+    const struct tree_digest *td = tree->digest;
+    struct extract_stats stats;
+    struct digest digest, *dp = NULL;
+    char hex[DIGEST_HEX_SIZE];
+    int status = -1;
+    int fd = -1;
+
+    memset(&stats, 0, sizeof(stats));
+    if (!td || digest_init(&digest, td->algo) == 0) {
+        dp = td ? &digest : NULL;
+        if (td && td->only) {
+            status = minix_extract_digest(tree->img, &job->inode, -1, dp,
+                &stats);
+        } else if ((fd = open(job->dst, O_WRONLY | O_CREAT | O_TRUNC,
+            0666)) < 0) {
+            perror(job->dst);
+        } else if (!dp && tree->aios) {
+            struct aio *aio;
+
+            pthread_mutex_lock(&tree->lock);
+            aio = tree->idle[--tree->nidle];
+            pthread_mutex_unlock(&tree->lock);
+            status = minix_extract_async(tree->img, &job->inode, fd, aio,
+                &stats);
+            pthread_mutex_lock(&tree->lock);
+            tree->idle[tree->nidle++] = aio;
+            pthread_mutex_unlock(&tree->lock);
+            close(fd);
+        } else {
+            status = minix_extract_digest(tree->img, &job->inode, fd, dp,
+                &stats);
+            close(fd);
+        }
+    }
+    if (dp) {
+        digest_final(dp, hex);
+    }
+
+    pthread_mutex_lock(&tree->lock);
+    add_stats(&tree->total, &stats);
+    tree->total.files++;
+    if (status != 0) {
+        tree->status = -1;
+    } else if (td) {
+        fprintf(td->out, "%s  %.*s%s\n", hex, (int)tree->root_len, td->root,
+            job->dst + tree->base);
+    }
+    pthread_mutex_unlock(&tree->lock);
+    free(job->dst);
+    free(job);
+}
+
+static void walk_tree(struct tree *tree, const struct inode *dir);
+
+static int walk_tree_entry(const struct fileent *entry, void *arg) {
+    struct tree *tree = arg;
+    struct inode inode;
+    size_t saved = tree->len;
+    int n;
+
+    if (strncmp(entry->name, ".", DIRSIZ) == 0 ||
+        strncmp(entry->name, "..", DIRSIZ) == 0 ||
+        memchr(entry->name, '/', strnlen(entry->name, DIRSIZ))) {
+        return 0;
+    }
+    n = snprintf(tree->path + saved, sizeof(tree->path) - saved, "/%.*s",
+        DIRSIZ, entry->name);
+    if (n < 0 || (size_t)n >= sizeof(tree->path) - saved) {
+        fprintf(stderr, "error: path too long under %s\n", tree->path);
+        tree->walk_status = -1;
+        return 0;
+    }
+    tree->len += n;
+
+    if (minix_read_inode(tree->img, entry->ino, &inode) != 0) {
+        fprintf(stderr, "%s: bad inode number %u\n", tree->path, entry->ino);
+        tree->walk_status = -1;
+    } else if (MINIX_ISDIR(inode.mode)) {
+        if (!tree->seen[entry->ino]) {
+            tree->seen[entry->ino] = 1;
+            if ((!tree->digest || !tree->digest->only) &&
+                mkdir(tree->path, 0777) != 0 && errno != EEXIST) {
+                perror(tree->path);
+                tree->walk_status = -1;
+            } else {
+                tree->dirs++;
+                walk_tree(tree, &inode);
+            }
+        }
+    } else if (MINIX_ISREG(inode.mode)) {
+        struct tree_job *job = malloc(sizeof(*job));
+
+        if (!job || !(job->dst = strdup(tree->path))) {
+            fprintf(stderr, "error: out of memory\n");
+            free(job);
+            tree->walk_status = -1;
+        } else {
+            job->inode = inode;
+            if (!tree->threaded) {
+                extract_tree_file(job, tree);
+            } else if (workq_push(&tree->queue, job) != 0) {
+                free(job->dst);
+                free(job);
+                tree->walk_status = -1;
+            }
+        }
+    } else if (tree->verbose) {
+        fprintf(stderr, "%s: skipping, not a file or directory\n",
+            tree->path);
+    }
+
+    tree->len = saved;
+    tree->path[saved] = '\0';
+    return 0;
+}
+
+static void walk_tree(struct tree *tree, const struct inode *dir) {
+    if (minix_readdir(tree->img, dir, walk_tree_entry, tree) < 0) {
+        tree->walk_status = -1;
+    }
+}
+
+/* an engine of depth for each of the workers, or the walker */
+static int start_aios(struct tree *tree, int nthreads, unsigned depth) {
+    int n = nthreads > 0 ? nthreads : 1;
+
+    tree->aios = calloc(n, sizeof(*tree->aios));
+    tree->idle = calloc(n, sizeof(*tree->idle));
+    if (!tree->aios || !tree->idle) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    for (tree->naios = 0; tree->naios < n; tree->naios++) {
+        if (aio_init(&tree->aios[tree->naios], depth, 0) != 0) {
+            return -1;
+        }
+        tree->idle[tree->nidle++] = &tree->aios[tree->naios];
+    }
+    return 0;
+}
+
+static void stop_aios(struct tree *tree) {
+    int i;
+
+    for (i = 0; i < tree->naios; i++) {
+        aio_destroy(&tree->aios[i]);
+    }
+    free(tree->aios);
+    free(tree->idle);
+}
+
+int minix_extract_tree(const struct minix_image *img, uint32_t dir_ino,
+    const char *dstdir, int nthreads, unsigned depth, int verbose,
+    const struct tree_digest *digest, struct extract_stats *stats) {
+    struct tree tree;
+    struct inode dir;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(&tree, 0, sizeof(tree));
+    tree.img = img;
+    tree.verbose = verbose;
+    tree.digest = digest;
+    tree.threaded = nthreads > 0;
+    if (digest && digest->only) {
+        dstdir = "";
+    }
+    if (digest) {
+        tree.root_len = strlen(digest->root);
+        while (tree.root_len > 0 && digest->root[tree.root_len - 1] == '/') {
+            tree.root_len--;
+        }
+    }
+    tree.len = tree.base = strlen(dstdir);
+    if (tree.len >= sizeof(tree.path)) {
+        fprintf(stderr, "error: destination path too long\n");
+        return -1;
+    }
+    memcpy(tree.path, dstdir, tree.len + 1);
+    if ((!digest || !digest->only) && mkdir(dstdir, 0777) != 0 &&
+        errno != EEXIST) {
+        perror(dstdir);
+        return -1;
+    }
+    if (!(tree.seen = calloc((size_t)img->sb->ninodes + 1, 1))) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    tree.seen[dir_ino] = 1;
+    if (minix_read_inode(img, dir_ino, &dir) != 0) {
+        fprintf(stderr, "error: bad inode number %u\n", dir_ino);
+        free(tree.seen);
+        return -1;
+    }
+    /* hashing reads each file in order, so only copies are queued */
+    if (depth && !digest && start_aios(&tree, nthreads, depth) != 0) {
+        stop_aios(&tree);
+        free(tree.seen);
+        return -1;
+    }
+    pthread_mutex_init(&tree.lock, NULL);
+
+    if (tree.threaded && workq_start(&tree.queue, nthreads,
+        extract_tree_file, &tree) != 0) {
+        stop_aios(&tree);
+        free(tree.seen);
+        pthread_mutex_destroy(&tree.lock);
+        return -1;
+    }
+    walk_tree(&tree, &dir);
+    if (tree.threaded) {
+        workq_finish(&tree.queue);
+    }
+
+    tree.total.dirs += tree.dirs;
+    if (tree.walk_status != 0) {
+        tree.status = -1;
+    }
+    *stats = tree.total;
+    stop_aios(&tree);
+    free(tree.seen);
+    pthread_mutex_destroy(&tree.lock);
+    return tree.status;
+}
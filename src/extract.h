@@ -0,0 +1,77 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include "minix.h"
+#include "zonemap.h"
+#include "aio.h"
+#include "digest.h"
+
+/* what an extraction did, reported by minget -v */
+struct extract_stats {
+    uint64_t bytes;     /* data bytes copied to the destination */
+    uint64_t hole_bytes; /* bytes of holes, seeked over when possible */
+    uint32_t runs;      /* physically contiguous zone runs */
+    uint32_t syscalls;  /* write-side system calls issued */
+    uint32_t indirect_reads; /* indirect blocks resolved */
+    uint32_t files;     /* files written, for a tree */
+    uint32_t dirs;      /* directories made, for a tree */
+};
+
+/* copy the contents of a regular file inode to dst_fd, coalescing
+ * adjacent zones into single large transfers. Holes become seeks when
+ * dst_fd is a regular file and zeros otherwise. stats may be NULL. */
+int minix_extract(const struct minix_image *img, const struct inode *inode,
+    int dst_fd, struct extract_stats *stats);
+
+/* same, feeding the file's contents (zeros for holes) to digest as
+ * they go by. With dst_fd -1 nothing is written; the file is only
+ * hashed. */
+int minix_extract_digest(const struct minix_image *img,
+    const struct inode *inode, int dst_fd, struct digest *digest,
+    struct extract_stats *stats);
+
+/* same, from an extent list already worked out (say by a sidecar
+ * index) instead of the inode's zone pointers */
+int minix_extract_extents(const struct minix_image *img, uint64_t size,
+    const struct zone_extent *extents, uint32_t count, int dst_fd,
+    struct extract_stats *stats);
+
+/* same, keeping up to aio->depth zone reads in flight and writing each
+ * at its own offset as it completes. That needs a regular file being
+ * extended; other destinations go through minix_extract. */
+int minix_extract_async(const struct minix_image *img,
+    const struct inode *inode, int dst_fd, struct aio *aio,
+    struct extract_stats *stats);
+
+/* one file of a batch; dst_fd must be an empty regular file */
+struct extract_job {
+    const struct inode *inode;
+    int dst_fd;
+};
+
+/* extract several files at once, issuing every data extent of every file
+ * in on-disk zone order so the image is read in a single forward sweep */
+int minix_extract_batch(const struct minix_image *img,
+    const struct extract_job *jobs, uint32_t njobs,
+    struct extract_stats *stats);
+
+/* hashing of the files minix_extract_tree extracts */
+struct tree_digest {
+    enum digest_algo algo;
+    const char *root;   /* dir_ino's path in the image, to name files by */
+    FILE *out;          /* gets a "hex  path" line per file */
+    int only;           /* hash without writing anything; dstdir unused */
+};
+
+/* reproduce the directory dir_ino under dstdir: one thread walks it
+ * and nthreads workers extract the files it finds, or with nthreads 0
+ * the walking thread extracts them as it goes. A nonzero depth gives
+ * each worker an aio engine of that depth to copy its files with, as
+ * minix_extract_async does. With verbose, entries that are neither
+ * files nor directories are reported as skipped. digest, if not NULL,
+ * has each file hashed on the way, in order and without the engines. */
+int minix_extract_tree(const struct minix_image *img, uint32_t dir_ino,
+    const char *dstdir, int nthreads, unsigned depth, int verbose,
+    const struct tree_digest *digest, struct extract_stats *stats);
+
+#endif /*EXTRACT_H*/
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "jsonout.h"
+
+#define JSON_FIELD_MAX 512 /* most one field can add, names included */
+
+void json_init(struct json_out *out, int fd) {
+    out->fd = fd;
+    out->error = 0;
+    out->first = 1;
+    out->len = 0;
+}
+
+int json_flush(struct json_out *out) {
+    size_t done = 0;
+
+    while (!out->error && done < out->len) {
+        ssize_t n = write(out->fd, out->buf + done, out->len - done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("write");
+            out->error = 1;
+            break;
+        }
+        done += n;
+    }
+    out->len = 0;
+    return out->error ? -1 : 0;
+}
+
+/* make room for a field of up to JSON_FIELD_MAX bytes */
+static void reserve(struct json_out *out) {
+    if (out->len > JSON_BUF_SIZE - JSON_FIELD_MAX) {
+        json_flush(out);
+    }
+}
+
+static void put(struct json_out *out, const char *s, size_t n) {
+    memcpy(out->buf + out->len, s, n);
+    out->len += n;
+}
+
+static void put_char(struct json_out *out, char c) {
+    out->buf[out->len++] = c;
+}
+
+static void put_uint(struct json_out *out, uint64_t value) {
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n > 0) {
+        put_char(out, digits[--n]);
+    }
+}
+
+static void put_key(struct json_out *out, const char *key) {
+    reserve(out);
+    if (!out->first) {
+        put_char(out, ',');
+    }
+    out->first = 0;
+    put_char(out, '"');
+    put(out, key, strlen(key));
+    put(out, "\":", 2);
+}
+
+void json_begin(struct json_out *out) {
+    reserve(out);
+    put_char(out, '{');
+    out->first = 1;
+}
+
+void json_end(struct json_out *out) {
+    reserve(out);
+    put(out, "}\n", 2);
+}
+
+void json_uint(struct json_out *out, const char *key, uint64_t value) {
+    put_key(out, key);
+    put_uint(out, value);
+}
+
+void json_int(struct json_out *out, const char *key, int64_t value) {
+    put_key(out, key);
+    if (value < 0) {
+        put_char(out, '-');
+        put_uint(out, -(uint64_t)value);
+    } else {
+        put_uint(out, value);
+    }
+}
+
+void json_str(struct json_out *out, const char *key, const char *s,
+    size_t maxlen) {
+    static const char hex[] = "0123456789abcdef";
+    size_t i;
+
+    put_key(out, key);
+    put_char(out, '"');
+    for (i = 0; i < maxlen && s[i]; i++) {
+        unsigned char c = s[i];
+
+        /* worst case every byte becomes a six byte escape */
+        if (out->len > JSON_BUF_SIZE - 8) {
+            json_flush(out);
+        }
+        if (c == '"' || c == '\\') {
+            put_char(out, '\\');
+            put_char(out, c);
+        } else if (c < 0x20 || c > 0x7e) {
+            put(out, "\\u00", 4);
+            put_char(out, hex[c >> 4]);
+            put_char(out, hex[c & 0xf]);
+        } else {
+            put_char(out, c);
+        }
+    }
+    reserve(out);
+    put_char(out, '"');
+}
+
+void json_array(struct json_out *out, const char *key) {
+    put_key(out, key);
+    put_char(out, '[');
+    out->first = 1;
+}
+
+void json_array_uints(struct json_out *out, const uint64_t *values,
+    int count) {
+    int i;
+
+    reserve(out);
+    if (!out->first) {
+        put_char(out, ',');
+    }
+    put_char(out, '[');
+    out->first = 0;
+    for (i = 0; i < count; i++) {
+        if (i) {
+            put_char(out, ',');
+        }
+        put_uint(out, values[i]);
+    }
+    put_char(out, ']');
+}
+
+void json_array_end(struct json_out *out) {
+    reserve(out);
+    put_char(out, ']');
+    out->first = 0;
+}
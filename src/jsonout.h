@@ -0,0 +1,41 @@
+#ifndef JSONOUT_H
+#define JSONOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_BUF_SIZE (1 << 16)
+
+/* buffered writer of one JSON object per line. Fields are formatted by
+ * hand straight into the buffer, which is written out with write(2) only
+ * when full, so memory stays constant however many records go out. */
+struct json_out {
+    int fd;
+    int error;                /* a write failed, later output is dropped */
+    int first;                /* next field opens the object */
+    size_t len;
+    char buf[JSON_BUF_SIZE];
+};
+
+void json_init(struct json_out *out, int fd);
+int json_flush(struct json_out *out);
+
+/* start and finish a record; fields go in between */
+void json_begin(struct json_out *out);
+void json_end(struct json_out *out);
+
+void json_uint(struct json_out *out, const char *key, uint64_t value);
+void json_int(struct json_out *out, const char *key, int64_t value);
+/* at most maxlen bytes of s, escaped; bytes past 0x7f come out as
+ * \u00XX so names that aren't UTF-8 still make valid JSON */
+void json_str(struct json_out *out, const char *key, const char *s,
+    size_t maxlen);
+
+/* "key":[ then small [a,b,...] elements with json_array_uints, then
+ * json_array_end */
+void json_array(struct json_out *out, const char *key);
+void json_array_uints(struct json_out *out, const uint64_t *values,
+    int count);
+void json_array_end(struct json_out *out);
+
+#endif /*JSONOUT_H*/
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "listing.h"
+#include "zonemap.h"
+#include "jsonout.h"
+
+const char *get_permissions(uint16_t mode, char perms[PERMS_SIZE]) {
+    perms[0] = MINIX_ISDIR(mode) ? 'd' : '-';
+    perms[1] = (mode & OWR_PERMISSION) ? 'r' : '-';
+    perms[2] = (mode & OWW_PERMISSION) ? 'w' : '-';
+    perms[3] = (mode & OWE_PERMISSION) ? 'x' : '-';
+    perms[4] = (mode & GR_PERMISSION) ? 'r' : '-';
+    perms[5] = (mode & GW_PERMISSION) ? 'w' : '-';
+    perms[6] = (mode & GE_PERMISSION) ? 'x' : '-';
+    perms[7] = (mode & OTR_PERMISSION) ? 'r' : '-';
+    perms[8] = (mode & OTW_PERMISSION) ? 'w' : '-';
+    perms[9] = (mode & OTE_PERMISSION) ? 'x' : '-';
+    perms[10] = '\0';
+    return perms;
+}
+
+void print_listing(FILE *out, const struct inode *inode, const char *name) {
+    char perms[PERMS_SIZE];
+
+    fprintf(out, "%s %5u %.*s\n", get_permissions(inode->mode, perms),
+        inode->size, DIRSIZ, name);
+}
+
+/* where print_entry lists to */
+struct listing {
+    const struct minix_image *img;
+    FILE *out;
+};
+
+/* print one directory entry along with its inode */
+static int print_entry(const struct fileent *entry, void *arg) {
+    const struct listing *listing = arg;
+    struct inode inode;
+
+    if (minix_read_inode(listing->img, entry->ino, &inode) != 0) {
+        fprintf(stderr, "error: bad inode number %u\n", entry->ino);
+        return 0;
+    }
+    print_listing(listing->out, &inode, entry->name);
+    return 0;
+}
+
+void list_directory(FILE *out, const struct minix_image *img,
+    const struct inode *dir_inode, const char *path) {
+    struct listing listing = { img, out };
+
+    fprintf(out, "%s:\n", path);
+    minix_readdir(img, dir_inode, print_entry, &listing);
+}
+
+/* a directory waiting to be listed in the next level of a -R walk */
+struct pending_dir {
+    char *path;
+    uint32_t ino;
+};
+
+/* one entry of a level, in directory order */
+struct level_entry {
+    char name[DIRSIZ];        /* copied, the block may be evicted */
+    uint32_t ino;
+    uint32_t dir;             /* index of its directory in the level */
+    struct inode inode;       /* copied out during the sorted sweep */
+    int valid;
+};
+
+/* everything found while reading one level's directories */
+struct level {
+    struct level_entry *entries;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t dir;             /* directory currently being read */
+};
+
+static int collect_level_entry(const struct fileent *entry, void *arg) {
+    struct level *level = arg;
+
+    if (level->count == level->cap) {
+        uint32_t cap = level->cap ? level->cap * 2 : 256;
+        struct level_entry *grown = realloc(level->entries,
+            cap * sizeof(*grown));
+        if (!grown) {
+            fprintf(stderr, "error: out of memory\n");
+            return 1;
+        }
+        level->entries = grown;
+        level->cap = cap;
+    }
+    memcpy(level->entries[level->count].name, entry->name, DIRSIZ);
+    level->entries[level->count].ino = entry->ino;
+    level->entries[level->count].dir = level->dir;
+    level->entries[level->count].valid = 0;
+    level->count++;
+    return 0;
+}
+
+static int by_ino(const void *a, const void *b) {
+    const struct level_entry *x = *(struct level_entry * const *)a;
+    const struct level_entry *y = *(struct level_entry * const *)b;
+
+    return x->ino < y->ino ? -1 : x->ino > y->ino;
+}
+
+/* fetch every inode of the level in inode number order so the inode
+ * table is swept front to back once, return the table blocks touched */
+static uint32_t sweep_inodes(const struct minix_image *img,
+    struct level *level, uint32_t *inodes_read) {
+    struct level_entry **order = malloc(level->count * sizeof(*order));
+    uint32_t per_block = img->sb->blocksize / INODE_SIZE;
+    uint32_t blocks = 0, last_block = UINT32_MAX, i;
+
+    if (!order) {
+        fprintf(stderr, "error: out of memory\n");
+        return 0;
+    }
+    for (i = 0; i < level->count; i++) {
+        order[i] = &level->entries[i];
+    }
+    qsort(order, level->count, sizeof(*order), by_ino);
+
+    for (i = 0; i < level->count; i++) {
+        if (minix_read_inode(img, order[i]->ino, &order[i]->inode) != 0) {
+            continue;
+        }
+        if ((order[i]->ino - 1) / per_block != last_block) {
+            last_block = (order[i]->ino - 1) / per_block;
+            blocks++;
+        }
+        order[i]->valid = 1;
+        (*inodes_read)++;
+    }
+    free(order);
+    return blocks;
+}
+
+static char *join_path(const char *dir, const char *name) {
+    size_t len = strlen(dir);
+    char *path = malloc(len + DIRSIZ + 2);
+
+    if (path) {
+        sprintf(path, "%s%s%.*s", dir, (len && dir[len - 1] == '/') ?
+            "" : "/", DIRSIZ, name);
+    }
+    return path;
+}
+
+void list_tree(FILE *out, const struct minix_image *img, uint32_t root,
+    const char *path, int verbose) {
+    struct pending_dir *dirs = malloc(sizeof(*dirs));
+    uint32_t ndirs = 1, d, i;
+    uint32_t levels = 0, blocks = 0, inodes_read = 0;
+    uint8_t *seen = calloc((size_t)img->sb->ninodes + 1, 1);
+
+    if (!dirs || !seen || !(dirs[0].path = strdup(path))) {
+        fprintf(stderr, "error: out of memory\n");
+        free(dirs);
+        free(seen);
+        return;
+    }
+    dirs[0].ino = root;
+    seen[root] = 1;
+
+    while (ndirs > 0) {
+        struct level level = { NULL, 0, 0, 0 };
+        struct pending_dir *next = NULL;
+        uint32_t nnext = 0, next_cap = 0;
+
+        for (d = 0; d < ndirs; d++) {
+            struct inode dir;
+
+            level.dir = d;
+            if (minix_read_inode(img, dirs[d].ino, &dir) == 0) {
+                minix_readdir(img, &dir, collect_level_entry, &level);
+            }
+        }
+        blocks += sweep_inodes(img, &level, &inodes_read);
+        levels++;
+
+        /* print in directory order, queue subdirectories for the next */
+        for (d = 0, i = 0; d < ndirs; d++) {
+            fprintf(out, "%s%s:\n", d || levels > 1 ? "\n" : "",
+                dirs[d].path);
+            for (; i < level.count && level.entries[i].dir == d; i++) {
+                struct level_entry *entry = &level.entries[i];
+
+                if (!entry->valid) {
+                    fprintf(stderr, "error: bad inode number %u\n",
+                        entry->ino);
+                    continue;
+                }
+                print_listing(out, &entry->inode, entry->name);
+                if (!MINIX_ISDIR(entry->inode.mode) || seen[entry->ino] ||
+                    strncmp(entry->name, ".", DIRSIZ) == 0 ||
+                    strncmp(entry->name, "..", DIRSIZ) == 0) {
+                    continue;
+                }
+                seen[entry->ino] = 1;
+                if (nnext == next_cap) {
+                    uint32_t cap = next_cap ? next_cap * 2 : 64;
+                    struct pending_dir *grown = realloc(next,
+                        cap * sizeof(*grown));
+
+                    if (!grown) {
+                        fprintf(stderr, "error: out of memory\n");
+                        continue;
+                    }
+                    next = grown;
+                    next_cap = cap;
+                }
+                if ((next[nnext].path = join_path(dirs[d].path,
+                    entry->name))) {
+                    next[nnext++].ino = entry->ino;
+                }
+            }
+            free(dirs[d].path);
+        }
+        free(level.entries);
+        free(dirs);
+        dirs = next;
+        ndirs = nnext;
+    }
+    free(dirs);
+    free(seen);
+
+    if (verbose) {
+        fprintf(out, "\ntree: %u levels, %u inodes read from %u inode table "
+            "block visits\n", levels, inodes_read, blocks);
+    }
+}
+
+/* state for a -j inventory walk, depth first so memory stays flat */
+struct inventory {
+    const struct minix_image *img;
+    struct json_out *out;
+    const char *fs;           /* tags each record when not NULL */
+    uint8_t *seen;            /* directories already walked */
+    int recursive;
+    uint64_t records;
+    char path[4096];
+    size_t len;
+};
+
+static const char *file_type(uint16_t mode) {
+    if (MINIX_ISDIR(mode)) {
+        return "dir";
+    }
+    if (MINIX_ISREG(mode)) {
+        return "file";
+    }
+    return "other";
+}
+
+/* one NDJSON line describing path; extents are [file zone, disk zone,
+ * zones] with disk zone 0 for a hole */
+static void inventory_record(struct inventory *inv, uint32_t ino,
+    const struct inode *inode) {
+    struct json_out *out = inv->out;
+    const char *type = file_type(inode->mode);
+    struct zone_map map;
+    struct zone_extent ext;
+
+    json_begin(out);
+    if (inv->fs) {
+        json_str(out, "fs", inv->fs, strlen(inv->fs));
+    }
+    json_str(out, "path", inv->path, inv->len);
+    json_uint(out, "ino", ino);
+    json_str(out, "type", type, strlen(type));
+    json_uint(out, "mode", inode->mode);
+    json_uint(out, "links", inode->links);
+    json_uint(out, "uid", inode->uid);
+    json_uint(out, "gid", inode->gid);
+    json_uint(out, "size", inode->size);
+    json_int(out, "atime", inode->atime);
+    json_int(out, "mtime", inode->mtime);
+    json_int(out, "ctime", inode->c_time);
+    json_array(out, "extents");
+    if (MINIX_ISDIR(inode->mode) || MINIX_ISREG(inode->mode)) {
+        zone_map_init(&map, inv->img, inode);
+        while (zone_map_next(&map, &ext) == 1) {
+            uint64_t fields[3] = { ext.file_zone, ext.start, ext.length };
+
+            json_array_uints(out, fields, 3);
+        }
+        zone_map_release(&map);
+    }
+    json_array_end(out);
+    json_end(out);
+    inv->records++;
+}
+
+static void inventory_dir(struct inventory *inv, const struct inode *dir);
+
+static int inventory_entry(const struct fileent *entry, void *arg) {
+    struct inventory *inv = arg;
+    size_t saved = inv->len;
+    struct inode inode;
+    int n;
+
+    if (strncmp(entry->name, ".", DIRSIZ) == 0 ||
+        strncmp(entry->name, "..", DIRSIZ) == 0) {
+        return 0;
+    }
+    n = snprintf(inv->path + saved, sizeof(inv->path) - saved, "%s%.*s",
+        saved && inv->path[saved - 1] == '/' ? "" : "/", DIRSIZ,
+        entry->name);
+    if (n < 0 || (size_t)n >= sizeof(inv->path) - saved) {
+        fprintf(stderr, "error: path too long under %s\n", inv->path);
+        inv->path[saved] = '\0';
+        return 0;
+    }
+    inv->len += n;
+
+    if (minix_read_inode(inv->img, entry->ino, &inode) != 0) {
+        fprintf(stderr, "%s: bad inode number %u\n", inv->path, entry->ino);
+    } else {
+        inventory_record(inv, entry->ino, &inode);
+        if (inv->recursive && MINIX_ISDIR(inode.mode) &&
+            !inv->seen[entry->ino]) {
+            inv->seen[entry->ino] = 1;
+            inventory_dir(inv, &inode);
+        }
+    }
+    inv->len = saved;
+    inv->path[saved] = '\0';
+    return 0;
+}
+
+static void inventory_dir(struct inventory *inv, const struct inode *dir) {
+    minix_readdir(inv->img, dir, inventory_entry, inv);
+}
+
+int print_inventory(int fd, const struct minix_image *img, uint32_t ino,
+    const struct inode *inode, const char *path, int recursive,
+    const char *fs) {
+    struct json_out *out = malloc(sizeof(*out));
+    struct inventory inv;
+    int status;
+
+    memset(&inv, 0, sizeof(inv));
+    inv.img = img;
+    inv.out = out;
+    inv.fs = fs;
+    inv.recursive = recursive;
+    inv.len = strlen(path);
+    inv.seen = calloc((size_t)img->sb->ninodes + 1, 1);
+    if (!out || !inv.seen || inv.len >= sizeof(inv.path)) {
+        fprintf(stderr, "error: out of memory\n");
+        free(out);
+        free(inv.seen);
+        return -1;
+    }
+    memcpy(inv.path, path, inv.len + 1);
+    json_init(out, fd);
+
+    inventory_record(&inv, ino, inode);
+    if (MINIX_ISDIR(inode->mode)) {
+        inv.seen[ino] = 1;
+        inventory_dir(&inv, inode);
+    }
+    status = json_flush(out);
+    free(out);
+    free(inv.seen);
+    return status;
+}
@@ -0,0 +1,30 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stdio.h>
+#include "minix.h"
+
+#define PERMS_SIZE 11 /* "drwxr-xr-x" and its terminator */
+
+/* ls style permissions of mode, written into perms and returned */
+const char *get_permissions(uint16_t mode, char perms[PERMS_SIZE]);
+
+/* one "perms size name" line */
+void print_listing(FILE *out, const struct inode *inode, const char *name);
+
+/* path's own entries, under a "path:" line */
+void list_directory(FILE *out, const struct minix_image *img,
+    const struct inode *dir_inode, const char *path);
+
+/* list path and everything below it breadth first, one level at a time */
+void list_tree(FILE *out, const struct minix_image *img, uint32_t root,
+    const char *path, int verbose);
+
+/* NDJSON inventory of path and, for a directory, what is in it (all of
+ * it when recursive) written to fd. Records start with "fs":fs when fs
+ * isn't NULL, to tell filesystems apart in a merged stream. */
+int print_inventory(int fd, const struct minix_image *img, uint32_t ino,
+    const struct inode *inode, const char *path, int recursive,
+    const char *fs);
+
+#endif /*LISTING_H*/
@@ -0,0 +1,612 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "minix.h"
+#include "dirindex.h"
+#include "extract.h"
+#include "dirscan.h"
+#include "zonemap.h"
+#include "aio.h"
+
+void print_usage() {
+    printf("Usage: minbench [-m] [-C blocks] [-p part [-s sub]] [-n rounds] "
+        "imagefile\n");
+}
+
+/* every path in the image, gathered once up front */
+struct path_list {
+    char **paths;
+    uint32_t count;
+    uint32_t cap;
+};
+
+/* inode numbers of the directories or regular files in the image */
+struct ino_list {
+    uint32_t *inos;
+    uint32_t count;
+    uint32_t cap;
+};
+
+struct walk {
+    const struct minix_image *img;
+    struct path_list *list;
+    struct ino_list *dirs;
+    struct ino_list *files;
+    uint8_t *seen;              /* directories already walked */
+    char path[4096];
+    size_t len;
+};
+
+/* one timed workload, printed by report */
+struct result {
+    const char *workload;
+    uint64_t ops;               /* paths, entries or files handled */
+    uint64_t bytes;             /* file data moved, 0 if none */
+    uint64_t syscalls;          /* read/write calls made, if known */
+    double secs;
+};
+
+static int add_path(struct path_list *list, const char *path) {
+    if (list->count == list->cap) {
+        uint32_t cap = list->cap ? list->cap * 2 : 256;
+        char **grown = realloc(list->paths, cap * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        list->paths = grown;
+        list->cap = cap;
+    }
+    if (!(list->paths[list->count] = strdup(path))) {
+        return -1;
+    }
+    list->count++;
+    return 0;
+}
+
+static int add_ino(struct ino_list *list, uint32_t ino) {
+    if (list->count == list->cap) {
+        uint32_t cap = list->cap ? list->cap * 2 : 256;
+        uint32_t *grown = realloc(list->inos, cap * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        list->inos = grown;
+        list->cap = cap;
+    }
+    list->inos[list->count++] = ino;
+    return 0;
+}
+
+static void walk_dir(struct walk *walk, const struct inode *dir);
+
+static int walk_entry(const struct fileent *entry, void *arg) {
+    struct walk *walk = arg;
+    struct inode inode;
+    size_t saved = walk->len;
+    int n;
+
+    if (strncmp(entry->name, ".", DIRSIZ) == 0 ||
+        strncmp(entry->name, "..", DIRSIZ) == 0) {
+        return 0;
+    }
+    n = snprintf(walk->path + saved, sizeof(walk->path) - saved, "/%.*s",
+        DIRSIZ, entry->name);
+    if (n < 0 || (size_t)n >= sizeof(walk->path) - saved) {
+        return 0;
+    }
+    walk->len += n;
+    add_path(walk->list, walk->path);
+
+    if (minix_read_inode(walk->img, entry->ino, &inode) == 0) {
+        if (MINIX_ISDIR(inode.mode) && !walk->seen[entry->ino]) {
+            walk->seen[entry->ino] = 1;
+            add_ino(walk->dirs, entry->ino);
+            walk_dir(walk, &inode);
+        } else if (MINIX_ISREG(inode.mode)) {
+            add_ino(walk->files, entry->ino);
+        }
+    }
+    walk->len = saved;
+    walk->path[saved] = '\0';
+    return 0;
+}
+
+static void walk_dir(struct walk *walk, const struct inode *dir) {
+    minix_readdir(walk->img, dir, walk_entry, walk);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* read and write calls made by this process so far, 0 where the kernel
+ * doesn't keep count for us */
+static uint64_t syscalls_so_far(void) {
+    FILE *io = fopen("/proc/self/io", "r");
+    char line[128];
+    unsigned long long n, total = 0;
+
+    if (!io) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), io)) {
+        if (sscanf(line, "syscr: %llu", &n) == 1 ||
+            sscanf(line, "syscw: %llu", &n) == 1) {
+            total += n;
+        }
+    }
+    fclose(io);
+    return total;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;  /* bytes there, kilobytes elsewhere */
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+/* reads syscalls_so_far itself makes, taken off every measurement */
+static uint64_t probe_cost;
+
+static void calibrate(void) {
+    uint64_t before = syscalls_so_far();
+
+    probe_cost = syscalls_so_far() - before;
+}
+
+static void start(struct result *result, const char *workload) {
+    memset(result, 0, sizeof(*result));
+    result->workload = workload;
+    result->syscalls = syscalls_so_far();
+    result->secs = now();
+}
+
+static void stop(struct result *result) {
+    result->secs = now() - result->secs;
+    result->syscalls = syscalls_so_far() - result->syscalls;
+    result->syscalls -= result->syscalls < probe_cost ?
+        result->syscalls : probe_cost;
+}
+
+/* resolve every path rounds times */
+static void bench_lookup(const struct minix_image *img,
+    const struct path_list *list, int rounds, struct result *result) {
+    uint32_t ino;
+    int r;
+    uint32_t i;
+
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < list->count; i++) {
+            if (minix_resolve(img, list->paths[i], &ino) != 0) {
+                fprintf(stderr, "error: lost path %s\n", list->paths[i]);
+            }
+        }
+    }
+    result->ops = (uint64_t)list->count * rounds;
+}
+
+struct list_walk {
+    const struct minix_image *img;
+    uint64_t entries;
+};
+
+static int list_entry(const struct fileent *entry, void *arg) {
+    struct list_walk *walk = arg;
+    struct inode inode;
+
+    if (minix_read_inode(walk->img, entry->ino, &inode) == 0) {
+        walk->entries++;
+    }
+    return 0;
+}
+
+/* what minls -l does to each directory: read it and every entry's inode */
+static void bench_list(const struct minix_image *img,
+    const struct ino_list *dirs, int rounds, struct result *result) {
+    struct list_walk walk = { img, 0 };
+    struct inode dir;
+    uint32_t i;
+    int r;
+
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < dirs->count; i++) {
+            if (minix_read_inode(img, dirs->inos[i], &dir) == 0) {
+                minix_readdir(img, &dir, list_entry, &walk);
+            }
+        }
+    }
+    result->ops = walk.entries;
+}
+
+/* the scanners to compare, best first */
+static const struct {
+    const char *impl;
+    const char *miss;
+    const char *readdir;
+} scanners[] = {
+    { "avx2", "dirscan-avx2", "readdir-avx2" },
+    { "sse2", "dirscan-sse2", "readdir-sse2" },
+    { "scalar", "dirscan-scalar", "readdir-scalar" },
+};
+
+/* look every directory through for a name it doesn't hold, so each slot
+ * gets compared; ops are slots scanned */
+static void bench_dirscan(const struct minix_image *img,
+    const struct ino_list *dirs, int rounds, struct result *result) {
+    struct inode dir;
+    uint32_t ino, i;
+    int r;
+
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < dirs->count; i++) {
+            if (minix_read_inode(img, dirs->inos[i], &dir) == 0 &&
+                minix_lookup(img, &dir, "minbench-missing-name", &ino) != 0) {
+                result->ops += dir.size / DIRECTORY_ENTRY_SIZE;
+            }
+        }
+    }
+}
+
+static int count_entry(const struct fileent *entry, void *arg) {
+    (*(uint64_t *)arg)++;
+    return 0;
+}
+
+/* just the live entries of every directory, no inodes */
+static void bench_readdir(const struct minix_image *img,
+    const struct ino_list *dirs, int rounds, struct result *result) {
+    struct inode dir;
+    uint32_t i;
+    int r;
+
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < dirs->count; i++) {
+            if (minix_read_inode(img, dirs->inos[i], &dir) == 0) {
+                minix_readdir(img, &dir, count_entry, &result->ops);
+            }
+        }
+    }
+}
+
+/* extract every regular file into one scratch file, rewound each time,
+ * through aio when it is given */
+static int bench_extract(const struct minix_image *img,
+    const struct ino_list *files, int rounds, struct aio *aio,
+    struct result *result) {
+    char scratch[] = "/tmp/minbench.XXXXXX";
+    struct extract_stats stats;
+    struct inode inode;
+    uint32_t i;
+    int r, fd = mkstemp(scratch);
+
+    if (fd < 0) {
+        perror("mkstemp");
+        return -1;
+    }
+    unlink(scratch);
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < files->count; i++) {
+            if (minix_read_inode(img, files->inos[i], &inode) != 0 ||
+                ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0 ||
+                (aio ? minix_extract_async(img, &inode, fd, aio, &stats) :
+                minix_extract(img, &inode, fd, &stats)) != 0) {
+                fprintf(stderr, "error: extract of inode %u failed\n",
+                    files->inos[i]);
+                continue;
+            }
+            result->bytes += stats.bytes;
+            result->ops++;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+/* the data extents of every regular file, as image reads */
+static int scan_chunks(const struct minix_image *img,
+    const struct ino_list *files, struct aio_chunk **chunks, size_t *n) {
+    size_t cap = 0;
+    uint32_t i;
+
+    *chunks = NULL;
+    *n = 0;
+    for (i = 0; i < files->count; i++) {
+        struct zone_extent ext;
+        struct zone_map map;
+        struct inode inode;
+
+        if (minix_read_inode(img, files->inos[i], &inode) != 0) {
+            continue;
+        }
+        zone_map_init(&map, img, &inode);
+        while (zone_map_next(&map, &ext) == 1) {
+            uint64_t pos = ext.file_zone * img->zone_size;
+            uint64_t src = img->offset + (uint64_t)ext.start * img->zone_size;
+            uint64_t len = (uint64_t)ext.length * img->zone_size;
+
+            if (ext.hole || pos >= inode.size) {
+                continue;
+            }
+            if (len > inode.size - pos) {
+                len = inode.size - pos;
+            }
+            while (len > 0) {
+                uint32_t part = len < AIO_CHUNK_SIZE ? len : AIO_CHUNK_SIZE;
+
+                if (*n == cap) {
+                    size_t grown_cap = cap ? cap * 2 : 256;
+                    struct aio_chunk *grown = realloc(*chunks,
+                        grown_cap * sizeof(*grown));
+
+                    if (!grown) {
+                        zone_map_release(&map);
+                        return -1;
+                    }
+                    *chunks = grown;
+                    cap = grown_cap;
+                }
+                (*chunks)[*n].src_off = src;
+                (*chunks)[*n].dst_off = 0;
+                (*chunks)[*n].len = part;
+                (*n)++;
+                src += part;
+                len -= part;
+            }
+        }
+        zone_map_release(&map);
+    }
+    return 0;
+}
+
+static int count_chunk(const struct aio_chunk *chunk, const uint8_t *data,
+    void *arg) {
+    struct result *result = arg;
+
+    (void)data;
+    result->ops++;
+    result->bytes += chunk->len;
+    return 0;
+}
+
+/* read all file data in the image, one pread after another or with
+ * aio keeping a queue of them in flight */
+static int bench_scan(const struct minix_image *img,
+    const struct aio_chunk *chunks, size_t n, int rounds, struct aio *aio,
+    struct result *result) {
+    uint8_t *buf = NULL;
+    size_t i;
+    int r;
+
+    if (!aio && !(buf = malloc(AIO_CHUNK_SIZE))) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    for (r = 0; r < rounds; r++) {
+        if (aio) {
+            if (aio_read(aio, img->fd, chunks, n, count_chunk, result) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            if (pread(img->fd, buf, chunks[i].len, chunks[i].src_off) !=
+                (ssize_t)chunks[i].len) {
+                perror("read");
+                free(buf);
+                return -1;
+            }
+            count_chunk(&chunks[i], buf, result);
+        }
+    }
+    free(buf);
+    return 0;
+}
+
+/* one line per workload; with -m it is key=value pairs for scripts */
+static void report(const char *image, int machine,
+    const struct result *result) {
+    double secs = result->secs > 0 ? result->secs : 1e-9;
+
+    if (machine) {
+        printf("image=%s workload=%s ops=%llu secs=%.6f ops_per_sec=%.0f "
+            "bytes=%llu bytes_per_sec=%.0f syscalls=%llu peak_rss_kb=%ld\n",
+            image, result->workload, (unsigned long long)result->ops, secs,
+            result->ops / secs, (unsigned long long)result->bytes,
+            result->bytes / secs, (unsigned long long)result->syscalls,
+            peak_rss_kb());
+        return;
+    }
+    printf("%-14s %10llu ops  %10.1f ns/op  %12.0f ops/s", result->workload,
+        (unsigned long long)result->ops,
+        result->ops ? secs * 1e9 / result->ops : 0.0, result->ops / secs);
+    if (result->bytes) {
+        printf("  %8.1f MB/s", result->bytes / secs / (1 << 20));
+    }
+    printf("  %8llu syscalls\n", (unsigned long long)result->syscalls);
+}
+
+int main(int argc, char *argv[]) {
+    int partition = -1;
+    int subpartition = -1;
+    int rounds = 100;
+    int machine = 0;
+    uint32_t cache_blocks = 0;
+    char *imagefile = NULL;
+    struct minix_image img;
+    struct path_list list = { NULL, 0, 0 };
+    struct ino_list dirs = { NULL, 0, 0 };
+    struct ino_list files = { NULL, 0, 0 };
+    struct walk walk;
+    struct result result;
+    struct dcache *dcache;
+    struct aio_chunk *chunks = NULL;
+    size_t nchunks = 0;
+    struct inode root;
+    uint32_t i;
+
+    for (i = 1; i < (uint32_t)argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < (uint32_t)argc) {
+            partition = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < (uint32_t)argc) {
+            subpartition = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < (uint32_t)argc) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < (uint32_t)argc) {
+            cache_blocks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            machine = 1;
+        } else if (!imagefile) {
+            imagefile = argv[i];
+        } else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!imagefile || rounds < 1) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    if ((cache_blocks ? minix_open_cached(&img, imagefile, partition,
+        subpartition, cache_blocks) : minix_open(&img, imagefile, partition,
+        subpartition)) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    memset(&walk, 0, sizeof(walk));
+    walk.img = &img;
+    walk.list = &list;
+    walk.dirs = &dirs;
+    walk.files = &files;
+    walk.seen = calloc((size_t)img.sb->ninodes + 1, 1);
+    if (!walk.seen) {
+        fprintf(stderr, "error: out of memory\n");
+        minix_close(&img);
+        return EXIT_FAILURE;
+    }
+    walk.seen[ROOT_INODE] = 1;
+    add_ino(&dirs, ROOT_INODE);
+    if (minix_read_inode(&img, ROOT_INODE, &root) == 0) {
+        walk_dir(&walk, &root);
+    }
+    free(walk.seen);
+
+    if (list.count == 0) {
+        fprintf(stderr, "error: no paths to resolve\n");
+        minix_close(&img);
+        return EXIT_FAILURE;
+    }
+
+    calibrate();
+    start(&result, "list");
+    bench_list(&img, &dirs, rounds, &result);
+    stop(&result);
+    report(imagefile, machine, &result);
+
+    /* keep the dentry cache out of the way while timing the directories */
+    dcache = img.dcache;
+    img.dcache = NULL;
+    start(&result, "lookup-scan");
+    bench_lookup(&img, &list, rounds, &result);
+    stop(&result);
+    report(imagefile, machine, &result);
+
+    minix_enable_dir_index(&img);
+    start(&result, "lookup-hashed");
+    bench_lookup(&img, &list, rounds, &result);
+    stop(&result);
+    report(imagefile, machine, &result);
+
+    img.dcache = dcache;
+    if (dcache) {
+        start(&result, "lookup-dcache");
+        bench_lookup(&img, &list, rounds, &result);
+        stop(&result);
+        report(imagefile, machine, &result);
+    }
+
+    for (i = 0; i < sizeof(scanners) / sizeof(scanners[0]); i++) {
+        if (dirscan_select(scanners[i].impl) != 0) {
+            continue;
+        }
+        start(&result, scanners[i].miss);
+        bench_dirscan(&img, &dirs, rounds, &result);
+        stop(&result);
+        report(imagefile, machine, &result);
+        start(&result, scanners[i].readdir);
+        bench_readdir(&img, &dirs, rounds, &result);
+        stop(&result);
+        report(imagefile, machine, &result);
+    }
+    dirscan_select(NULL);
+
+    if (files.count > 0) {
+        start(&result, "extract");
+        bench_extract(&img, &files, rounds, NULL, &result);
+        stop(&result);
+        report(imagefile, machine, &result);
+    }
+
+    /* the same data again, queued: io_uring when the kernel has it, then
+     * the thread pool it falls back to */
+    if (files.count > 0 && scan_chunks(&img, &files, &chunks, &nchunks) == 0) {
+        start(&result, "scan-pread");
+        bench_scan(&img, chunks, nchunks, rounds, NULL, &result);
+        stop(&result);
+        report(imagefile, machine, &result);
+        for (i = 0; i < 2; i++) {
+            struct aio aio;
+
+            if (aio_init(&aio, AIO_DEFAULT_DEPTH, i) != 0) {
+                break;
+            }
+            if (i == 0 && !aio.ring) {
+                aio_destroy(&aio);
+                continue;
+            }
+            /* io_uring_enter calls never show up in the read counts */
+            start(&result, i ? "scan-threads" : "scan-uring");
+            bench_scan(&img, chunks, nchunks, rounds, &aio, &result);
+            stop(&result);
+            result.syscalls = aio.stats.syscalls;
+            report(imagefile, machine, &result);
+            aio.stats.syscalls = 0;
+            start(&result, i ? "extract-threads" : "extract-uring");
+            bench_extract(&img, &files, rounds, &aio, &result);
+            stop(&result);
+            result.syscalls = aio.stats.syscalls;
+            report(imagefile, machine, &result);
+            aio_destroy(&aio);
+        }
+    }
+    free(chunks);
+
+    if (!machine) {
+        printf("%u paths, %u directories (%u indexed), %u files, "
+            "peak rss %ld kB, %s directory scans\n", list.count, dirs.count,
+            img.dir_index ? img.dir_index->built : 0, files.count,
+            peak_rss_kb(), dirscan_impl());
+        minix_print_stats(&img, stdout);
+    }
+
+    for (i = 0; i < list.count; i++) {
+        free(list.paths[i]);
+    }
+    free(list.paths);
+    free(dirs.inos);
+    free(files.inos);
+    minix_close(&img);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,892 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "minix.h"
+#include "zonemap.h"
+#include "partscan.h"
+#include "readahead.h"
+#include "digest.h"
+#include "duptable.h"
+#include "aio.h"
+
+#define DEFAULT_MEMORY_MB 256
+#define WINDOW_OPS 4096         /* zones, holes and file ends per window */
+
+void print_usage() {
+    printf("Usage: mindup [-v] [-H algo] [-C blocks] [-A kb] [-Q depth] "
+        "[-m mb] [-t tmpdir]\n              [-f targetfile] target...\n");
+    printf("       a target is imagefile[:part[:sub]]; an image given "
+        "alone means every\n       MINIX filesystem in it\n");
+    printf("  -H sha256|xxh64 hashes zones and files with it (sha256)\n");
+    printf("  -m caps the memory the hash tables use (%d MB)\n",
+        DEFAULT_MEMORY_MB);
+    printf("  -t holds the hash tables' spill files (TMPDIR or /tmp)\n");
+    printf("  -Q reads the zones depth at a time, through io_uring or a "
+        "pread pool\n");
+}
+
+/* one filesystem to hash, and what the report says about it */
+struct filesystem {
+    char *image;
+    int partition;
+    int subpartition;
+    char *name;               /* image[:part[:sub]] */
+    int status;
+    uint64_t files;           /* regular files, counting links once */
+    uint64_t zones;           /* data zones hashed */
+    uint64_t bytes;           /* file bytes in them */
+    uint64_t dup_within;      /* zones with a copy earlier in this fs */
+    uint64_t dup_earlier;     /* contents already in an earlier fs */
+    uint64_t dup_bytes;       /* bytes of those two */
+    uint64_t dup_files;       /* files with a copy in an earlier fs */
+};
+
+#define NO_NOTE UINT64_MAX
+
+/* what is kept about each file for the report, in the paths file,
+ * followed by the file's path and its terminator. Files of the same
+ * contents in a filesystem are chained through next as the file table
+ * merges them, so the table holds one record for them all. */
+struct file_note {
+    uint64_t size;
+    uint64_t next;            /* offset of the next note, or NO_NOTE */
+    char hex[DIGEST_HEX_SIZE];
+};
+
+/* a file whose zones are being read through the aio engine; they may
+ * take several windows */
+struct queued_file {
+    struct digest whole;
+    uint64_t size;
+    char *path;
+    int failed;
+};
+
+enum { OP_ZONE, OP_HOLE, OP_END };
+
+/* one step of hashing what a window read, taken in file order once all
+ * of its reads are in */
+struct window_op {
+    int kind;
+    struct queued_file *file;
+    size_t off;               /* of an OP_ZONE's bytes in the window */
+    uint64_t len;
+};
+
+/* with -Q, the zones of the files walked are gathered into a window of
+ * chunk reads, all issued at once, and hashed when they are back */
+struct window {
+    struct aio aio;
+    uint8_t *buf;
+    size_t size;
+    size_t used;
+    struct aio_chunk *chunks;
+    size_t nchunks;
+    size_t chunks_cap;
+    struct window_op ops[WINDOW_OPS];
+    uint32_t nops;
+};
+
+struct dedup {
+    enum digest_algo algo;
+    uint32_t cache_blocks;
+    int readahead_kb;
+    int verbose;
+    struct window *window;    /* NULL reads zones one block at a time */
+    const char *tmpdir;
+    size_t memory;
+    struct filesystem *fs;
+    uint32_t count;
+    uint32_t cap;
+    struct dup_table zones;   /* merged per (content, fs) */
+    struct dup_table files;   /* per (content, fs), value a note chain */
+    FILE *paths;
+    /* the filesystem being walked */
+    const struct minix_image *img;
+    uint32_t index;
+    uint8_t *seen;            /* inodes already walked or hashed */
+    char path[PATH_MAX];
+    size_t len;
+    int status;
+    /* report totals */
+    uint64_t contents;        /* distinct zone contents */
+    uint64_t dup_zones;       /* zones whose content is stored before */
+    uint64_t dup_zone_bytes;
+    uint64_t file_groups;     /* distinct contents with several files */
+    uint64_t dup_files;
+    uint64_t dup_file_bytes;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* minix_target_fn adding one filesystem to hash */
+static int add_fs(const char *image, int partition, int subpartition,
+    void *arg) {
+    struct dedup *dd = arg;
+    struct filesystem *fs;
+    char name[PATH_MAX + 32];
+
+    if (dd->count == dd->cap) {
+        uint32_t cap = dd->cap ? dd->cap * 2 : 64;
+        struct filesystem *grown = realloc(dd->fs, cap * sizeof(*grown));
+
+        if (!grown) {
+            fprintf(stderr, "error: out of memory\n");
+            return -1;
+        }
+        dd->fs = grown;
+        dd->cap = cap;
+    }
+    fs = &dd->fs[dd->count];
+    memset(fs, 0, sizeof(*fs));
+    fs->partition = partition;
+    fs->subpartition = subpartition;
+    if (subpartition >= 0) {
+        snprintf(name, sizeof(name), "%s:%d:%d", image, partition,
+            subpartition);
+    } else if (partition >= 0) {
+        snprintf(name, sizeof(name), "%s:%d", image, partition);
+    } else {
+        snprintf(name, sizeof(name), "%s", image);
+    }
+    if (!(fs->image = strdup(image)) || !(fs->name = strdup(name))) {
+        fprintf(stderr, "error: out of memory\n");
+        free(fs->image);
+        return -1;
+    }
+    dd->count++;
+    return 0;
+}
+
+static int open_fs(const struct dedup *dd, const struct filesystem *fs,
+    struct minix_image *img) {
+    if ((dd->cache_blocks ? minix_open_cached(img, fs->image,
+        fs->partition, fs->subpartition, dd->cache_blocks) :
+        minix_open(img, fs->image, fs->partition, fs->subpartition)) != 0) {
+        fprintf(stderr, "%s: cannot open filesystem\n", fs->name);
+        return -1;
+    }
+    if (minix_set_readahead(img, dd->readahead_kb * 1024) != 0) {
+        minix_close(img);
+        return -1;
+    }
+    return 0;
+}
+
+/* the digest's leading bytes, zero padded when it is shorter */
+static void make_key(struct digest *d, uint8_t key[DUP_KEY_SIZE],
+    char hex[DIGEST_HEX_SIZE]) {
+    uint8_t raw[DIGEST_MAX_SIZE];
+    size_t len = digest_final_raw(d, raw), i;
+
+    memset(key, 0, DUP_KEY_SIZE);
+    memcpy(key, raw, len < DUP_KEY_SIZE ? len : DUP_KEY_SIZE);
+    if (hex) {
+        for (i = 0; i < len; i++) {
+            sprintf(hex + 2 * i, "%02x", raw[i]);
+        }
+        hex[2 * len] = '\0';
+    }
+}
+
+/* note a file of size bytes hashed into whole, at path, in the file
+ * table; failed just finishes the digest */
+static int add_file(struct dedup *dd, struct digest *whole, uint64_t size,
+    const char *path, int failed) {
+    struct dup_record rec;
+    struct file_note note;
+
+    make_key(whole, rec.key, note.hex);
+    if (failed) {
+        return -1;
+    }
+    /* every empty file is the same, and that says nothing */
+    if (size == 0) {
+        return 0;
+    }
+    note.size = size;
+    note.next = NO_NOTE;
+    rec.fs = dd->index;
+    rec.count = 1;
+    rec.value = ftello(dd->paths);
+    if (fwrite(&note, sizeof(note), 1, dd->paths) != 1 ||
+        fwrite(path, strlen(path) + 1, 1, dd->paths) != 1) {
+        perror("error: writing paths");
+        return -1;
+    }
+    return dup_table_add(&dd->files, &rec);
+}
+
+/* hash len bytes of disk zone zone, which hold the file's bytes at pos,
+ * feeding them to the whole file's digest as well */
+static int hash_zone(struct dedup *dd, struct ra_file *ra,
+    struct digest *whole, uint32_t zone, uint64_t pos, uint32_t len,
+    uint8_t key[DUP_KEY_SIZE]) {
+    const struct minix_image *img = dd->img;
+    uint32_t blocksize = img->sb->blocksize;
+    uint32_t block = zone << img->sb->log_zone_size;
+    struct digest d;
+
+    if (digest_init(&d, dd->algo) != 0) {
+        return -1;
+    }
+    while (len > 0) {
+        uint32_t chunk = len < blocksize ? len : blocksize;
+        struct minix_buf buf;
+
+        ra_file_read(img, ra, pos, chunk);
+        if (minix_get_block(img, block++, &buf) != 0) {
+            fprintf(stderr, "%s: short read from image\n", dd->path);
+            make_key(&d, key, NULL);
+            return -1;
+        }
+        digest_update(&d, buf.data, chunk);
+        digest_update(whole, buf.data, chunk);
+        minix_put_block(img, &buf);
+        pos += chunk;
+        len -= chunk;
+    }
+    make_key(&d, key, NULL);
+    return 0;
+}
+
+/* hash each data zone of a file into the zone table, and the whole of
+ * it (holes as zeros) into the file table */
+static int hash_file(struct dedup *dd, const struct inode *inode) {
+    const struct minix_image *img = dd->img;
+    struct filesystem *fs = &dd->fs[dd->index];
+    uint64_t size = inode->size;
+    struct dup_record rec;
+    struct zone_extent ext;
+    struct zone_map map;
+    struct ra_file ra;
+    struct digest whole;
+    uint64_t pos;
+    uint32_t z;
+    int rc;
+
+    if (digest_init(&whole, dd->algo) != 0) {
+        return -1;
+    }
+    zone_map_init(&map, img, inode);
+    ra_file_init(&ra, img, inode);
+    memset(&rec, 0, sizeof(rec));
+    rec.fs = dd->index;
+    rec.count = 1;
+    while ((rc = zone_map_next(&map, &ext)) == 1) {
+        pos = ext.file_zone * img->zone_size;
+        if (ext.hole) {
+            uint64_t len = (uint64_t)ext.length * img->zone_size;
+
+            digest_zeros(&whole, size - pos < len ? size - pos : len);
+            continue;
+        }
+        for (z = 0; z < ext.length && rc == 1; z++) {
+            uint32_t len = size - pos < img->zone_size ? size - pos :
+                img->zone_size;
+
+            rec.value = len;
+            if (hash_zone(dd, &ra, &whole, ext.start + z, pos, len,
+                rec.key) != 0 || dup_table_add(&dd->zones, &rec) != 0) {
+                rc = -1;
+            }
+            fs->zones++;
+            fs->bytes += len;
+            pos += len;
+        }
+        if (rc != 1) {
+            break;
+        }
+    }
+    zone_map_release(&map);
+    ra_file_release(&ra);
+    fs->files++;
+    return add_file(dd, &whole, size, dd->path, rc < 0);
+}
+
+/* read every chunk of the window and hash what it holds */
+static int fill_window(const struct aio_chunk *chunk, const uint8_t *data,
+    void *arg) {
+    struct window *w = arg;
+
+    memcpy(w->buf + chunk->dst_off, data, chunk->len);
+    return 0;
+}
+
+static int run_window(struct dedup *dd) {
+    struct window *w = dd->window;
+    struct dup_record rec;
+    struct digest d;
+    int status = 0, failed = 0;
+    uint32_t i;
+
+    if (w->nchunks > 0 && aio_read(&w->aio, dd->img->fd, w->chunks,
+        w->nchunks, fill_window, w) != 0) {
+        fprintf(stderr, "%s: short read from image\n",
+            dd->fs[dd->index].name);
+        failed = 1;
+    }
+    memset(&rec, 0, sizeof(rec));
+    rec.fs = dd->index;
+    rec.count = 1;
+    for (i = 0; i < w->nops; i++) {
+        struct window_op *op = &w->ops[i];
+        struct queued_file *qf = op->file;
+
+        if (op->kind == OP_HOLE) {
+            digest_zeros(&qf->whole, op->len);
+        } else if (op->kind == OP_ZONE) {
+            if (failed || qf->failed || digest_init(&d, dd->algo) != 0) {
+                qf->failed = 1;
+                continue;
+            }
+            digest_update(&d, w->buf + op->off, op->len);
+            digest_update(&qf->whole, w->buf + op->off, op->len);
+            make_key(&d, rec.key, NULL);
+            rec.value = op->len;
+            if (dup_table_add(&dd->zones, &rec) != 0) {
+                qf->failed = 1;
+            }
+        } else {
+            if (add_file(dd, &qf->whole, qf->size, qf->path,
+                qf->failed) != 0) {
+                status = -1;
+            }
+            free(qf->path);
+            free(qf);
+        }
+    }
+    w->used = 0;
+    w->nchunks = 0;
+    w->nops = 0;
+    return status;
+}
+
+/* the next step for the window, running it first when it is full */
+static int add_op(struct dedup *dd, int kind, struct queued_file *qf,
+    uint64_t len) {
+    struct window *w = dd->window;
+    struct window_op *op;
+    int status = 0;
+
+    if (w->nops == WINDOW_OPS) {
+        status = run_window(dd);
+    }
+    op = &w->ops[w->nops++];
+    op->kind = kind;
+    op->file = qf;
+    op->off = w->used;
+    op->len = len;
+    return status;
+}
+
+/* len bytes of disk zone zone into the window, as reads of at most
+ * AIO_CHUNK_SIZE, the zone's run on from the last one's joining it */
+static int queue_zone(struct dedup *dd, struct queued_file *qf,
+    uint32_t zone, uint32_t len) {
+    struct window *w = dd->window;
+    uint64_t src = dd->img->offset + (uint64_t)zone * dd->img->zone_size;
+    int status = 0;
+
+    if (w->used + len > w->size || w->nops == WINDOW_OPS) {
+        status = run_window(dd);
+    }
+    if (add_op(dd, OP_ZONE, qf, len) != 0) {
+        status = -1;
+    }
+    while (len > 0) {
+        struct aio_chunk *last = w->nchunks ? &w->chunks[w->nchunks - 1] :
+            NULL;
+        uint32_t n;
+
+        if (last && last->src_off + last->len == src &&
+            last->len < AIO_CHUNK_SIZE) {
+            n = AIO_CHUNK_SIZE - last->len < len ?
+                AIO_CHUNK_SIZE - last->len : len;
+            last->len += n;
+        } else {
+            if (w->nchunks == w->chunks_cap) {
+                size_t cap = w->chunks_cap ? w->chunks_cap * 2 : 256;
+                struct aio_chunk *grown = realloc(w->chunks,
+                    cap * sizeof(*grown));
+
+                if (!grown) {
+                    fprintf(stderr, "error: out of memory\n");
+                    qf->failed = 1;
+                    return -1;
+                }
+                w->chunks = grown;
+                w->chunks_cap = cap;
+            }
+            n = len < AIO_CHUNK_SIZE ? len : AIO_CHUNK_SIZE;
+            last = &w->chunks[w->nchunks++];
+            last->src_off = src;
+            last->dst_off = w->used;
+            last->len = n;
+        }
+        src += n;
+        w->used += n;
+        len -= n;
+    }
+    return status;
+}
+
+/* hash_file through the window: the file's zones and holes are queued
+ * and hashed, and the file noted, as the windows holding them run */
+static int queue_file(struct dedup *dd, const struct inode *inode) {
+    const struct minix_image *img = dd->img;
+    struct filesystem *fs = &dd->fs[dd->index];
+    uint64_t size = inode->size;
+    struct queued_file *qf = malloc(sizeof(*qf));
+    struct zone_extent ext;
+    struct zone_map map;
+    int status = 0, rc;
+    uint64_t pos;
+    uint32_t z;
+
+    if (!qf || !(qf->path = strdup(dd->path))) {
+        fprintf(stderr, "error: out of memory\n");
+        free(qf);
+        return -1;
+    }
+    if (digest_init(&qf->whole, dd->algo) != 0) {
+        free(qf->path);
+        free(qf);
+        return -1;
+    }
+    qf->size = size;
+    qf->failed = 0;
+    zone_map_init(&map, img, inode);
+    while ((rc = zone_map_next(&map, &ext)) == 1) {
+        pos = ext.file_zone * img->zone_size;
+        if (ext.hole) {
+            uint64_t len = (uint64_t)ext.length * img->zone_size;
+
+            if (add_op(dd, OP_HOLE, qf, size - pos < len ? size - pos :
+                len) != 0) {
+                status = -1;
+            }
+            continue;
+        }
+        for (z = 0; z < ext.length; z++) {
+            uint32_t len = size - pos < img->zone_size ? size - pos :
+                img->zone_size;
+
+            if (queue_zone(dd, qf, ext.start + z, len) != 0) {
+                status = -1;
+            }
+            fs->zones++;
+            fs->bytes += len;
+            pos += len;
+        }
+    }
+    zone_map_release(&map);
+    fs->files++;
+    if (rc < 0) {
+        qf->failed = 1;
+    }
+    /* the window frees qf once it has been through it */
+    if (add_op(dd, OP_END, qf, 0) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+static void walk(struct dedup *dd, const struct inode *dir);
+
+static int walk_entry(const struct fileent *entry, void *arg) {
+    struct dedup *dd = arg;
+    struct inode inode;
+    size_t saved = dd->len;
+    int n;
+
+    if (strncmp(entry->name, ".", DIRSIZ) == 0 ||
+        strncmp(entry->name, "..", DIRSIZ) == 0 ||
+        memchr(entry->name, '/', strnlen(entry->name, DIRSIZ))) {
+        return 0;
+    }
+    n = snprintf(dd->path + saved, sizeof(dd->path) - saved, "/%.*s",
+        DIRSIZ, entry->name);
+    if (n < 0 || (size_t)n >= sizeof(dd->path) - saved) {
+        fprintf(stderr, "error: path too long under %s\n", dd->path);
+        dd->status = -1;
+        return 0;
+    }
+    dd->len += n;
+
+    /* a file with several links is hashed under the first name found */
+    if (dd->seen[entry->ino]) {
+        /* already done */
+    } else if (minix_read_inode(dd->img, entry->ino, &inode) != 0) {
+        fprintf(stderr, "%s: bad inode number %u\n", dd->path, entry->ino);
+        dd->status = -1;
+    } else if (MINIX_ISDIR(inode.mode)) {
+        dd->seen[entry->ino] = 1;
+        walk(dd, &inode);
+    } else if (MINIX_ISREG(inode.mode)) {
+        dd->seen[entry->ino] = 1;
+        if ((dd->window ? queue_file(dd, &inode) :
+            hash_file(dd, &inode)) != 0) {
+            dd->status = -1;
+        }
+    }
+
+    dd->len = saved;
+    dd->path[saved] = '\0';
+    return 0;
+}
+
+static void walk(struct dedup *dd, const struct inode *dir) {
+    if (minix_readdir(dd->img, dir, walk_entry, dd) < 0) {
+        dd->status = -1;
+    }
+}
+
+/* room in w, if there is a window, for a zone of zone_size */
+static int window_fits(struct window *w, uint32_t zone_size) {
+    uint8_t *grown;
+
+    if (!w || zone_size <= w->size) {
+        return 1;
+    }
+    if (!(grown = realloc(w->buf, zone_size))) {
+        fprintf(stderr, "error: out of memory\n");
+        return 0;
+    }
+    w->buf = grown;
+    w->size = zone_size;
+    return 1;
+}
+
+/* hash every file of filesystem index */
+static int hash_fs(struct dedup *dd, uint32_t index) {
+    struct filesystem *fs = &dd->fs[index];
+    struct minix_image img;
+    struct inode root;
+    double start = now();
+
+    if (open_fs(dd, fs, &img) != 0) {
+        return -1;
+    }
+    dd->img = &img;
+    dd->index = index;
+    dd->status = 0;
+    dd->path[0] = '\0';
+    dd->len = 0;
+    if (!(dd->seen = calloc((size_t)img.sb->ninodes + 1, 1))) {
+        fprintf(stderr, "error: out of memory\n");
+        dd->status = -1;
+    } else if (minix_read_inode(&img, ROOT_INODE, &root) != 0) {
+        fprintf(stderr, "%s: cannot read the root directory\n", fs->name);
+        dd->status = -1;
+    } else if (!window_fits(dd->window, img.zone_size)) {
+        dd->status = -1;
+    } else {
+        dd->seen[ROOT_INODE] = 1;
+        walk(dd, &root);
+        /* what the last window holds */
+        if (dd->window && run_window(dd) != 0) {
+            dd->status = -1;
+        }
+    }
+    free(dd->seen);
+    dd->seen = NULL;
+    if (dd->verbose) {
+        fprintf(stderr, "%s: %llu files, %llu zones in %.3f s\n", fs->name,
+            (unsigned long long)fs->files, (unsigned long long)fs->zones,
+            now() - start);
+        minix_print_stats(&img, stderr);
+    }
+    minix_close(&img);
+    return dd->status;
+}
+
+/* one zone content and every filesystem it is in, earliest first */
+static int zone_group(const struct dup_record *recs, size_t count,
+    void *arg) {
+    struct dedup *dd = arg;
+    uint64_t zone_bytes = recs[0].value / recs[0].count;
+    size_t i;
+
+    dd->contents++;
+    for (i = 0; i < count; i++) {
+        struct filesystem *fs = &dd->fs[recs[i].fs];
+        /* the first copy anywhere is the one that has to be kept */
+        uint64_t extra = recs[i].count - (i == 0);
+
+        fs->dup_within += recs[i].count - 1;
+        fs->dup_earlier += i > 0;
+        fs->dup_bytes += extra * zone_bytes;
+        dd->dup_zones += extra;
+        dd->dup_zone_bytes += extra * zone_bytes;
+    }
+    return 0;
+}
+
+/* dup_merge_fn for the file table: rec, a single file, goes on the
+ * front of into's chain */
+static void chain_files(struct dup_record *into,
+    const struct dup_record *rec, void *arg) {
+    struct dedup *dd = arg;
+    uint64_t next = into->value;
+
+    if (pwrite(fileno(dd->paths), &next, sizeof(next), rec->value +
+        offsetof(struct file_note, next)) != (ssize_t)sizeof(next)) {
+        perror("error: writing paths");
+        dd->status = -1;
+        return;
+    }
+    into->value = rec->value;
+    into->count += rec->count;
+}
+
+/* the note and path written for a file at off */
+static int read_note(struct dedup *dd, uint64_t off, struct file_note *note,
+    char path[PATH_MAX]) {
+    int fd = fileno(dd->paths);
+    ssize_t n;
+
+    if (pread(fd, note, sizeof(*note), off) != (ssize_t)sizeof(*note) ||
+        (n = pread(fd, path, PATH_MAX, off + sizeof(*note))) <= 0 ||
+        !memchr(path, '\0', n)) {
+        fprintf(stderr, "error: short read from paths\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* files of the same contents, a chain of them per filesystem: reported
+ * when there is more than one */
+static int file_group(const struct dup_record *recs, size_t count,
+    void *arg) {
+    struct dedup *dd = arg;
+    struct file_note note;
+    char path[PATH_MAX];
+    uint64_t copies = 0, off;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        copies += recs[i].count;
+    }
+    if (copies < 2) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        if (i > 0) {
+            dd->fs[recs[i].fs].dup_files += recs[i].count;
+        }
+        for (off = recs[i].value; off != NO_NOTE; off = note.next) {
+            if (read_note(dd, off, &note, path) != 0) {
+                dd->status = -1;
+                return 1;
+            }
+            if (i == 0 && off == recs[i].value) {
+                printf("%s  %llu bytes, %llu copies\n", note.hex,
+                    (unsigned long long)note.size,
+                    (unsigned long long)copies);
+            }
+            printf("    %s:%s\n", dd->fs[recs[i].fs].name, path);
+        }
+    }
+    dd->file_groups++;
+    dd->dup_files += copies - 1;
+    dd->dup_file_bytes += (copies - 1) * note.size;
+    return 0;
+}
+
+static void print_report(const struct dedup *dd) {
+    uint64_t zones = 0;
+    uint32_t i;
+
+    printf("%-32s %10s %10s %10s %10s %14s %10s\n", "filesystem", "files",
+        "zones", "dup-here", "dup-before", "dup-bytes", "dup-files");
+    for (i = 0; i < dd->count; i++) {
+        const struct filesystem *fs = &dd->fs[i];
+
+        zones += fs->zones;
+        printf("%-32s %10llu %10llu %10llu %10llu %14llu %10llu%s\n",
+            fs->name, (unsigned long long)fs->files,
+            (unsigned long long)fs->zones,
+            (unsigned long long)fs->dup_within,
+            (unsigned long long)fs->dup_earlier,
+            (unsigned long long)fs->dup_bytes,
+            (unsigned long long)fs->dup_files,
+            fs->status == 0 ? "" : "  (incomplete)");
+    }
+    printf("total: %llu zones, %llu distinct; %llu redundant zones "
+        "(%llu bytes)\n", (unsigned long long)zones,
+        (unsigned long long)dd->contents,
+        (unsigned long long)dd->dup_zones,
+        (unsigned long long)dd->dup_zone_bytes);
+    printf("total: %llu files with another copy, in %llu sets "
+        "(%llu bytes)\n", (unsigned long long)dd->dup_files,
+        (unsigned long long)dd->file_groups,
+        (unsigned long long)dd->dup_file_bytes);
+}
+
+/* hash every data zone and every file of the filesystems named, then
+ * report the duplicates: identical files by name, identical zones as
+ * counts per filesystem */
+int main(int argc, char *argv[]) {
+    struct dedup dd;
+    const char *target_file = NULL;
+    uint64_t max_zones = 0, max_files = 0;
+    int status = 0, memory_mb = DEFAULT_MEMORY_MB, depth = 0, fd, i;
+    double start;
+    uint32_t j;
+
+    memset(&dd, 0, sizeof(dd));
+    dd.algo = DIGEST_SHA256;
+    dd.readahead_kb = RA_DEFAULT_WINDOW / 1024;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            dd.verbose = 1;
+        } else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+            if (digest_parse(argv[++i], &dd.algo) != 0) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            dd.cache_blocks = atoi(argv[++i]);
+            if (atoi(argv[i]) <= 0) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) {
+            dd.readahead_kb = atoi(argv[++i]);
+            if (dd.readahead_kb < 0 || dd.readahead_kb > 1024 * 1024) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-Q") == 0 && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+            if (depth < 1 || depth > AIO_MAX_DEPTH) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            memory_mb = atoi(argv[++i]);
+            if (memory_mb < 1) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            dd.tmpdir = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            target_file = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            print_usage();
+            return EXIT_FAILURE;
+        } else if (minix_expand_target(argv[i], add_fs, &dd) != 0) {
+            /* bad targets are reported and the rest still get done */
+            status = -1;
+        }
+    }
+    if (target_file && minix_read_targets(target_file, add_fs, &dd) != 0) {
+        status = -1;
+    }
+    if (dd.count == 0) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    dd.memory = (size_t)memory_mb * 1024 * 1024;
+
+    /* the superblocks bound how much there can be to hash, which sizes
+     * the tables so no bucket outgrows the memory limit */
+    for (j = 0; j < dd.count; j++) {
+        struct minix_image img;
+
+        if (open_fs(&dd, &dd.fs[j], &img) != 0) {
+            dd.fs[j].status = -1;
+            status = -1;
+            continue;
+        }
+        max_zones += img.sb->zones;
+        max_files += img.sb->ninodes;
+        minix_close(&img);
+    }
+    if (dup_table_open(&dd.zones, dd.tmpdir, max_zones, dd.memory / 2,
+        NULL, NULL) != 0 || dup_table_open(&dd.files, dd.tmpdir, max_files,
+        dd.memory / 2, chain_files, &dd) != 0) {
+        return EXIT_FAILURE;
+    }
+    if ((fd = dup_tmpfile(dd.tmpdir)) < 0 ||
+        !(dd.paths = fdopen(fd, "w+"))) {
+        perror("error: paths file");
+        return EXIT_FAILURE;
+    }
+    if (depth) {
+        if (!(dd.window = calloc(1, sizeof(*dd.window))) ||
+            !(dd.window->buf = malloc((size_t)depth * AIO_CHUNK_SIZE))) {
+            fprintf(stderr, "error: out of memory\n");
+            return EXIT_FAILURE;
+        }
+        dd.window->size = (size_t)depth * AIO_CHUNK_SIZE;
+        if (aio_init(&dd.window->aio, depth, 0) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (dd.verbose) {
+        fprintf(stderr, "mindup: %u filesystems, %s (%s), %u zone and %u "
+            "file buckets\n", dd.count, digest_name(dd.algo),
+            digest_impl(dd.algo), dd.zones.nbuckets, dd.files.nbuckets);
+        if (depth) {
+            fprintf(stderr, "mindup: reading through %s, depth %d\n",
+                aio_backend(&dd.window->aio), depth);
+        }
+    }
+
+    start = now();
+    for (j = 0; j < dd.count; j++) {
+        if (dd.fs[j].status == 0 && hash_fs(&dd, j) != 0) {
+            dd.fs[j].status = -1;
+            status = -1;
+        }
+    }
+    if (dd.verbose) {
+        fprintf(stderr, "mindup: hashed %llu zones and %llu files in "
+            "%.3f s\n", (unsigned long long)dd.zones.records,
+            (unsigned long long)dd.files.records, now() - start);
+        if (depth) {
+            fprintf(stderr, "aio: %llu chunks, %u most in flight, "
+                "%u retried\n",
+                (unsigned long long)dd.window->aio.stats.chunks,
+                dd.window->aio.stats.max_inflight,
+                dd.window->aio.stats.retries);
+        }
+    }
+    if (depth) {
+        aio_destroy(&dd.window->aio);
+        free(dd.window->buf);
+        free(dd.window->chunks);
+        free(dd.window);
+    }
+
+    fflush(dd.paths);
+    dd.status = 0;
+    if (dup_table_scan(&dd.zones, zone_group, &dd) != 0 ||
+        dup_table_scan(&dd.files, file_group, &dd) != 0 || dd.status != 0) {
+        status = -1;
+    }
+    print_report(&dd);
+
+    dup_table_close(&dd.zones);
+    dup_table_close(&dd.files);
+    fclose(dd.paths);
+    for (j = 0; j < dd.count; j++) {
+        free(dd.fs[j].image);
+        free(dd.fs[j].name);
+    }
+    free(dd.fs);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
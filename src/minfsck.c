@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "minix.h"
+#include "check.h"
+#include "workq.h"
+#include "aio.h"
+
+void print_usage() {
+    printf("Usage: minfsck [-v] [-j threads] [-C blocks] [-Q depth] "
+        "[-p part [-s sub]] imagefile\n");
+    printf("  -Q reads the inode table ahead, depth chunks at a time, "
+        "through io_uring\n     or a pread pool\n");
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* read-only check of one filesystem: exits 0 when it is consistent, 1
+ * when problems were found and 2 when it couldn't be checked */
+int main(int argc, char *argv[]) {
+    int verbose = 0;
+    int partition = -1;
+    int subpartition = -1;
+    uint32_t cache_blocks = 0;
+    int nthreads = workq_default_threads();
+    int depth = 0;
+    char *imagefile = NULL;
+    struct check_report report;
+    struct minix_image img;
+    double start;
+    int status;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            partition = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            subpartition = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-Q") == 0 && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+            if (depth < 1 || depth > AIO_MAX_DEPTH) {
+                print_usage();
+                return 2;
+            }
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            cache_blocks = atoi(argv[++i]);
+            if (atoi(argv[i]) <= 0) {
+                print_usage();
+                return 2;
+            }
+        } else if (!imagefile) {
+            imagefile = argv[i];
+        } else {
+            print_usage();
+            return 2;
+        }
+    }
+    if (!imagefile || nthreads < 1) {
+        print_usage();
+        return 2;
+    }
+
+    if ((cache_blocks ? minix_open_cached(&img, imagefile, partition,
+        subpartition, cache_blocks) : minix_open(&img, imagefile, partition,
+        subpartition)) != 0) {
+        return 2;
+    }
+
+    start = now();
+    status = minix_check(&img, nthreads, depth, stdout, &report);
+    if (status == 0) {
+        printf("%u inodes in use: %u files, %u directories, %u other\n",
+            report.inodes, report.files, report.dirs, report.other);
+        printf("%u zones in use, %u marked in the zone bitmap\n",
+            report.zones_owned, report.zones_marked);
+        if (report.problems) {
+            printf("%llu problems\n", (unsigned long long)report.problems);
+        } else {
+            printf("clean\n");
+        }
+    }
+    if (verbose) {
+        fflush(stdout);
+        fprintf(stderr, "check: %.3fs with %d threads\n", now() - start,
+            nthreads);
+        minix_print_stats(&img, stderr);
+    }
+    minix_close(&img);
+    if (status != 0) {
+        return 2;
+    }
+    return report.problems ? 1 : 0;
+}
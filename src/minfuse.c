@@ -0,0 +1,878 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <linux/fuse.h>
+#include "minix.h"
+#include "zonemap.h"
+#include "dcache.h"
+#include "readahead.h"
+#include "workq.h"
+
+#define FS_TIMEOUT 86400            /* the image never changes under us */
+#define FS_MAX_PAGES 256            /* largest read or readdir, in pages */
+#define FS_MAX_REPLY (FS_MAX_PAGES * 4096)
+#define FS_IN_SIZE (64 * 1024)      /* requests are all small, being read-only */
+#define ICACHE_SLOTS 65536          /* decoded inodes kept, direct mapped */
+#define ICACHE_LOCKS 64
+
+void print_usage() {
+    printf("Usage: minfuse [-v] [-f] [-a] [-j threads] [-C blocks] [-A kb] "
+        "[-p part [-s sub]] imagefile mountpoint\n");
+}
+
+/* decoded inodes, so that getattr and readdirplus storms don't go back
+ * to the inode table each time */
+struct icache_slot {
+    uint32_t ino;             /* 0 when empty */
+    struct inode inode;
+};
+
+struct icache {
+    struct icache_slot *slots;
+    pthread_mutex_t locks[ICACHE_LOCKS];  /* striped by slot */
+    /* atomic, as no one stripe lock covers them */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/* the mounted filesystem, shared by every worker */
+struct fs {
+    struct minix_image img;
+    int fd;                   /* /dev/fuse */
+    char mountpoint[PATH_MAX];
+    struct icache icache;
+    uint64_t free_zones;
+    uint64_t free_inodes;
+    uint64_t requests;
+    uint64_t reads;
+    uint64_t read_bytes;
+};
+
+/* one worker thread and its buffers */
+struct worker {
+    struct fs *fs;
+    pthread_t thread;
+    uint8_t *in;              /* FS_IN_SIZE */
+    uint8_t *out;             /* header plus FS_MAX_REPLY */
+};
+
+/* an open regular file: its inode and a read-ahead stream of its own */
+struct open_file {
+    struct inode inode;
+    pthread_mutex_t lock;     /* guards ra */
+    struct ra_file ra;
+};
+
+/* a directory as it was at opendir, so readdir at any offset is an
+ * index rather than a rescan */
+struct dir_item {
+    uint32_t ino;
+    char name[DIRSIZ + 1];
+};
+
+struct open_dir {
+    struct dir_item *items;
+    uint32_t count;
+    uint32_t cap;
+};
+
+static struct fs *mounted;    /* for the signal handler */
+
+static int icache_init(struct icache *cache) {
+    int i;
+
+    memset(cache, 0, sizeof(*cache));
+    if (!(cache->slots = calloc(ICACHE_SLOTS, sizeof(*cache->slots)))) {
+        return -1;
+    }
+    for (i = 0; i < ICACHE_LOCKS; i++) {
+        pthread_mutex_init(&cache->locks[i], NULL);
+    }
+    return 0;
+}
+
+static void icache_destroy(struct icache *cache) {
+    int i;
+
+    for (i = 0; i < ICACHE_LOCKS; i++) {
+        pthread_mutex_destroy(&cache->locks[i]);
+    }
+    free(cache->slots);
+}
+
+/* inode ino, from the cache or the inode table; ENOENT for a number out
+ * of range or a free inode */
+static int get_inode(struct fs *fs, uint32_t ino, struct inode *inode) {
+    struct icache *cache = &fs->icache;
+    struct icache_slot *slot = &cache->slots[ino % ICACHE_SLOTS];
+    pthread_mutex_t *lock = &cache->locks[ino % ICACHE_LOCKS];
+
+    if (ino < ROOT_INODE || ino > fs->img.sb->ninodes) {
+        return ENOENT;
+    }
+    pthread_mutex_lock(lock);
+    if (slot->ino == ino) {
+        *inode = slot->inode;
+        __atomic_add_fetch(&cache->hits, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(lock);
+        return 0;
+    }
+    __atomic_add_fetch(&cache->misses, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(lock);
+
+    if (minix_read_inode(&fs->img, ino, inode) != 0) {
+        return EIO;
+    }
+    if (inode->mode == 0) {
+        return ENOENT;
+    }
+    pthread_mutex_lock(lock);
+    slot->ino = ino;
+    slot->inode = *inode;
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+/* name in directory dir_ino, through the dentry cache; ENOENT when it
+ * isn't there */
+static int lookup(struct fs *fs, uint32_t dir_ino, const struct inode *dir,
+    const char *name, uint32_t *ino) {
+    int found, rc;
+
+    if (strlen(name) > DIRSIZ) {
+        return ENAMETOOLONG;
+    }
+    found = fs->img.dcache && dcache_lookup(fs->img.dcache, dir_ino, name,
+        ino);
+    if (found) {
+        return *ino ? 0 : ENOENT;
+    }
+    rc = minix_lookup(&fs->img, dir, name, ino);
+    if (rc != 0) {
+        *ino = 0;
+    }
+    if (fs->img.dcache) {
+        dcache_insert(fs->img.dcache, dir_ino, name, *ino);
+    }
+    return rc == 0 ? 0 : ENOENT;
+}
+
+static void fill_attr(const struct fs *fs, uint32_t ino,
+    const struct inode *inode, struct fuse_attr *attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->ino = ino;
+    attr->size = inode->size;
+    attr->blocks = ((uint64_t)inode->size + 511) / 512;
+    attr->atime = inode->atime;
+    attr->mtime = inode->mtime;
+    attr->ctime = inode->c_time;
+    attr->mode = inode->mode;
+    attr->nlink = inode->links;
+    attr->uid = inode->uid;
+    attr->gid = inode->gid;
+    /* device nodes keep their number in the first zone slot */
+    if (S_ISCHR(inode->mode) || S_ISBLK(inode->mode)) {
+        attr->rdev = inode->zone[0];
+    }
+    attr->blksize = fs->img.zone_size;
+}
+
+static void fill_entry(const struct fs *fs, uint32_t ino,
+    const struct inode *inode, struct fuse_entry_out *entry) {
+    memset(entry, 0, sizeof(*entry));
+    entry->nodeid = ino;
+    entry->entry_valid = FS_TIMEOUT;
+    entry->attr_valid = FS_TIMEOUT;
+    if (inode) {
+        fill_attr(fs, ino, inode, &entry->attr);
+    }
+}
+
+/* copy size bytes of a file from pos on into buf, zeros for holes */
+static int read_data(struct fs *fs, const struct inode *inode, uint64_t pos,
+    uint32_t size, uint8_t *buf) {
+    const struct minix_image *img = &fs->img;
+    uint32_t blocksize = img->sb->blocksize;
+    struct zone_map map;
+    uint32_t done = 0;
+    int rc = 0;
+
+    zone_map_init(&map, img, inode);
+    while (done < size && rc == 0) {
+        uint64_t at = pos + done;
+        uint32_t within = at % img->zone_size;
+        uint32_t part = img->zone_size - within;
+        uint32_t zone;
+
+        if (part > size - done) {
+            part = size - done;
+        }
+        if (zone_map_lookup(&map, at / img->zone_size, &zone) != 0 ||
+            (zone != 0 && !minix_zone_valid(img, zone))) {
+            rc = EIO;
+        } else if (zone == 0) {
+            memset(buf + done, 0, part);
+        } else if (img->map) {
+            memcpy(buf + done, img->map + img->offset +
+                (uint64_t)zone * img->zone_size + within, part);
+        } else {
+            /* a block at a time through the cache */
+            uint32_t block = (zone << img->sb->log_zone_size) +
+                within / blocksize;
+            uint32_t skip = within % blocksize, copied = 0;
+
+            while (copied < part) {
+                struct minix_buf b;
+                uint32_t n = blocksize - skip;
+
+                if (n > part - copied) {
+                    n = part - copied;
+                }
+                if (minix_get_block(img, block++, &b) != 0) {
+                    rc = EIO;
+                    break;
+                }
+                memcpy(buf + done + copied, b.data + skip, n);
+                minix_put_block(img, &b);
+                copied += n;
+                skip = 0;
+            }
+        }
+        done += part;
+    }
+    zone_map_release(&map);
+    return rc;
+}
+
+static void reply_iov(struct worker *w, uint64_t unique, int error,
+    struct iovec *iov, int count) {
+    struct fuse_out_header out;
+    size_t len = sizeof(out);
+    int i;
+
+    for (i = 1; i < count; i++) {
+        len += iov[i].iov_len;
+    }
+    out.len = len;
+    out.error = -error;
+    out.unique = unique;
+    iov[0].iov_base = &out;
+    iov[0].iov_len = sizeof(out);
+    /* ENOENT means the request was interrupted and nobody is waiting */
+    if (writev(w->fs->fd, iov, count) < 0 && errno != ENOENT) {
+        perror("fuse reply");
+    }
+}
+
+static void reply(struct worker *w, uint64_t unique, int error,
+    const void *data, size_t len) {
+    struct iovec iov[2];
+
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = error ? 0 : len;
+    reply_iov(w, unique, error, iov, 2);
+}
+
+static void do_init(struct worker *w, const struct fuse_in_header *hdr,
+    const struct fuse_init_in *in) {
+    struct fuse_init_out out;
+
+    if (in->major != FUSE_KERNEL_VERSION) {
+        fprintf(stderr, "error: kernel speaks FUSE %u.%u, not %u\n",
+            in->major, in->minor, FUSE_KERNEL_VERSION);
+        reply(w, hdr->unique, EPROTO, NULL, 0);
+        return;
+    }
+    memset(&out, 0, sizeof(out));
+    out.major = FUSE_KERNEL_VERSION;
+    out.minor = in->minor < FUSE_KERNEL_MINOR_VERSION ? in->minor :
+        FUSE_KERNEL_MINOR_VERSION;
+    out.max_readahead = in->max_readahead;
+    /* concurrent reads and lookups, directory listings with attributes,
+     * and big reads; all safe since nothing ever changes */
+    out.flags = in->flags & (FUSE_ASYNC_READ | FUSE_EXPORT_SUPPORT |
+        FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO | FUSE_PARALLEL_DIROPS |
+        FUSE_MAX_PAGES | FUSE_CACHE_SYMLINKS);
+    out.max_background = 64;
+    out.congestion_threshold = 48;
+    out.max_write = 4096;
+    out.time_gran = 1000000000;  /* whole seconds */
+    out.max_pages = FS_MAX_PAGES;
+    reply(w, hdr->unique, 0, &out, out.minor < 23 ?
+        FUSE_COMPAT_22_INIT_OUT_SIZE : sizeof(out));
+}
+
+static void do_lookup(struct worker *w, const struct fuse_in_header *hdr,
+    const char *name) {
+    struct fuse_entry_out out;
+    struct inode dir, inode;
+    uint32_t ino;
+    int rc;
+
+    if ((rc = get_inode(w->fs, hdr->nodeid, &dir)) != 0) {
+        reply(w, hdr->unique, rc, NULL, 0);
+        return;
+    }
+    if (!MINIX_ISDIR(dir.mode)) {
+        reply(w, hdr->unique, ENOTDIR, NULL, 0);
+        return;
+    }
+    rc = lookup(w->fs, hdr->nodeid, &dir, name, &ino);
+    if (rc == ENOENT) {
+        /* a negative entry the kernel may keep as long as it likes */
+        fill_entry(w->fs, 0, NULL, &out);
+        reply(w, hdr->unique, 0, &out, sizeof(out));
+        return;
+    }
+    if (rc == 0) {
+        rc = get_inode(w->fs, ino, &inode);
+    }
+    if (rc != 0) {
+        reply(w, hdr->unique, rc, NULL, 0);
+        return;
+    }
+    fill_entry(w->fs, ino, &inode, &out);
+    reply(w, hdr->unique, 0, &out, sizeof(out));
+}
+
+static void do_getattr(struct worker *w, const struct fuse_in_header *hdr) {
+    struct fuse_attr_out out;
+    struct inode inode;
+    int rc;
+
+    if ((rc = get_inode(w->fs, hdr->nodeid, &inode)) != 0) {
+        reply(w, hdr->unique, rc, NULL, 0);
+        return;
+    }
+    memset(&out, 0, sizeof(out));
+    out.attr_valid = FS_TIMEOUT;
+    fill_attr(w->fs, hdr->nodeid, &inode, &out.attr);
+    reply(w, hdr->unique, 0, &out, sizeof(out));
+}
+
+static void do_readlink(struct worker *w, const struct fuse_in_header *hdr) {
+    struct inode inode;
+    uint32_t len = 0;
+    int rc;
+
+    if ((rc = get_inode(w->fs, hdr->nodeid, &inode)) == 0 &&
+        (inode.mode & FILE_TYPE) != SYMLINK) {
+        rc = EINVAL;
+    }
+    if (rc == 0 && inode.size > FS_MAX_REPLY) {
+        rc = ENAMETOOLONG;
+    }
+    if (rc == 0) {
+        len = inode.size;
+        rc = read_data(w->fs, &inode, 0, len,
+            w->out + sizeof(struct fuse_out_header));
+    }
+    reply(w, hdr->unique, rc, w->out + sizeof(struct fuse_out_header), len);
+}
+
+static void do_open(struct worker *w, const struct fuse_in_header *hdr,
+    const struct fuse_open_in *in) {
+    struct fuse_open_out out;
+    struct open_file *file;
+    int rc;
+
+    if ((in->flags & O_ACCMODE) != O_RDONLY) {
+        reply(w, hdr->unique, EROFS, NULL, 0);
+        return;
+    }
+    if (!(file = calloc(1, sizeof(*file)))) {
+        reply(w, hdr->unique, ENOMEM, NULL, 0);
+        return;
+    }
+    if ((rc = get_inode(w->fs, hdr->nodeid, &file->inode)) != 0) {
+        free(file);
+        reply(w, hdr->unique, rc, NULL, 0);
+        return;
+    }
+    pthread_mutex_init(&file->lock, NULL);
+    ra_file_init(&file->ra, &w->fs->img, &file->inode);
+    memset(&out, 0, sizeof(out));
+    out.fh = (uintptr_t)file;
+    out.open_flags = FOPEN_KEEP_CACHE;
+    reply(w, hdr->unique, 0, &out, sizeof(out));
+}
+
+static void do_read(struct worker *w, const struct fuse_in_header *hdr,
+    const struct fuse_read_in *in) {
+    struct open_file *file = (struct open_file *)(uintptr_t)in->fh;
+    uint8_t *data = w->out + sizeof(struct fuse_out_header);
+    uint32_t size = in->size < FS_MAX_REPLY ? in->size : FS_MAX_REPLY;
+    int rc;
+
+    if (in->offset >= file->inode.size) {
+        size = 0;
+    } else if (size > file->inode.size - in->offset) {
+        size = file->inode.size - in->offset;
+    }
+    pthread_mutex_lock(&file->lock);
+    ra_file_read(&w->fs->img, &file->ra, in->offset, size);
+    pthread_mutex_unlock(&file->lock);
+
+    rc = read_data(w->fs, &file->inode, in->offset, size, data);
+    __atomic_add_fetch(&w->fs->reads, 1, __ATOMIC_RELAXED);
+    if (rc == 0) {
+        __atomic_add_fetch(&w->fs->read_bytes, size, __ATOMIC_RELAXED);
+    }
+    reply(w, hdr->unique, rc, data, size);
+}
+
+static void do_release(struct worker *w, const struct fuse_in_header *hdr,
+    const struct fuse_release_in *in) {
+    struct open_file *file = (struct open_file *)(uintptr_t)in->fh;
+
+    ra_file_release(&file->ra);
+    pthread_mutex_destroy(&file->lock);
+    free(file);
+    reply(w, hdr->unique, 0, NULL, 0);
+}
+
+static int add_item(const struct fileent *entry, void *arg) {
+    struct open_dir *dir = arg;
+
+    if (dir->count == dir->cap) {
+        uint32_t cap = dir->cap ? dir->cap * 2 : 64;
+        struct dir_item *grown = realloc(dir->items, cap * sizeof(*grown));
+
+        if (!grown) {
+            return -1;
+        }
+        dir->items = grown;
+        dir->cap = cap;
+    }
+    dir->items[dir->count].ino = entry->ino;
+    memcpy(dir->items[dir->count].name, entry->name, DIRSIZ);
+    dir->items[dir->count].name[DIRSIZ] = '\0';
+    dir->count++;
+    return 0;
+}
+
+static void do_opendir(struct worker *w, const struct fuse_in_header *hdr) {
+    struct fuse_open_out out;
+    struct open_dir *dir;
+    struct inode inode;
+    int rc;
+
+    if ((rc = get_inode(w->fs, hdr->nodeid, &inode)) == 0 &&
+        !MINIX_ISDIR(inode.mode)) {
+        rc = ENOTDIR;
+    }
+    if (rc == 0 && !(dir = calloc(1, sizeof(*dir)))) {
+        rc = ENOMEM;
+    }
+    if (rc == 0 && minix_readdir(&w->fs->img, &inode, add_item, dir) != 0) {
+        free(dir->items);
+        free(dir);
+        rc = EIO;
+    }
+    if (rc != 0) {
+        reply(w, hdr->unique, rc, NULL, 0);
+        return;
+    }
+    memset(&out, 0, sizeof(out));
+    out.fh = (uintptr_t)dir;
+    out.open_flags = FOPEN_KEEP_CACHE | FOPEN_CACHE_DIR;
+    reply(w, hdr->unique, 0, &out, sizeof(out));
+}
+
+/* entries from in->offset on, as many as fit; each entry's offset is
+ * the index of the one after it */
+static void do_readdir(struct worker *w, const struct fuse_in_header *hdr,
+    const struct fuse_read_in *in, int plus) {
+    struct open_dir *dir = (struct open_dir *)(uintptr_t)in->fh;
+    uint8_t *data = w->out + sizeof(struct fuse_out_header);
+    uint32_t size = in->size < FS_MAX_REPLY ? in->size : FS_MAX_REPLY;
+    uint32_t len = 0;
+    uint64_t i;
+
+    for (i = in->offset; i < dir->count; i++) {
+        const struct dir_item *item = &dir->items[i];
+        uint32_t namelen = strlen(item->name);
+        size_t head = plus ? FUSE_NAME_OFFSET_DIRENTPLUS : FUSE_NAME_OFFSET;
+        size_t reclen = FUSE_DIRENT_ALIGN(head + namelen);
+        struct fuse_dirent *dirent;
+        struct inode inode;
+        int known;
+
+        if (len + reclen > size) {
+            break;
+        }
+        memset(data + len, 0, reclen);
+        known = get_inode(w->fs, item->ino, &inode) == 0;
+        if (plus) {
+            struct fuse_direntplus *entry = (void *)(data + len);
+
+            /* nodeid 0 leaves the entry for a later lookup to resolve */
+            if (known) {
+                fill_entry(w->fs, item->ino, &inode, &entry->entry_out);
+            }
+            dirent = &entry->dirent;
+        } else {
+            dirent = (void *)(data + len);
+        }
+        dirent->ino = item->ino;
+        dirent->off = i + 1;
+        dirent->namelen = namelen;
+        dirent->type = known ? (inode.mode & FILE_TYPE) >> 12 : DT_UNKNOWN;
+        memcpy(dirent->name, item->name, namelen);
+        len += reclen;
+    }
+    reply(w, hdr->unique, 0, data, len);
+}
+
+static void do_releasedir(struct worker *w, const struct fuse_in_header *hdr,
+    const struct fuse_release_in *in) {
+    struct open_dir *dir = (struct open_dir *)(uintptr_t)in->fh;
+
+    free(dir->items);
+    free(dir);
+    reply(w, hdr->unique, 0, NULL, 0);
+}
+
+static void do_statfs(struct worker *w, const struct fuse_in_header *hdr) {
+    const struct minix_image *img = &w->fs->img;
+    struct fuse_statfs_out out;
+
+    memset(&out, 0, sizeof(out));
+    out.st.blocks = img->sb->zones;
+    out.st.bfree = w->fs->free_zones;
+    out.st.bavail = w->fs->free_zones;
+    out.st.files = img->sb->ninodes;
+    out.st.ffree = w->fs->free_inodes;
+    out.st.bsize = img->zone_size;
+    out.st.frsize = img->zone_size;
+    out.st.namelen = DIRSIZ;
+    reply(w, hdr->unique, 0, &out, sizeof(out));
+}
+
+static void dispatch(struct worker *w, const struct fuse_in_header *hdr,
+    const void *arg) {
+    switch (hdr->opcode) {
+    case FUSE_INIT:
+        do_init(w, hdr, arg);
+        break;
+    case FUSE_LOOKUP:
+        do_lookup(w, hdr, arg);
+        break;
+    case FUSE_GETATTR:
+        do_getattr(w, hdr);
+        break;
+    case FUSE_READLINK:
+        do_readlink(w, hdr);
+        break;
+    case FUSE_OPEN:
+        do_open(w, hdr, arg);
+        break;
+    case FUSE_READ:
+        do_read(w, hdr, arg);
+        break;
+    case FUSE_RELEASE:
+        do_release(w, hdr, arg);
+        break;
+    case FUSE_OPENDIR:
+        do_opendir(w, hdr);
+        break;
+    case FUSE_READDIR:
+        do_readdir(w, hdr, arg, 0);
+        break;
+    case FUSE_READDIRPLUS:
+        do_readdir(w, hdr, arg, 1);
+        break;
+    case FUSE_RELEASEDIR:
+        do_releasedir(w, hdr, arg);
+        break;
+    case FUSE_STATFS:
+        do_statfs(w, hdr);
+        break;
+    case FUSE_ACCESS: {
+        const struct fuse_access_in *in = arg;
+
+        reply(w, hdr->unique, in->mask & W_OK ? EROFS : 0, NULL, 0);
+        break;
+    }
+    case FUSE_FLUSH:
+    case FUSE_DESTROY:
+        reply(w, hdr->unique, 0, NULL, 0);
+        break;
+    case FUSE_FORGET:
+    case FUSE_BATCH_FORGET:
+    case FUSE_INTERRUPT:
+        /* inode numbers are the node ids, there is nothing to forget,
+         * and no request takes long enough to be worth interrupting */
+        break;
+    default:
+        reply(w, hdr->unique, ENOSYS, NULL, 0);
+        break;
+    }
+}
+
+static void *serve(void *arg) {
+    struct worker *w = arg;
+
+    for (;;) {
+        ssize_t n = read(w->fs->fd, w->in, FS_IN_SIZE);
+        const struct fuse_in_header *hdr = (const void *)w->in;
+
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == ENOENT) {
+                continue;
+            }
+            /* ENODEV: unmounted */
+            if (errno != ENODEV) {
+                perror("fuse read");
+            }
+            return NULL;
+        }
+        if ((size_t)n < sizeof(*hdr) || hdr->len != (size_t)n) {
+            continue;
+        }
+        __atomic_add_fetch(&w->fs->requests, 1, __ATOMIC_RELAXED);
+        dispatch(w, hdr, w->in + sizeof(*hdr));
+    }
+}
+
+/* clear bits among the first nbits of a bitmap starting at block first;
+ * bit 0 is always set, so this counts free zones or inodes */
+static uint64_t count_clear(const struct minix_image *img, uint32_t first,
+    uint64_t nbits) {
+    uint64_t per_block = (uint64_t)img->sb->blocksize * 8;
+    uint64_t set = 0, done = 0;
+    uint32_t block = first;
+
+    while (done < nbits) {
+        uint64_t bits = nbits - done < per_block ? nbits - done : per_block;
+        struct minix_buf buf;
+        uint64_t i;
+
+        if (minix_get_block(img, block++, &buf) != 0) {
+            return 0;
+        }
+        /* whole words count the same either way round */
+        for (i = 0; i + 32 <= bits; i += 32) {
+            uint32_t word;
+
+            memcpy(&word, buf.data + i / 8, sizeof(word));
+            set += __builtin_popcount(word);
+        }
+        for (; i < bits; i++) {
+            uint64_t byte = img->swapped ? i / 32 * 4 + 3 - i % 32 / 8 :
+                i / 8;
+
+            set += buf.data[byte] >> (i % 8) & 1;
+        }
+        minix_put_block(img, &buf);
+        done += bits;
+    }
+    return set < nbits ? nbits - set : 0;
+}
+
+static void unmount(int sig) {
+    (void)sig;
+    if (mounted) {
+        umount2(mounted->mountpoint, MNT_DETACH);
+    }
+}
+
+static int mount_image(struct fs *fs, const char *imagefile,
+    const char *mountpoint, int allow_other) {
+    char opts[256];
+    struct stat st;
+
+    if (!realpath(mountpoint, fs->mountpoint) ||
+        stat(fs->mountpoint, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "error: '%s' is not a directory\n", mountpoint);
+        return -1;
+    }
+    if ((fs->fd = open("/dev/fuse", O_RDWR | O_CLOEXEC)) < 0) {
+        perror("/dev/fuse");
+        return -1;
+    }
+    snprintf(opts, sizeof(opts), "fd=%d,rootmode=%o,user_id=%u,"
+        "group_id=%u,default_permissions%s", fs->fd, S_IFDIR, getuid(),
+        getgid(), allow_other ? ",allow_other" : "");
+    if (mount(imagefile, fs->mountpoint, "fuse.minix",
+        MS_RDONLY | MS_NOSUID | MS_NODEV, opts) != 0) {
+        perror("mount");
+        if (errno == EPERM) {
+            fprintf(stderr, "error: mounting needs root or "
+                "CAP_SYS_ADMIN\n");
+        }
+        close(fs->fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* serve a read-only mount of an image until it is unmounted, with
+ * umount, fusermount -u or a signal */
+int main(int argc, char *argv[]) {
+    int verbose = 0;
+    int foreground = 0;
+    int allow_other = 0;
+    int partition = -1;
+    int subpartition = -1;
+    int nthreads = workq_default_threads();
+    int readahead_kb = RA_DEFAULT_WINDOW / 1024;
+    uint32_t cache_blocks = 0;
+    char *imagefile = NULL;
+    char *mountpoint = NULL;
+    struct worker *workers;
+    struct sigaction sa;
+    struct fs fs;
+    const struct superblock *sb;
+    int i, started = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            foreground = 1;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            allow_other = 1;
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            partition = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            subpartition = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            cache_blocks = atoi(argv[++i]);
+            if (atoi(argv[i]) <= 0) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) {
+            readahead_kb = atoi(argv[++i]);
+            if (readahead_kb < 0 || readahead_kb > 1024 * 1024) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (!imagefile) {
+            imagefile = argv[i];
+        } else if (!mountpoint) {
+            mountpoint = argv[i];
+        } else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!imagefile || !mountpoint || nthreads < 1) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    memset(&fs, 0, sizeof(fs));
+    if ((cache_blocks ? minix_open_cached(&fs.img, imagefile, partition,
+        subpartition, cache_blocks) : minix_open(&fs.img, imagefile,
+        partition, subpartition)) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (minix_set_readahead(&fs.img, readahead_kb * 1024) != 0 ||
+        icache_init(&fs.icache) != 0) {
+        fprintf(stderr, "error: out of memory\n");
+        minix_close(&fs.img);
+        return EXIT_FAILURE;
+    }
+    sb = fs.img.sb;
+    fs.free_inodes = count_clear(&fs.img, 2, (uint64_t)sb->ninodes + 1);
+    fs.free_zones = count_clear(&fs.img, 2 + sb->i_blocks,
+        (uint64_t)sb->zones - sb->firstdata + 1);
+
+    workers = calloc(nthreads, sizeof(*workers));
+    if (!workers || mount_image(&fs, imagefile, mountpoint,
+        allow_other) != 0) {
+        free(workers);
+        icache_destroy(&fs.icache);
+        minix_close(&fs.img);
+        return EXIT_FAILURE;
+    }
+
+    /* the mount is up, so errors from here on have nowhere to go but a
+     * log; in the background there is not even that */
+    if (!foreground) {
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            perror("fork");
+            foreground = 1;
+        } else if (pid > 0) {
+            return EXIT_SUCCESS;
+        } else {
+            int null = open("/dev/null", O_RDWR);
+
+            setsid();
+            if (chdir("/") != 0) {
+                perror("chdir");
+            }
+            if (null >= 0) {
+                dup2(null, STDIN_FILENO);
+                dup2(null, STDOUT_FILENO);
+                dup2(null, STDERR_FILENO);
+                close(null);
+            }
+        }
+    }
+
+    mounted = &fs;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = unmount;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        workers[i].fs = &fs;
+        workers[i].in = malloc(FS_IN_SIZE);
+        workers[i].out = malloc(sizeof(struct fuse_out_header) +
+            FS_MAX_REPLY);
+        if (!workers[i].in || !workers[i].out ||
+            pthread_create(&workers[i].thread, NULL, serve,
+            &workers[i]) != 0) {
+            free(workers[i].in);
+            free(workers[i].out);
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        fprintf(stderr, "error: no threads to serve the mount\n");
+        umount2(fs.mountpoint, MNT_DETACH);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        free(workers[i].in);
+        free(workers[i].out);
+    }
+
+    if (verbose) {
+        fprintf(stderr, "fuse: %llu requests on %d threads, %llu reads of "
+            "%llu bytes\n", (unsigned long long)fs.requests, started,
+            (unsigned long long)fs.reads,
+            (unsigned long long)fs.read_bytes);
+        fprintf(stderr, "icache: %llu hits, %llu misses\n",
+            (unsigned long long)fs.icache.hits,
+            (unsigned long long)fs.icache.misses);
+        minix_print_stats(&fs.img, stderr);
+    }
+    mounted = NULL;
+    close(fs.fd);
+    free(workers);
+    icache_destroy(&fs.icache);
+    minix_close(&fs.img);
+    return EXIT_SUCCESS;
+}
@@ -3,23 +3,50 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include "minget.h"
-
-#define S_ISDIR(mode) (((mode) & DIRECTORY) == DIRECTORY)
+#include <sys/stat.h>
+#include "minix.h"
+#include "extract.h"
+#include "zonemap.h"
+#include "workq.h"
+#include "sidecar.h"
+#include "readahead.h"
+#include "remote.h"
+#include "digest.h"
+
+#define BATCH_FILES 256 /* destinations held open per batch sweep */
+
+/* one "srcpath dstpath" line of a batch manifest */
+struct request {
+    char *src;
+    char *dst;
+    struct inode inode;
+    uint32_t first_zone;   /* first data zone, for ordering the batch */
+};
 
 void print_usage() {
-  printf("Usage: minget [-v] [-p part [-s sub]] imagefile srcpath [dstpath]\n");
-}
-
-/* read the superblock */
-void read_superblock(FILE *file, struct superblock *sb) {
-    /* superblock starts at 1024 */
-    fseek(file, 1024, SEEK_SET);
-    fread(sb, sizeof(struct superblock), 1, file);
+  printf("Usage: minget [-v] [-I] [-C blocks] [-A kb] [-Q depth] "
+      "[-S socket] [-H algo] [-p part [-s sub]] imagefile srcpath "
+      "[dstpath]\n");
+  printf("       minget [-v] [-I] [-C blocks] [-A kb] [-Q depth] "
+      "[-H algo] [-p part [-s sub]] -b manifest imagefile\n");
+  printf("       minget [-v] [-I] [-C blocks] [-A kb] [-Q depth] "
+      "[-H algo] [-p part [-s sub]] -r [-j threads] imagefile srcpath "
+      "dstdir\n");
+  printf("       minget [-v] [-C blocks] [-A kb] [-H algo] "
+      "[-p part [-s sub]] -n [-r [-j threads]] imagefile srcpath\n");
+  printf("       minget [-v] [-C blocks] [-A kb] [-H algo] "
+      "[-p part [-s sub]] -n -b manifest imagefile\n");
+  printf("  -H sha256|xxh64 hashes each file as it is extracted and prints "
+      "\"hash  srcpath\"\n");
+  printf("  -n only hashes (sha256 unless -H says otherwise), writing "
+      "nothing\n");
+  printf("  -Q keeps up to depth reads in flight per file copied (io_uring, "
+      "else a pread\n     pool); hashing reads each file in order and "
+      "does without\n");
 }
 
 /* print verbose superblock info  */
-void print_superblock(struct superblock *sb) {
+void print_superblock(const struct superblock *sb) {
     int zone_size = sb->blocksize * (1 << sb->log_zone_size);
     printf("Superblock Contents:\n");
     printf("Stored Fields:\n");
@@ -27,7 +54,7 @@ void print_superblock(struct superblock *sb) {
     printf("  i_blocks %d\n", sb->i_blocks);
     printf("  z_blocks %d\n", sb->z_blocks);
     printf("  firstdata %u\n", sb->firstdata);
-    printf("  log_zone_size %d (zone size: %d bytes)\n", sb->log_zone_size, 
+    printf("  log_zone_size %d (zone size: %d bytes)\n", sb->log_zone_size,
         zone_size);
     printf("  max_file %u\n", sb->max_file);
     printf("  magic 0x%x\n", sb->magic);
@@ -36,171 +63,440 @@ void print_superblock(struct superblock *sb) {
     printf("  subversion %u\n", sb->subversion);
 }
 
-/* read an inode by its number */
-void read_inode(FILE *file, int inode_num, struct inode *inode,
- struct superblock *sb) {
-    int inode_block = ((inode_num - 1) / (sb->blocksize / INODE_SIZE)) + 2;  
-    int inode_index = (inode_num - 1) % (sb->blocksize / INODE_SIZE);
-    fseek(file, sb->blocksize * inode_block + inode_index * INODE_SIZE, 
-    SEEK_SET);
-    fread(inode, sizeof(struct inode), 1, file);
+int open_destination(const char *dstpath) {
+    if (dstpath == NULL) {
+        return STDOUT_FILENO; /*stdout if no destination path*/
+    }
+    int dst = open(dstpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (dst < 0) {
+        perror("Failed to open destination file");
+        exit(EXIT_FAILURE);
+    }
+    return dst;
 }
 
-int traverse_directory(FILE *file, struct inode *current_inode, 
-    const char *entry_name, struct inode *found_inode, struct superblock *sb) {
-    char buffer[4096]; 
-    struct fileent *entry;
-    int i, offset;
+void print_extract_stats(const struct extract_stats *stats) {
+    fprintf(stderr, "extracted %llu bytes (%llu in holes) in %u runs, "
+        "%u write calls, %u indirect blocks\n",
+        (unsigned long long)stats->bytes,
+        (unsigned long long)stats->hole_bytes, stats->runs,
+        stats->syscalls, stats->indirect_reads);
+}
 
-    for (i = 0; i < DIRECT_ZONES; i++) {
-        if (current_inode->zone[i] == 0)
-            continue;
+static void add_stats(struct extract_stats *total,
+    const struct extract_stats *stats) {
+    total->bytes += stats->bytes;
+    total->hole_bytes += stats->hole_bytes;
+    total->runs += stats->runs;
+    total->syscalls += stats->syscalls;
+    total->indirect_reads += stats->indirect_reads;
+}
 
-        int block_address = sb->firstdata + (current_inode->zone[i] - 1);
-        fseek(file, block_address * sb->blocksize, SEEK_SET);
-        fread(buffer, 1, sb->blocksize, file);
-        offset = 0;
+/* split "src dst" (or "src<TAB>dst" for names with spaces) in place.
+ * A line with no dst gets a NULL one. */
+static int parse_line(char *line, char **src, char **dst) {
+    char *sep;
 
-        while (offset < sb->blocksize) {
-            entry = (struct fileent *)(buffer + offset);
-            if (entry->ino != 0 && strcmp(entry->name, entry_name) == 0) {
-                read_inode(file, entry->ino, found_inode, sb);
-                return 1; /* found */
-            }
-            offset += sizeof(struct fileent);
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#') {
+        return 0;
+    }
+    sep = strchr(line, '\t');
+    if (!sep) {
+        sep = strchr(line, ' ');
+    }
+    if (!sep) {
+        *src = line;
+        *dst = NULL;
+        return 1;
+    }
+    *sep++ = '\0';
+    while (*sep == ' ' || *sep == '\t') {
+        sep++;
+    }
+    if (*sep == '\0') {
+        return -1;
+    }
+    *src = line;
+    *dst = sep;
+    return 1;
+}
+
+static uint32_t first_data_zone(const struct minix_image *img,
+    const struct inode *inode) {
+    struct zone_map map;
+    struct zone_extent ext;
+    uint32_t first = 0;
+
+    zone_map_init(&map, img, inode);
+    while (zone_map_next(&map, &ext) == 1) {
+        if (!ext.hole) {
+            first = ext.start;
+            break;
         }
     }
-    return 0; /* not found */
+    zone_map_release(&map);
+    return first;
 }
 
+static int by_first_zone(const void *a, const void *b) {
+    const struct request *x = a, *y = b;
 
-int find_inode_by_path(FILE *file, const char *path, struct inode *inode,
- struct superblock *sb) {
-    if (strcmp(path, "/") == 0) {
-        read_inode(file, 1, inode, sb); /* root inode */
-        return 0;
-    }
+    return x->first_zone < y->first_zone ? -1 :
+        x->first_zone > y->first_zone;
+}
+
+/* extract requests[0..count) with at most BATCH_FILES open at a time */
+static int extract_requests(const struct minix_image *img,
+    struct request *requests, uint32_t count, struct extract_stats *total) {
+    struct extract_job jobs[BATCH_FILES];
+    struct extract_stats stats;
+    int status = 0;
+    uint32_t base, i, njobs;
+
+    for (base = 0; base < count; base += BATCH_FILES) {
+        uint32_t end = count - base < BATCH_FILES ? count : base + BATCH_FILES;
+
+        njobs = 0;
+        for (i = base; i < end; i++) {
+            struct stat st;
+            int fd = open(requests[i].dst, O_WRONLY | O_CREAT | O_TRUNC,
+                0666);
+
+            if (fd < 0) {
+                perror(requests[i].dst);
+                status = -1;
+                continue;
+            }
+            /* pipes and devices can't take writes out of order */
+            if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                if (minix_extract(img, &requests[i].inode, fd,
+                    &stats) != 0) {
+                    status = -1;
+                }
+                add_stats(total, &stats);
+                close(fd);
+                continue;
+            }
+            jobs[njobs].inode = &requests[i].inode;
+            jobs[njobs].dst_fd = fd;
+            njobs++;
+        }
 
-    char *path_copy = strdup(path);
-    char *token = strtok(path_copy, "/");
-    struct inode current_inode;
-    read_inode(file, 1, &current_inode, sb);  /* start at root*/
-    while (token != NULL) {
-        if (!S_ISDIR(current_inode.mode)) { /* check if curr inode is direct*/
-            fprintf(stderr, "Not a directory\n");
-            free(path_copy);
-            return -1;
+        if (minix_extract_batch(img, jobs, njobs, &stats) != 0) {
+            status = -1;
         }
-        if (!traverse_directory(file, &current_inode, token, 
-            &current_inode, sb)) {  /* find token in curr directory */
-            fprintf(stderr, "Path not found: %s\n", token);
-            free(path_copy);
-            return -1;
+        add_stats(total, &stats);
+        for (i = 0; i < njobs; i++) {
+            close(jobs[i].dst_fd);
         }
-        token = strtok(NULL, "/");
     }
-
-    *inode = current_inode; /* found inode of last token */
-    free(path_copy);
-    return 0;
+    return status;
 }
 
-void read_partition_table(FILE *file, int partition, int subpartition, 
-    int *partition_offset) {
-    uint8_t buffer[SECTOR_SIZE];
+/* extract requests[0..count) one file at a time, each with up to
+ * aio->depth of its zone reads in flight. The requests are in on-disk
+ * order, so the queued reads still move through the image front to
+ * back. */
+static int queue_requests(const struct minix_image *img,
+    struct request *requests, uint32_t count, struct aio *aio,
+    struct extract_stats *total) {
+    struct extract_stats stats;
+    int status = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        int fd = open(requests[i].dst, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+        if (fd < 0) {
+            perror(requests[i].dst);
+            status = -1;
+            continue;
+        }
+        if (minix_extract_async(img, &requests[i].inode, fd, aio,
+            &stats) != 0) {
+            status = -1;
+        }
+        add_stats(total, &stats);
+        close(fd);
+    }
+    return status;
+}
 
-    fseek(file, 0, SEEK_SET);
-    fread(buffer, SECTOR_SIZE, 1, file);
+static void print_aio_stats(const struct aio *aio) {
+    fprintf(stderr, "aio: %s, depth %u, %llu chunks, %u most in "
+        "flight, %u retried\n", aio_backend(aio), aio->depth,
+        (unsigned long long)aio->stats.chunks,
+        aio->stats.max_inflight, aio->stats.retries);
+}
 
-    if (buffer[BOOT_SIG_OFFSET] != 0x55 || buffer[BOOT_SIG_OFFSET + 1] != 0xAA) 
-    {
-        fprintf(stderr, "error: invalid partition table signature\n");
-        fclose(file);
-        exit(1);
+/* extract requests[0..count) one file at a time, hashing each as it
+ * goes and printing "hash  srcpath"; with hash_only nothing is written.
+ * The requests are in on-disk order already, so the image is still read
+ * front to back. */
+static int hash_requests(const struct minix_image *img,
+    struct request *requests, uint32_t count, enum digest_algo algo,
+    int hash_only, struct extract_stats *total) {
+    struct extract_stats stats;
+    struct digest digest;
+    char hex[DIGEST_HEX_SIZE];
+    int status = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        int fd = -1;
+        int rc;
+
+        if (!hash_only && (fd = open(requests[i].dst,
+            O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+            perror(requests[i].dst);
+            status = -1;
+            continue;
+        }
+        if (digest_init(&digest, algo) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            status = -1;
+            continue;
+        }
+        rc = minix_extract_digest(img, &requests[i].inode, fd, &digest,
+            &stats);
+        digest_final(&digest, hex);
+        if (rc != 0) {
+            status = -1;
+        } else {
+            printf("%s  %s\n", hex, requests[i].src);
+        }
+        add_stats(total, &stats);
+        if (fd >= 0) {
+            close(fd);
+        }
     }
+    return status;
+}
 
-    struct partition_table *partitions = 
-        (struct partition_table *)&buffer[PARTITION_TABLE_OFFSET];
-    if (partition < 0 || partition > 3) {
-        fprintf(stderr, "error: invalid primary partition number\n");
-        fclose(file);
-        exit(1);
+/* read a manifest of "srcpath dstpath" lines and extract them all from
+ * one open image, in on-disk order. With algo, each file is hashed on
+ * the way; with hash_only too, the lines need no dstpath and nothing is
+ * written. Otherwise a nonzero depth copies them through an aio engine
+ * rather than in one sweep. */
+int run_batch(struct minix_image *img, const char *manifest, int verbose,
+    unsigned depth, enum digest_algo algo, int hash_only) {
+    FILE *in = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+    struct request *requests = NULL;
+    struct extract_stats total;
+    struct aio aio;
+    uint32_t count = 0, cap = 0, i;
+    char *line = NULL;
+    size_t line_cap = 0;
+    int status = 0;
+
+    if (!in) {
+        perror(manifest);
+        return -1;
     }
+    /* many lookups against the same directories */
+    minix_enable_dir_index(img);
 
-    *partition_offset = partitions[partition].IFirst * SECTOR_SIZE;
-    if (partitions[partition].type == EXTENDED_PARTITION && subpartition != -1){
-        fseek(file, *partition_offset, SEEK_SET);
-        fread(buffer, SECTOR_SIZE, 1, file);
-        struct partition_table *subpartitions = 
-            (struct partition_table *)&buffer[PARTITION_TABLE_OFFSET];
+    while (getline(&line, &line_cap, in) >= 0) {
+        char *src, *dst;
+        struct inode inode;
+        uint32_t ino;
+        int rc = parse_line(line, &src, &dst);
 
-        if (subpartition < 0 || subpartition > 3) {
-            fprintf(stderr, "error: invalid subpartition number\n");
-            fclose(file);
-            exit(1);
+        if (rc == 0) {
+            continue;
         }
+        if (rc < 0 || (!dst && !hash_only)) {
+            fprintf(stderr, "error: bad manifest line '%s'\n", line);
+            status = -1;
+            continue;
+        }
+        if (minix_resolve(img, src, &ino) != 0 ||
+            minix_read_inode(img, ino, &inode) != 0) {
+            fprintf(stderr, "%s: File not found.\n", src);
+            status = -1;
+            continue;
+        }
+        if (!MINIX_ISREG(inode.mode)) {
+            fprintf(stderr, "%s: Not a regular file.\n", src);
+            status = -1;
+            continue;
+        }
+        if (count == cap) {
+            struct request *grown;
+
+            cap = cap ? cap * 2 : 64;
+            if (!(grown = realloc(requests, cap * sizeof(*grown)))) {
+                fprintf(stderr, "error: out of memory\n");
+                status = -1;
+                break;
+            }
+            requests = grown;
+        }
+        requests[count].src = strdup(src);
+        requests[count].dst = dst ? strdup(dst) : NULL;
+        requests[count].inode = inode;
+        requests[count].first_zone = first_data_zone(img,
+            &requests[count].inode);
+        count++;
+    }
+    free(line);
+    if (in != stdin) {
+        fclose(in);
+    }
 
-        if (subpartitions[subpartition].type != PARTITION_TYPE) {
-            fprintf(stderr, "error: invalid Minix subpartition type\n");
-            fclose(file);
-            exit(1);
+    /* neighbouring files on disk end up in the same sweep */
+    qsort(requests, count, sizeof(*requests), by_first_zone);
+    memset(&total, 0, sizeof(total));
+    if (algo) {
+        depth = 0;
+        if (hash_requests(img, requests, count, algo, hash_only,
+            &total) != 0) {
+            status = -1;
+        }
+    } else if (depth) {
+        if (aio_init(&aio, depth, 0) != 0 ||
+            queue_requests(img, requests, count, &aio, &total) != 0) {
+            status = -1;
         }
+    } else if (extract_requests(img, requests, count, &total) != 0) {
+        status = -1;
+    }
 
-        *partition_offset = partitions[partition].IFirst * SECTOR_SIZE;
-        printf("Subpartition %d: lFirst=%u, size=%u\n", 
-               subpartition, 
-               subpartitions[subpartition].IFirst, 
-               subpartitions[subpartition].size);
+    if (verbose) {
+        fprintf(stderr, "batch: %u files\n", count);
+        print_extract_stats(&total);
+        if (depth) {
+            print_aio_stats(&aio);
+        }
+        minix_print_stats(img, stderr);
+    }
+    if (depth) {
+        aio_destroy(&aio);
+    }
+    for (i = 0; i < count; i++) {
+        free(requests[i].src);
+        free(requests[i].dst);
     }
+    free(requests);
+    return status;
+}
+
+/* reproduce the directory dir_ino under dstdir, one thread walking and
+ * nthreads workers extracting the files it finds, each with up to depth
+ * reads in flight when depth isn't 0. With algo, each file's hash is
+ * printed as "hash  path" with path under srcpath. */
+int run_tree(const struct minix_image *img, uint32_t dir_ino,
+    const char *srcpath, const char *dstdir, int nthreads, unsigned depth,
+    int verbose, enum digest_algo algo, int hash_only) {
+    struct extract_stats stats;
+    struct tree_digest digest = { algo, srcpath, stdout, hash_only };
+    int status = minix_extract_tree(img, dir_ino, dstdir, nthreads, depth,
+        verbose, algo ? &digest : NULL, &stats);
 
-    printf("Partition %d: lFirst=%u, size=%u\n", 
-           partition, 
-           partitions[partition].IFirst, 
-           partitions[partition].size);
+    if (verbose) {
+        fprintf(stderr, "tree: %u files, %u directories, %d threads\n",
+            stats.files, stats.dirs, nthreads);
+        print_extract_stats(&stats);
+    }
+    return status;
 }
 
-FILE *open_destination(const char *dstpath) {
-    if (dstpath == NULL) {
-        return stdout; /*stdout if no destination path*/
+/* extract one file: hashing it on the way when asked to, with queued
+ * reads when asked for, otherwise straight from its sidecar extents
+ * when there are some so no indirect block has to be read */
+static int extract_path(const struct minix_image *img, const char *path,
+    const struct inode *inode, int dst_fd, struct digest *digest,
+    struct aio *aio, struct extract_stats *stats) {
+    const struct sidecar_entry *entry;
+    struct zone_extent *extents;
+    int known, status;
+
+    if (digest) {
+        return minix_extract_digest(img, inode, dst_fd, digest, stats);
     }
-    FILE *dst = fopen(dstpath, "wb");
-    if (!dst) {
-        perror("Failed to open destination file");
-        exit(EXIT_FAILURE);
+    if (aio) {
+        return minix_extract_async(img, inode, dst_fd, aio, stats);
     }
-    return dst;
+    if (!img->sidecar ||
+        !(entry = sidecar_find(img->sidecar, path, &known)) ||
+        !(extents = sidecar_load_extents(img->sidecar, entry))) {
+        return minix_extract(img, inode, dst_fd, stats);
+    }
+    status = minix_extract_extents(img, entry->inode.size, extents,
+        entry->nextents, dst_fd, stats);
+    free(extents);
+    return status;
 }
 
-void copy_file_data(FILE *src, struct inode *inode, struct superblock *sb,
-     FILE *dst) {
-    char buffer[1024]; 
-    int bytes_to_read = inode->size;
-    int bytes_read;
-
-    for (int i = 0; i < DIRECT_ZONES && bytes_to_read > 0; i++) {
-        if (inode->zone[i] == 0) continue; 
-        int block_address = sb->firstdata + (inode->zone[i] - 1);
-        fseek(src, block_address * sb->blocksize, SEEK_SET);
-
-        int chunk_size = 
-            (bytes_to_read > sb->blocksize) ? sb->blocksize : bytes_to_read;
-        bytes_read = fread(buffer, 1, chunk_size, src);
-        fwrite(buffer, 1, bytes_read, dst);
+/* have a minixd extract srcpath, straight into the destination opened
+ * here and passed to it: 0 when it did, -1 when it couldn't, 1 when there
+ * is no daemon (or it can't open the image) and it has to be done here */
+static int get_remote(const char *socket_path, const char *imagefile,
+    int partition, int subpartition, const char *srcpath,
+    const char *dstpath) {
+    struct remote_reply reply;
+    int sock, dst_fd, status = 0;
+
+    if ((sock = remote_connect(socket_path)) < 0) {
+        return 1;
+    }
+    /* look first, so nothing is created for a path that isn't there */
+    if (remote_send(sock, REMOTE_STAT, imagefile, partition, subpartition,
+        srcpath, -1) != 0 || remote_recv(sock, &reply, NULL) != 0 ||
+        (reply.status != REMOTE_OK && reply.status != REMOTE_NOT_FOUND)) {
+        close(sock);
+        return 1;
+    }
+    if (reply.status == REMOTE_NOT_FOUND) {
+        fprintf(stderr, "File not found.\n");
+        close(sock);
+        return -1;
+    }
+    if (!MINIX_ISREG(reply.inode.mode)) {
+        fprintf(stderr, "Not a regular file.\n");
+        close(sock);
+        return -1;
+    }
 
-        bytes_to_read -= bytes_read;
+    dst_fd = open_destination(dstpath);
+    if (remote_send(sock, REMOTE_GET, imagefile, partition, subpartition,
+        srcpath, dst_fd) != 0 || remote_recv(sock, &reply, NULL) != 0 ||
+        reply.status != REMOTE_OK) {
+        fprintf(stderr, "error: minixd failed to extract '%s'\n", srcpath);
+        status = -1;
     }
+    if (dst_fd != STDOUT_FILENO) {
+        close(dst_fd);
+    }
+    close(sock);
+    return status;
 }
 
 int main(int argc, char *argv[]) {
     int verbose = 0;
     int partition = -1;
     int subpartition = -1;
+    uint32_t cache_blocks = 0;
     char *imagefile = NULL;
     char *srcpath = NULL;
     char *dstpath = NULL;
-    FILE *file, *dst_file;
-    struct superblock sb;
+    char *manifest = NULL;
+    const char *socket_path = NULL;
+    int recursive = 0;
+    int use_sidecar = 0;
+    int nthreads = workq_default_threads();
+    int depth = 0;
+    int readahead_kb = RA_DEFAULT_WINDOW / 1024;
+    enum digest_algo algo = DIGEST_NONE;
+    int hash_only = 0;
+    int dst_fd;
+    struct extract_stats stats;
+    struct minix_image img;
     struct inode inode;
+    uint32_t ino;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-v") == 0) {
@@ -209,6 +505,41 @@ int main(int argc, char *argv[]) {
             partition = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
             subpartition = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0) {
+            recursive = 1;
+        } else if (strcmp(argv[i], "-I") == 0) {
+            use_sidecar = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-Q") == 0 && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+            if (depth < 1 || depth > AIO_MAX_DEPTH) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            cache_blocks = atoi(argv[++i]);
+            if (atoi(argv[i]) <= 0) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) {
+            readahead_kb = atoi(argv[++i]);
+            if (readahead_kb < 0 || readahead_kb > 1024 * 1024) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+            if (digest_parse(argv[++i], &algo) != 0) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            hash_only = 1;
         } else if (!imagefile) {
             imagefile = argv[i];
         } else if (!srcpath) {
@@ -218,53 +549,118 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (!imagefile || !srcpath) {
+    if (hash_only && !algo) {
+        algo = DIGEST_SHA256;
+    }
+    if (!imagefile || (!srcpath && !manifest) || (srcpath && manifest) ||
+        (recursive && manifest) || (hash_only && dstpath) ||
+        (recursive && !hash_only && !dstpath) || nthreads < 1) {
         print_usage();
         return EXIT_FAILURE;
     }
 
-    file = fopen(imagefile, "rb");
-    if (!file) {
-        fprintf(stderr, "Error opening image file.\n");
-        return EXIT_FAILURE;
-    }
+    /* a single plain copy can come from a minixd with the image open */
+    if (!verbose && !manifest && !recursive && !use_sidecar && !depth &&
+        !algo &&
+        (socket_path = remote_socket_path(socket_path))) {
+        int status = get_remote(socket_path, imagefile, partition,
+            subpartition, srcpath, dstpath);
 
-    int partition_offset = 0;
-    if (partition != -1) {
-        read_partition_table(file, partition, subpartition, &partition_offset);
-        /* adjust fp to start of selected partition*/
-        fseek(file, partition_offset, SEEK_SET);  
+        if (status <= 0) {
+            return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
     }
 
-    read_superblock(file, &sb);
-    if (sb.magic != MAGIC_NUM) {
-        fprintf(stderr, "Not a Minix filesystem.\n");
-        fclose(file);
+    if ((cache_blocks ? minix_open_cached(&img, imagefile, partition,
+        subpartition, cache_blocks) : minix_open(&img, imagefile, partition,
+        subpartition)) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (minix_set_readahead(&img, readahead_kb * 1024) != 0) {
+        minix_close(&img);
         return EXIT_FAILURE;
     }
 
     if (verbose) {
-        print_superblock(&sb);
+        print_superblock(img.sb);
+        if (algo) {
+            printf("digest: %s (%s)\n", digest_name(algo),
+                digest_impl(algo));
+        }
+    }
+    if (use_sidecar) {
+        sidecar_attach(&img, imagefile, partition, subpartition);
     }
 
-    if (find_inode_by_path(file, srcpath, &inode, &sb) != 0) {
+    if (manifest) {
+        int status = run_batch(&img, manifest, verbose, depth, algo,
+            hash_only);
+        minix_close(&img);
+        return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (minix_resolve(&img, srcpath, &ino) != 0 ||
+        minix_read_inode(&img, ino, &inode) != 0) {
         fprintf(stderr, "File not found.\n");
-        fclose(file);
+        minix_close(&img);
         return EXIT_FAILURE;
     }
 
-    if ((inode.mode & FILE_TYPE) != REGULAR_FILE) {
+    if (recursive && MINIX_ISDIR(inode.mode)) {
+        int status = run_tree(&img, ino, srcpath, dstpath, nthreads, depth,
+            verbose, algo, hash_only);
+        minix_close(&img);
+        return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (!MINIX_ISREG(inode.mode)) {
         fprintf(stderr, "Not a regular file.\n");
-        fclose(file);
+        minix_close(&img);
         return EXIT_FAILURE;
     }
 
-    dst_file = open_destination(dstpath);
-    copy_file_data(file, &inode, &sb, dst_file);
+    struct aio aio;
 
-    if (dst_file != stdout) {
-        fclose(dst_file);
+    if (depth && aio_init(&aio, depth, 0) != 0) {
+        minix_close(&img);
+        return EXIT_FAILURE;
+    }
+    struct digest digest;
+    char hex[DIGEST_HEX_SIZE];
+
+    if (algo && digest_init(&digest, algo) != 0) {
+        if (depth) {
+            aio_destroy(&aio);
+        }
+        minix_close(&img);
+        return EXIT_FAILURE;
+    }
+    dst_fd = hash_only ? -1 : open_destination(dstpath);
+    int status = extract_path(&img, srcpath, &inode, dst_fd,
+        algo ? &digest : NULL, depth ? &aio : NULL, &stats);
+
+    if (algo) {
+        digest_final(&digest, hex);
+        /* the hash can't share stdout with the file's contents */
+        if (status == 0) {
+            fprintf(dstpath || hash_only ? stdout : stderr, "%s  %s\n",
+                hex, srcpath);
+        }
+    }
+
+    if (verbose) {
+        print_extract_stats(&stats);
+        if (depth) {
+            print_aio_stats(&aio);
+        }
+        minix_print_stats(&img, stderr);
+    }
+    if (depth) {
+        aio_destroy(&aio);
+    }
+    if (dst_fd >= 0 && dst_fd != STDOUT_FILENO) {
+        close(dst_fd);
     }
-    fclose(file);
-    return EXIT_SUCCESS;
+    minix_close(&img);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
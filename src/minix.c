@@ -0,0 +1,582 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "minix.h"
+#include "zonemap.h"
+#include "dirindex.h"
+#include "dcache.h"
+#include "bcache.h"
+#include "sidecar.h"
+#include "dirscan.h"
+#include "byteorder.h"
+#include "readahead.h"
+
+uint32_t minix_name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    int i;
+
+    /* FNV-1a over at most DIRSIZ bytes, names need not be terminated */
+    for (i = 0; i < DIRSIZ && name[i]; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* copy len bytes at an absolute image offset, only used while opening,
+ * before the block size (and so the block cache) is known */
+static int read_bytes(const struct minix_image *img, uint64_t pos,
+    void *buf, uint64_t len) {
+    uint64_t done = 0;
+
+    if (pos > img->map_size || len > img->map_size - pos) {
+        return -1;
+    }
+    if (img->map) {
+        memcpy(buf, img->map + pos, len);
+        return 0;
+    }
+    while (done < len) {
+        ssize_t n = pread(img->fd, (uint8_t *)buf + done, len - done,
+            pos + done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/* partition table in the sector at byte offset base, after checking the
+ * 0x55AA boot signature */
+static int read_partition_table(const struct minix_image *img, uint64_t base,
+    struct partition_table table[4]) {
+    uint8_t sector[SECTOR_SIZE];
+
+    if (read_bytes(img, base, sector, SECTOR_SIZE) != 0) {
+        fprintf(stderr, "error: partition table at %llu is past end of "
+            "image\n", (unsigned long long)base);
+        return -1;
+    }
+    if (sector[BOOT_SIG_OFFSET] != BYTE_510 ||
+        sector[BOOT_SIG_OFFSET + 1] != BYTE_511) {
+        fprintf(stderr, "error: invalid partition table signature "
+            "(0x%02x%02x)\n", sector[BOOT_SIG_OFFSET],
+            sector[BOOT_SIG_OFFSET + 1]);
+        return -1;
+    }
+    memcpy(table, sector + PARTITION_TABLE_OFFSET,
+        4 * sizeof(struct partition_table));
+    return 0;
+}
+
+int minix_partition_offset(const struct minix_image *img, int partition,
+    int subpartition, uint64_t *offset) {
+    struct partition_table table[4];
+
+    *offset = 0;
+    if (partition == -1) {
+        return 0;
+    }
+    if (partition < 0 || partition > 3) {
+        fprintf(stderr, "error: invalid primary partition number: %d\n",
+            partition);
+        return -1;
+    }
+    if (read_partition_table(img, 0, table) != 0) {
+        return -1;
+    }
+    if (table[partition].type != PARTITION_TYPE) {
+        fprintf(stderr, "error: partition %d is not a Minix partition "
+            "(type 0x%02x)\n", partition, table[partition].type);
+        return -1;
+    }
+    *offset = (uint64_t)table[partition].IFirst * SECTOR_SIZE;
+
+    if (subpartition == -1) {
+        return 0;
+    }
+    if (subpartition < 0 || subpartition > 3) {
+        fprintf(stderr, "error: invalid subpartition number: %d\n",
+            subpartition);
+        return -1;
+    }
+    if (read_partition_table(img, *offset, table) != 0) {
+        return -1;
+    }
+    if (table[subpartition].type != PARTITION_TYPE) {
+        fprintf(stderr, "error: subpartition %d is not a Minix partition "
+            "(type 0x%02x)\n", subpartition, table[subpartition].type);
+        return -1;
+    }
+    /* subpartition sectors are absolute, not relative to the primary */
+    *offset = (uint64_t)table[subpartition].IFirst * SECTOR_SIZE;
+    return 0;
+}
+
+/* locate and validate the superblock of the filesystem at img->offset */
+static int load_superblock(struct minix_image *img) {
+    struct superblock *sb = &img->super;
+    uint64_t pos = img->offset + SUPERBLOCK_OFFSET;
+
+    if (read_bytes(img, pos, sb, sizeof(*sb)) != 0) {
+        fprintf(stderr, "error: superblock at %llu is past end of image\n",
+            (unsigned long long)pos);
+        return -1;
+    }
+    /* decided here once; everything read later is decoded to match */
+    if (sb->magic == (int16_t)R_MAGIC_NUM) {
+        img->swapped = 1;
+        minix_swap_superblock(sb);
+    }
+    if (sb->magic != MAGIC_NUM) {
+        fprintf(stderr, "Bad magic number. (0x%04x)\n",
+            (uint16_t)sb->magic);
+        fprintf(stderr, "This doesn't look like a MINIX filesystem.\n");
+        return -1;
+    }
+    if (sb->blocksize < SUPERBLOCK_OFFSET || sb->blocksize % INODE_SIZE ||
+        sb->log_zone_size < 0 || sb->log_zone_size > 16) {
+        fprintf(stderr, "error: corrupt superblock (blocksize %u, "
+            "log_zone_size %d)\n", sb->blocksize, sb->log_zone_size);
+        return -1;
+    }
+
+    img->sb = sb;
+    img->zone_size = (uint32_t)sb->blocksize << sb->log_zone_size;
+    /* boot block, superblock, then the two bitmaps */
+    img->inode_block = 2 + sb->i_blocks + sb->z_blocks;
+    return 0;
+}
+
+/* open with a mapping, or with a block cache of cache_blocks blocks */
+static int open_image(struct minix_image *img, const char *path,
+    int partition, int subpartition, uint32_t cache_blocks) {
+    struct stat st;
+    off_t size;
+
+    memset(img, 0, sizeof(*img));
+    img->fd = open(path, O_RDONLY);
+    if (img->fd < 0) {
+        fprintf(stderr, "error: cannot open image file '%s'\n", path);
+        return -1;
+    }
+
+    /* st_size is 0 for block devices, ask the device itself */
+    if (fstat(img->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size = st.st_size;
+    } else {
+        size = lseek(img->fd, 0, SEEK_END);
+    }
+    if (size <= 0) {
+        fprintf(stderr, "error: '%s' is empty\n", path);
+        close(img->fd);
+        return -1;
+    }
+    img->map_size = size;
+
+    if (cache_blocks == 0) {
+        void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, img->fd, 0);
+
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            close(img->fd);
+            return -1;
+        }
+        img->map = map;
+    }
+
+    if (minix_partition_offset(img, partition, subpartition,
+        &img->offset) != 0 || load_superblock(img) != 0) {
+        minix_close(img);
+        return -1;
+    }
+    if (cache_blocks != 0 && !(img->bcache = bcache_create(img->fd,
+        img->offset, img->sb->blocksize, cache_blocks))) {
+        fprintf(stderr, "error: out of memory for block cache\n");
+        minix_close(img);
+        return -1;
+    }
+    /* without a dentry cache every lookup just goes to the directory */
+    img->dcache = dcache_create();
+    img->readahead = readahead_create(img, RA_DEFAULT_WINDOW);
+    return 0;
+}
+
+int minix_open(struct minix_image *img, const char *path, int partition,
+    int subpartition) {
+    return open_image(img, path, partition, subpartition, 0);
+}
+
+int minix_open_cached(struct minix_image *img, const char *path,
+    int partition, int subpartition, uint32_t cache_blocks) {
+    return open_image(img, path, partition, subpartition,
+        cache_blocks ? cache_blocks : 1);
+}
+
+void minix_close(struct minix_image *img) {
+    dir_index_destroy(img->dir_index);
+    dcache_destroy(img->dcache);
+    bcache_destroy(img->bcache);
+    sidecar_close(img->sidecar);
+    readahead_destroy(img->readahead);
+    img->sidecar = NULL;
+    img->readahead = NULL;
+    img->dir_index = NULL;
+    img->dcache = NULL;
+    img->bcache = NULL;
+    if (img->map) {
+        munmap((void *)img->map, img->map_size);
+    }
+    if (img->fd >= 0) {
+        close(img->fd);
+    }
+    img->map = NULL;
+    img->fd = -1;
+}
+
+int minix_get_block(const struct minix_image *img, uint32_t block,
+    struct minix_buf *buf) {
+    uint64_t pos = img->offset + (uint64_t)block * img->sb->blocksize;
+
+    buf->data = NULL;
+    buf->block = NULL;
+    if (pos > img->map_size || img->sb->blocksize > img->map_size - pos) {
+        return -1;
+    }
+    if (img->map) {
+        buf->data = img->map + pos;
+        return 0;
+    }
+    if (!(buf->block = bcache_get(img->bcache, block))) {
+        return -1;
+    }
+    buf->data = buf->block->data;
+    return 0;
+}
+
+void minix_put_block(const struct minix_image *img, struct minix_buf *buf) {
+    if (buf->block) {
+        bcache_put(img->bcache, buf->block);
+    }
+    buf->data = NULL;
+    buf->block = NULL;
+}
+
+int minix_read_inode(const struct minix_image *img, uint32_t ino,
+    struct inode *inode) {
+    uint32_t per_block = img->sb->blocksize / INODE_SIZE;
+    struct minix_buf buf;
+
+    if (ino < ROOT_INODE || ino > img->sb->ninodes) {
+        return -1;
+    }
+    ra_inode_read(img, ino);
+    if (minix_get_block(img, img->inode_block + (ino - 1) / per_block,
+        &buf) != 0) {
+        return -1;
+    }
+    minix_decode_inode(img, buf.data + ((ino - 1) % per_block) * INODE_SIZE,
+        inode);
+    minix_put_block(img, &buf);
+    return 0;
+}
+
+void minix_decode_inode(const struct minix_image *img, const void *raw,
+    struct inode *inode) {
+    memcpy(inode, raw, sizeof(*inode));
+    if (img->swapped) {
+        minix_swap_inode(inode);
+    }
+}
+
+int minix_zone_valid(const struct minix_image *img, uint32_t zone) {
+    uint64_t pos = img->offset + (uint64_t)zone * img->zone_size;
+
+    return zone != 0 && zone < img->sb->zones && pos <= img->map_size &&
+        img->zone_size <= img->map_size - pos;
+}
+
+/* called with the live part of each directory block in turn, nonzero
+ * stops the walk */
+typedef int (*dir_block_fn)(const uint8_t *slots, uint32_t nslots,
+    void *arg);
+
+static int walk_dir_blocks(const struct minix_image *img,
+    const struct inode *dir, dir_block_fn fn, void *arg) {
+    uint32_t blocks_per_zone = 1u << img->sb->log_zone_size;
+    uint32_t blocksize = img->sb->blocksize;
+    struct zone_map map;
+    struct zone_extent ext;
+    int rc;
+
+    if (!MINIX_ISDIR(dir->mode)) {
+        fprintf(stderr, "Not a directory\n");
+        return -1;
+    }
+
+    zone_map_init(&map, img, dir);
+    while ((rc = zone_map_next(&map, &ext)) == 1) {
+        uint64_t pos = ext.file_zone * img->zone_size;
+        uint64_t len = (uint64_t)ext.length * img->zone_size;
+        uint32_t block = ext.start * blocks_per_zone;
+        uint64_t done;
+
+        if (ext.hole) {
+            continue; /* no entries here */
+        }
+        if (len > dir->size - pos) {
+            len = dir->size - pos;
+        }
+        for (done = 0; done < len; done += blocksize, block++) {
+            uint64_t end = len - done < blocksize ? len - done : blocksize;
+            struct minix_buf buf;
+
+            if (minix_get_block(img, block, &buf) != 0) {
+                fprintf(stderr, "error: cannot read directory block %u\n",
+                    block);
+                zone_map_release(&map);
+                return -1;
+            }
+            if (fn(buf.data, end / DIRECTORY_ENTRY_SIZE, arg)) {
+                minix_put_block(img, &buf);
+                zone_map_release(&map);
+                return 1;
+            }
+            minix_put_block(img, &buf);
+        }
+    }
+    zone_map_release(&map);
+    return rc < 0 ? -1 : 0;
+}
+
+struct readdir_arg {
+    minix_dirent_fn fn;
+    void *arg;
+};
+
+/* hand each live entry of a block to the caller */
+static int readdir_block(const uint8_t *slots, uint32_t nslots, void *arg) {
+    struct readdir_arg *readdir = arg;
+    uint64_t live[DIRSCAN_MAX_SLOTS / 64];
+    uint32_t w;
+
+    dirscan_live(slots, nslots, live);
+    for (w = 0; w < (nslots + 63) / 64; w++) {
+        while (live[w]) {
+            uint32_t i = w * 64 + __builtin_ctzll(live[w]);
+
+            live[w] &= live[w] - 1;
+            if (readdir->fn((const struct fileent *)(slots +
+                (size_t)i * DIRECTORY_ENTRY_SIZE), readdir->arg)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* same, handing over copies with the ino put in host order */
+static int readdir_block_swapped(const uint8_t *slots, uint32_t nslots,
+    void *arg) {
+    struct readdir_arg *readdir = arg;
+    uint64_t live[DIRSCAN_MAX_SLOTS / 64];
+    struct fileent entry;
+    uint32_t w;
+
+    dirscan_live(slots, nslots, live);
+    for (w = 0; w < (nslots + 63) / 64; w++) {
+        while (live[w]) {
+            uint32_t i = w * 64 + __builtin_ctzll(live[w]);
+
+            live[w] &= live[w] - 1;
+            memcpy(&entry, slots + (size_t)i * DIRECTORY_ENTRY_SIZE,
+                sizeof(entry));
+            entry.ino = __builtin_bswap32(entry.ino);
+            if (readdir->fn(&entry, readdir->arg)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int minix_readdir(const struct minix_image *img, const struct inode *dir,
+    minix_dirent_fn fn, void *arg) {
+    struct readdir_arg readdir = { fn, arg };
+
+    return walk_dir_blocks(img, dir, img->swapped ? readdir_block_swapped :
+        readdir_block, &readdir);
+}
+
+struct lookup_arg {
+    struct dir_key key;
+    uint32_t ino;
+};
+
+static int lookup_block(const uint8_t *slots, uint32_t nslots, void *arg) {
+    struct lookup_arg *lookup = arg;
+    int i = dirscan_find(slots, nslots, &lookup->key);
+
+    if (i < 0) {
+        return 0;
+    }
+    memcpy(&lookup->ino, slots + (size_t)i * DIRECTORY_ENTRY_SIZE,
+        sizeof(lookup->ino));
+    return 1;
+}
+
+int minix_lookup(const struct minix_image *img, const struct inode *dir,
+    const char *name, uint32_t *ino) {
+    struct lookup_arg lookup;
+
+    /* names fill all DIRSIZ bytes without a terminator */
+    if (dir_key_init(&lookup.key, name) != 0) {
+        return -1;
+    }
+    if (walk_dir_blocks(img, dir, lookup_block, &lookup) != 1) {
+        return -1;
+    }
+    *ino = img->swapped ? __builtin_bswap32(lookup.ino) : lookup.ino;
+    return 0;
+}
+
+/* one path component: dentry cache first, then the directory itself */
+static int lookup_component(const struct minix_image *img, uint32_t dir_ino,
+    const struct inode *dir, const char *name, uint32_t *ino) {
+    int rc;
+
+    if (img->dcache && dcache_lookup(img->dcache, dir_ino, name, ino)) {
+        return *ino != 0 ? 0 : -1;
+    }
+    if (img->dir_index) {
+        rc = dir_index_lookup(img->dir_index, img, dir_ino, dir, name, ino);
+    } else {
+        rc = minix_lookup(img, dir, name, ino);
+    }
+    if (img->dcache) {
+        dcache_insert(img->dcache, dir_ino, name, rc == 0 ? *ino : 0);
+    }
+    return rc;
+}
+
+int minix_resolve(const struct minix_image *img, const char *path,
+    uint32_t *ino) {
+    char name[DIRSIZ + 1];
+    uint32_t current = ROOT_INODE;
+    const char *p = path;
+
+    /* a sidecar index answers without touching a directory */
+    if (img->sidecar) {
+        int known;
+        const struct sidecar_entry *entry = sidecar_find(img->sidecar,
+            path, &known);
+
+        if (entry) {
+            *ino = entry->ino;
+            return 0;
+        }
+        if (known) {
+            fprintf(stderr, "Path not found: %s\n", path);
+            return -1;
+        }
+    }
+
+    while (*p) {
+        struct inode dir;
+        size_t len;
+
+        while (*p == '/') {
+            p++;
+        }
+        len = strcspn(p, "/");
+        if (len == 0) {
+            break;
+        }
+        if (len > DIRSIZ) {
+            fprintf(stderr, "Path not found: %.*s\n", (int)len, p);
+            return -1;
+        }
+        memcpy(name, p, len);
+        name[len] = '\0';
+        p += len;
+
+        if (minix_read_inode(img, current, &dir) != 0) {
+            fprintf(stderr, "error: bad inode number %u\n", current);
+            return -1;
+        }
+        if (!MINIX_ISDIR(dir.mode)) {
+            fprintf(stderr, "Not a directory\n");
+            return -1;
+        }
+        if (lookup_component(img, current, &dir, name, &current) != 0) {
+            fprintf(stderr, "Path not found: %s\n", name);
+            return -1;
+        }
+    }
+
+    *ino = current;
+    return 0;
+}
+
+int minix_enable_dir_index(struct minix_image *img) {
+    if (!img->dir_index && !(img->dir_index = dir_index_create(img))) {
+        fprintf(stderr, "error: out of memory for directory index\n");
+        return -1;
+    }
+    return 0;
+}
+
+int minix_set_readahead(struct minix_image *img, uint32_t max_window) {
+    readahead_destroy(img->readahead);
+    img->readahead = NULL;
+    if (max_window && !(img->readahead = readahead_create(img,
+        max_window))) {
+        fprintf(stderr, "error: out of memory for read-ahead\n");
+        return -1;
+    }
+    return 0;
+}
+
+void minix_print_stats(const struct minix_image *img, FILE *out) {
+    if (img->dcache) {
+        fprintf(out, "dcache: %llu hits (%llu negative), %llu misses, "
+            "%u entries\n", (unsigned long long)img->dcache->hits,
+            (unsigned long long)img->dcache->negative_hits,
+            (unsigned long long)img->dcache->misses, img->dcache->count);
+    }
+    if (img->sidecar) {
+        fprintf(out, "sidecar: %u paths, %llu extents%s, %llu lookups "
+            "answered, %llu passed on\n", img->sidecar->header->nentries,
+            (unsigned long long)img->sidecar->header->nextents,
+            img->sidecar->built ? " (built this run)" : "",
+            (unsigned long long)img->sidecar->hits,
+            (unsigned long long)img->sidecar->fallbacks);
+    }
+    if (img->bcache) {
+        struct bcache *cache = img->bcache;
+        uint64_t lookups = cache->hits + cache->misses;
+
+        fprintf(out, "bcache: %llu hits, %llu misses (%.1f%% hit rate), "
+            "%llu bytes read, %llu blocks read ahead, %llu evictions, "
+            "%u/%u blocks of %u bytes\n",
+            (unsigned long long)cache->hits,
+            (unsigned long long)cache->misses,
+            lookups ? 100.0 * cache->hits / lookups : 0.0,
+            (unsigned long long)cache->bytes_read,
+            (unsigned long long)cache->prefetched,
+            (unsigned long long)cache->evictions, cache->count,
+            cache->capacity, cache->block_size);
+    }
+    if (img->readahead) {
+        readahead_print_stats(img->readahead, out);
+    }
+}
@@ -0,0 +1,190 @@
+#ifndef MINIX_H
+#define MINIX_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SECTOR_SIZE 512
+#define BOOT_SIG_OFFSET 510
+#define PARTITION_TABLE_OFFSET 446
+#define EXTENDED_PARTITION 0x05
+#define SUPERBLOCK_OFFSET 1024 /* superblock is always 1k into the fs */
+
+#define PARTITION_TABLE_LOC 0x1BE /* location of the partition table */
+#define PARTITION_TYPE 0x81 /* partition type for Minix */
+#define BYTE_510 0x55 /*byte 510 of a boot sector with a valid partition table*/
+#define BYTE_511 0xAA /* byte 511 of a boot sector with valid partition table */
+#define MAGIC_NUM 0x4D5A /* the minix magic number */
+#define R_MAGIC_NUM 0x5A4D /* minix magic number on byte-reversed filesystem */
+#define MAGIC_NUM_OLD 0x2468 /* the minix magic number old  */
+#define R_MAGIC_NUM_OLD 0x6824 /* old reversed num */
+#define INODE_SIZE 64 /* size of an inode in bytes */
+#define DIRECTORY_ENTRY_SIZE 64 /* size of a directory entry in bytes */
+
+#define ROOT_INODE 1
+#define DIRECT_ZONES 7
+
+#define FILE_TYPE 0170000 /* File type mask */
+#define REGULAR_FILE 0100000 /* Regular file */
+#define DIRECTORY 0040000 /* Directory */
+#define SYMLINK 0120000 /* Symbolic link */
+#define OWR_PERMISSION 0000400 /* Owner read permission */
+#define OWW_PERMISSION 0000200 /* Owner write permission */
+#define OWE_PERMISSION 0000100 /* Owner execute permission */
+#define GR_PERMISSION 0000040 /* Group read permission */
+#define GW_PERMISSION 0000020 /* Group write permission */
+#define GE_PERMISSION 0000010 /* Group execute permission */
+#define OTR_PERMISSION 0000004 /* Other read permission */
+#define OTW_PERMISSION 0000002 /* Other write permission */
+#define OTE_PERMISSION 0000001 /* Other execute permission */
+
+#define MINIX_ISDIR(mode) (((mode) & FILE_TYPE) == DIRECTORY)
+#define MINIX_ISREG(mode) (((mode) & FILE_TYPE) == REGULAR_FILE)
+
+#ifndef DIRSIZ
+#define DIRSIZ 60
+#endif
+
+struct partition_table {
+	uint8_t bootind;        /* Boot magic number (0x80 if bootable) */
+	uint8_t start_head;     /* Start of partition in CHS   */
+	uint8_t start_sec;
+	uint8_t start_cyl;
+	uint8_t type;           /* Type of partition (0x81 is minix) */
+	uint8_t end_head;       /* End of partition in CHS   */
+	uint8_t end_sec;
+	uint8_t end_cyl;
+	uint32_t IFirst;        /* First sector (LBA addressing) */
+	uint32_t size;          /* size of partition (in sectors) */
+} __attribute__((packed));
+
+
+struct superblock { /* Minix Version 3 Superblock
+    * this structure found in fs/super.h
+    * in minix 3.1.1
+    */
+    /* on disk. These fields and orientation are non–negotiable */
+    uint32_t ninodes; /* number of inodes in this filesystem */
+    uint16_t pad1; /* make things line up properly */
+    int16_t i_blocks; /* # of blocks used by inode bit map */
+    int16_t z_blocks; /* # of blocks used by zone bit map */
+    uint16_t firstdata; /* number of first data zone */
+    int16_t log_zone_size; /* log2 of blocks per zone */
+    int16_t pad2; /* make things line up again */
+    uint32_t max_file; /* maximum file size */
+    uint32_t zones; /* number of zones on disk */
+    int16_t magic; /* magic number */
+    int16_t pad3; /* make things line up again */
+    uint16_t blocksize; /* block size in bytes */
+    uint8_t subversion; /* filesystem sub–version */
+} __attribute__((packed));
+
+
+struct inode {
+    uint16_t mode; /* mode */
+    uint16_t links; /* number or links */
+    uint16_t uid;
+    uint16_t gid;
+    uint32_t size;
+    int32_t atime;
+    int32_t mtime;
+    int32_t c_time;
+    uint32_t zone[DIRECT_ZONES];
+    uint32_t indirect;
+    uint32_t two_indirect;
+    uint32_t unused;
+} __attribute__((packed));
+
+
+
+struct fileent {
+    uint32_t ino;
+    char name[DIRSIZ];
+} __attribute__((packed));
+
+
+struct dir_index;
+struct dcache;
+struct bcache;
+struct bcache_block;
+struct sidecar;
+struct readahead;
+
+/* an open filesystem image. By default the whole image file is mapped
+ * read-only once at open time and block accesses point straight into the
+ * mapping. Opened with a block cache instead, blocks are read with pread
+ * into an LRU cache and pinned while in use. */
+struct minix_image {
+    int fd;
+    const uint8_t *map;        /* read-only mapping, NULL when cached */
+    uint64_t map_size;         /* size of the image file */
+    uint64_t offset;           /* byte offset of the filesystem */
+    struct superblock super;
+    const struct superblock *sb; /* points at super */
+    uint32_t zone_size;        /* blocksize << log_zone_size */
+    uint32_t inode_block;      /* first block of the inode table */
+    int swapped;               /* on-disk integers are byte-reversed */
+    struct bcache *bcache;     /* block cache, NULL when mapped */
+    struct dir_index *dir_index; /* hashed lookups, NULL until enabled */
+    struct dcache *dcache;     /* (parent, name) -> inode lookups */
+    struct sidecar *sidecar;   /* on-disk path index, NULL if not used */
+    struct readahead *readahead; /* prefetch policy, NULL when turned off */
+};
+
+/* a pinned view of one filesystem block, release with minix_put_block */
+struct minix_buf {
+    const uint8_t *data;
+    struct bcache_block *block;  /* NULL when data points into the map */
+};
+
+/* called once per live directory entry, stop early by returning nonzero.
+ * entry is only valid during the call. */
+typedef int (*minix_dirent_fn)(const struct fileent *entry, void *arg);
+
+/* open and map an image, select partition/subpartition (-1 for none)
+ * and validate its superblock */
+int minix_open(struct minix_image *img, const char *path, int partition,
+    int subpartition);
+/* same, but read through a block cache of cache_blocks blocks */
+int minix_open_cached(struct minix_image *img, const char *path,
+    int partition, int subpartition, uint32_t cache_blocks);
+void minix_close(struct minix_image *img);
+
+/* byte offset of the filesystem chosen by -p part [-s sub] */
+int minix_partition_offset(const struct minix_image *img, int partition,
+    int subpartition, uint64_t *offset);
+
+/* block and inode access, -1 when out of range or unreadable */
+int minix_get_block(const struct minix_image *img, uint32_t block,
+    struct minix_buf *buf);
+void minix_put_block(const struct minix_image *img, struct minix_buf *buf);
+int minix_read_inode(const struct minix_image *img, uint32_t ino,
+    struct inode *inode);
+/* an inode as it sits in the inode table, put in host byte order */
+void minix_decode_inode(const struct minix_image *img, const void *raw,
+    struct inode *inode);
+int minix_zone_valid(const struct minix_image *img, uint32_t zone);
+
+/* directory walking and path resolution */
+int minix_readdir(const struct minix_image *img, const struct inode *dir,
+    minix_dirent_fn fn, void *arg);
+int minix_lookup(const struct minix_image *img, const struct inode *dir,
+    const char *name, uint32_t *ino);
+int minix_resolve(const struct minix_image *img, const char *path,
+    uint32_t *ino);
+
+/* hash of a directory entry name, shared by the lookup caches */
+uint32_t minix_name_hash(const char *name);
+
+/* have minix_resolve hash each directory on first use instead of scanning
+ * it per lookup; worth it when resolving many paths in one image */
+int minix_enable_dir_index(struct minix_image *img);
+
+/* widest read-ahead window in bytes, 0 to turn read-ahead off */
+int minix_set_readahead(struct minix_image *img, uint32_t max_window);
+
+/* cache counters for -v output */
+void minix_print_stats(const struct minix_image *img, FILE *out);
+
+#endif /*MINIX_H*/
@@ -0,0 +1,648 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "minix.h"
+#include "extract.h"
+#include "remote.h"
+#include "workq.h"
+
+#define DEFAULT_IMAGES 64   /* images kept open when idle */
+#define MAX_EVENTS 64
+
+void print_usage() {
+    printf("Usage: minixd [-v] [-f] [-j threads] [-n images] socketpath\n");
+}
+
+/* an open image, shared by every request that names it. Images stay
+ * mapped, so all that a request costs is the lookups it does, and the
+ * directory entry cache stays warm from one client to the next. */
+struct served {
+    char path[PATH_MAX];
+    int partition;
+    int subpartition;
+    struct stat st;           /* of the file when it was opened */
+    struct minix_image img;
+    unsigned refs;            /* requests using it right now */
+    int stale;                /* replaced on disk, goes when refs drops */
+    uint64_t last_used;
+    struct served *next;
+};
+
+struct image_table {
+    pthread_mutex_t lock;
+    struct served *head;
+    unsigned count;
+    unsigned max;             /* idle images beyond this get closed */
+    uint64_t clock;
+    uint64_t opens;
+    uint64_t hits;
+};
+
+/* a client connection. The event loop owns it while waiting for a
+ * request, a worker while answering one; EPOLLONESHOT hands it over. */
+struct conn {
+    int fd;
+    int passed_fd;            /* a get's destination, -1 if none */
+    size_t got;
+    uint8_t buf[sizeof(struct remote_request) + 2 * PATH_MAX];
+};
+
+struct server {
+    int listen_fd;
+    int epoll_fd;
+    char socket_path[PATH_MAX];
+    struct image_table images;
+    struct workq q;
+    uint64_t connections;
+    uint64_t requests;
+    uint64_t bytes;           /* file data sent or written for clients */
+};
+
+static volatile sig_atomic_t stopping;
+
+static void stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+        a->st_size == b->st_size &&
+        a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+        a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/* unlink s from the table and close it; called locked with refs at 0 */
+static void image_drop(struct image_table *t, struct served *s) {
+    struct served **p;
+
+    for (p = &t->head; *p; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    }
+    t->count--;
+    minix_close(&s->img);
+    free(s);
+}
+
+/* close the least recently used idle image; called locked */
+static void image_evict(struct image_table *t) {
+    struct served *s, *victim = NULL;
+
+    for (s = t->head; s; s = s->next) {
+        if (s->refs == 0 && (!victim || s->last_used < victim->last_used)) {
+            victim = s;
+        }
+    }
+    if (victim) {
+        image_drop(t, victim);
+    }
+}
+
+/* the image at path, opened now or earlier and not changed since; NULL
+ * if it can't be opened. Release it with image_release. */
+static struct served *image_acquire(struct image_table *t, const char *path,
+    int partition, int subpartition) {
+    struct served *s;
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&t->lock);
+    t->clock++;
+    for (s = t->head; s; s = s->next) {
+        if (s->stale || s->partition != partition ||
+            s->subpartition != subpartition || strcmp(s->path, path) != 0) {
+            continue;
+        }
+        if (same_file(&s->st, &st)) {
+            s->refs++;
+            s->last_used = t->clock;
+            t->hits++;
+            pthread_mutex_unlock(&t->lock);
+            return s;
+        }
+        /* rewritten since: finish what is using it, then let it go */
+        s->stale = 1;
+        if (s->refs == 0) {
+            image_drop(t, s);
+        }
+        break;
+    }
+
+    /* opening is a map and a superblock check, quick enough to do
+     * holding the lock, and it stops two threads opening one image */
+    while (t->count >= t->max) {
+        unsigned before = t->count;
+
+        image_evict(t);
+        if (t->count == before) {
+            break;            /* all busy, go over for now */
+        }
+    }
+    if (!(s = calloc(1, sizeof(*s))) ||
+        minix_open(&s->img, path, partition, subpartition) != 0) {
+        pthread_mutex_unlock(&t->lock);
+        free(s);
+        return NULL;
+    }
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    s->partition = partition;
+    s->subpartition = subpartition;
+    if (fstat(s->img.fd, &s->st) != 0) {
+        s->st = st;
+    }
+    s->refs = 1;
+    s->last_used = t->clock;
+    s->next = t->head;
+    t->head = s;
+    t->count++;
+    t->opens++;
+    pthread_mutex_unlock(&t->lock);
+    return s;
+}
+
+static void image_release(struct image_table *t, struct served *s) {
+    pthread_mutex_lock(&t->lock);
+    if (--s->refs == 0 && s->stale) {
+        image_drop(t, s);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+static void conn_close(struct conn *conn) {
+    if (conn->passed_fd >= 0) {
+        close(conn->passed_fd);
+    }
+    close(conn->fd);
+    free(conn);
+}
+
+/* wait for the connection's next request */
+static int conn_arm(struct server *srv, struct conn *conn, int op) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    return epoll_ctl(srv->epoll_fd, op, conn->fd, &ev);
+}
+
+/* read what has arrived of a request without blocking: 1 when it is
+ * all there, 0 to wait for more, -1 to hang up. Only the request's own
+ * bytes are read, so the next one stays in the socket. */
+static int conn_read(struct conn *conn) {
+    struct remote_request req;
+    union {
+        struct cmsghdr align;
+        char bytes[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    size_t need;
+    ssize_t n;
+
+    for (;;) {
+        need = sizeof(req);
+        if (conn->got >= sizeof(req)) {
+            memcpy(&req, conn->buf, sizeof(req));
+            if (req.magic != REMOTE_MAGIC || req.image_len == 0 ||
+                req.image_len >= PATH_MAX || req.path_len >= PATH_MAX) {
+                return -1;
+            }
+            need += req.image_len + req.path_len;
+            if (conn->got == need) {
+                return 1;
+            }
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = conn->buf + conn->got;
+        iov.iov_len = need - conn->got;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.bytes;
+        msg.msg_controllen = sizeof(control.bytes);
+        n = recvmsg(conn->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+            cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            int fd;
+
+            if (cmsg->cmsg_level != SOL_SOCKET ||
+                cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+            if (conn->passed_fd >= 0) {
+                close(fd);
+            } else {
+                conn->passed_fd = fd;
+            }
+        }
+        conn->got += n;
+    }
+}
+
+static int send_reply(int fd, const struct remote_reply *reply) {
+    return remote_write_full(fd, reply, sizeof(*reply));
+}
+
+/* a directory listing being gathered */
+struct listing {
+    const struct minix_image *img;
+    struct remote_entry *entries;
+    uint32_t count;
+    uint32_t cap;
+};
+
+static int add_entry(const struct fileent *entry, void *arg) {
+    struct listing *list = arg;
+    struct remote_entry *e;
+
+    if (list->count == list->cap) {
+        uint32_t cap = list->cap ? list->cap * 2 : 64;
+        struct remote_entry *grown = realloc(list->entries,
+            cap * sizeof(*grown));
+
+        if (!grown) {
+            return 1;
+        }
+        list->entries = grown;
+        list->cap = cap;
+    }
+    e = &list->entries[list->count++];
+    memset(e, 0, sizeof(*e));
+    e->ino = entry->ino;
+    memcpy(e->name, entry->name, DIRSIZ);
+    if (minix_read_inode(list->img, entry->ino, &e->inode) != 0) {
+        e->flags = REMOTE_BAD_INODE;
+    }
+    return 0;
+}
+
+static int send_listing(struct conn *conn, const struct minix_image *img,
+    struct remote_reply *reply) {
+    struct listing list = { img, NULL, 0, 0 };
+    int rc;
+
+    if (minix_readdir(img, &reply->inode, add_entry, &list) != 0) {
+        free(list.entries);
+        reply->status = REMOTE_FAILED;
+        return send_reply(conn->fd, reply);
+    }
+    reply->count = list.count;
+    rc = send_reply(conn->fd, reply);
+    if (rc == 0 && list.count) {
+        rc = remote_write_full(conn->fd, list.entries,
+            (size_t)list.count * sizeof(*list.entries));
+    }
+    free(list.entries);
+    return rc;
+}
+
+/* straight into the client's own file when it passed one, so the data
+ * goes from the image to there by copy_file_range or sendfile without
+ * passing through either process; otherwise after the reply on the
+ * socket itself. A failure partway through a stream can only be told
+ * by hanging up. */
+static int send_file(struct server *srv, struct conn *conn,
+    const struct minix_image *img, struct remote_reply *reply) {
+    reply->size = reply->inode.size;
+    if (conn->passed_fd >= 0) {
+        if (minix_extract(img, &reply->inode, conn->passed_fd, NULL) != 0) {
+            reply->status = REMOTE_FAILED;
+        } else {
+            __atomic_add_fetch(&srv->bytes, reply->size, __ATOMIC_RELAXED);
+        }
+        return send_reply(conn->fd, reply);
+    }
+    if (send_reply(conn->fd, reply) != 0 ||
+        minix_extract(img, &reply->inode, conn->fd, NULL) != 0) {
+        return -1;
+    }
+    __atomic_add_fetch(&srv->bytes, reply->size, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* answer one request, -1 when the connection is no longer usable */
+static int answer(struct server *srv, struct conn *conn,
+    const struct remote_request *req, const char *image, const char *path) {
+    struct remote_reply reply;
+    struct served *s;
+    uint32_t ino;
+    int rc;
+
+    memset(&reply, 0, sizeof(reply));
+    if (req->op < REMOTE_STAT || req->op > REMOTE_GET) {
+        reply.status = REMOTE_BAD_REQUEST;
+        return send_reply(conn->fd, &reply);
+    }
+    if (!(s = image_acquire(&srv->images, image, req->partition,
+        req->subpartition))) {
+        reply.status = REMOTE_BAD_IMAGE;
+        return send_reply(conn->fd, &reply);
+    }
+    reply.offset = s->img.offset;
+    reply.super = *s->img.sb;
+
+    if (minix_resolve(&s->img, path, &ino) != 0 ||
+        minix_read_inode(&s->img, ino, &reply.inode) != 0) {
+        reply.status = REMOTE_NOT_FOUND;
+        rc = send_reply(conn->fd, &reply);
+        image_release(&srv->images, s);
+        return rc;
+    }
+    reply.ino = ino;
+    if (req->op == REMOTE_LIST && MINIX_ISDIR(reply.inode.mode)) {
+        rc = send_listing(conn, &s->img, &reply);
+    } else if (req->op == REMOTE_GET && !MINIX_ISREG(reply.inode.mode)) {
+        reply.status = REMOTE_NOT_FILE;
+        rc = send_reply(conn->fd, &reply);
+    } else if (req->op == REMOTE_GET) {
+        rc = send_file(srv, conn, &s->img, &reply);
+    } else {
+        rc = send_reply(conn->fd, &reply);
+    }
+    image_release(&srv->images, s);
+    return rc;
+}
+
+/* worker side: answer the request read in full by the event loop, then
+ * hand the connection back to it */
+static void serve(void *item, void *ctx) {
+    struct server *srv = ctx;
+    struct conn *conn = item;
+    struct remote_request req;
+    char image[PATH_MAX];
+    char path[PATH_MAX];
+    int rc;
+
+    memcpy(&req, conn->buf, sizeof(req));
+    memcpy(image, conn->buf + sizeof(req), req.image_len);
+    image[req.image_len] = '\0';
+    memcpy(path, conn->buf + sizeof(req) + req.image_len, req.path_len);
+    path[req.path_len] = '\0';
+    __atomic_add_fetch(&srv->requests, 1, __ATOMIC_RELAXED);
+
+    rc = answer(srv, conn, &req, image, path);
+    if (conn->passed_fd >= 0) {
+        close(conn->passed_fd);
+        conn->passed_fd = -1;
+    }
+    conn->got = 0;
+    if (rc != 0 || conn_arm(srv, conn, EPOLL_CTL_MOD) != 0) {
+        conn_close(conn);
+    }
+}
+
+static void accept_all(struct server *srv) {
+    struct conn *conn;
+    int fd;
+
+    while ((fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        if (!(conn = calloc(1, sizeof(*conn)))) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->passed_fd = -1;
+        if (conn_arm(srv, conn, EPOLL_CTL_ADD) != 0) {
+            conn_close(conn);
+            continue;
+        }
+        srv->connections++;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+        errno != ECONNABORTED) {
+        perror("accept");
+    }
+}
+
+/* wait for requests until told to stop; each complete one goes to a
+ * worker, which may block on the client as long as it likes */
+static void event_loop(struct server *srv) {
+    struct epoll_event events[MAX_EVENTS];
+    int n, i;
+
+    while (!stopping) {
+        if ((n = epoll_wait(srv->epoll_fd, events, MAX_EVENTS, -1)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return;
+        }
+        for (i = 0; i < n; i++) {
+            struct conn *conn = events[i].data.ptr;
+            int rc;
+
+            if (!conn) {
+                accept_all(srv);
+                continue;
+            }
+            rc = conn_read(conn);
+            if (rc == 1 && workq_push(&srv->q, conn) == 0) {
+                continue;
+            }
+            if (rc != 0 || conn_arm(srv, conn, EPOLL_CTL_MOD) != 0) {
+                conn_close(conn);
+            }
+        }
+    }
+}
+
+static int listen_on(struct server *srv, const char *socket_path) {
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    struct stat st;
+    mode_t old_mask;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "error: socket path too long '%s'\n", socket_path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    /* a socket left behind by a daemon that is gone can be reused */
+    if (remote_connect(socket_path) >= 0) {
+        fprintf(stderr, "error: a daemon is already listening on %s\n",
+            socket_path);
+        return -1;
+    }
+    /* but only a socket: a mistyped path mustn't cost someone a file */
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "error: %s exists and is not a socket\n",
+                socket_path);
+            return -1;
+        }
+        unlink(socket_path);
+    }
+    /* clients get any image the daemon can open, so only its owner may
+     * connect, whatever umask it was started with */
+    old_mask = umask(0077);
+    if ((srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+        SOCK_CLOEXEC, 0)) < 0 ||
+        bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        chmod(socket_path, 0600) != 0 ||
+        listen(srv->listen_fd, SOMAXCONN) != 0) {
+        perror(socket_path);
+        umask(old_mask);
+        return -1;
+    }
+    umask(old_mask);
+    snprintf(srv->socket_path, sizeof(srv->socket_path), "%s", socket_path);
+
+    if ((srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listen_fd, &ev) != 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+/* keep images open and answer minls and minget (or anything else that
+ * speaks remote.h) over a Unix socket until SIGINT or SIGTERM */
+int main(int argc, char *argv[]) {
+    int verbose = 0;
+    int foreground = 0;
+    int nthreads = workq_default_threads();
+    int max_images = DEFAULT_IMAGES;
+    char *socket_path = NULL;
+    struct server srv;
+    struct sigaction sa;
+    sigset_t stops, old;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            foreground = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            max_images = atoi(argv[++i]);
+        } else if (!socket_path) {
+            socket_path = argv[i];
+        } else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!socket_path || nthreads < 1 || max_images < 1) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    memset(&srv, 0, sizeof(srv));
+    srv.listen_fd = srv.epoll_fd = -1;
+    pthread_mutex_init(&srv.images.lock, NULL);
+    srv.images.max = max_images;
+    if (listen_on(&srv, socket_path) != 0) {
+        if (srv.listen_fd >= 0) {
+            close(srv.listen_fd);
+        }
+        if (srv.epoll_fd >= 0) {
+            close(srv.epoll_fd);
+        }
+        return EXIT_FAILURE;
+    }
+
+    if (!foreground) {
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            perror("fork");
+            foreground = 1;
+        } else if (pid > 0) {
+            return EXIT_SUCCESS;
+        } else {
+            int null = open("/dev/null", O_RDWR);
+
+            setsid();
+            if (chdir("/") != 0) {
+                perror("chdir");
+            }
+            if (null >= 0) {
+                dup2(null, STDIN_FILENO);
+                dup2(null, STDOUT_FILENO);
+                dup2(null, STDERR_FILENO);
+                close(null);
+            }
+        }
+    }
+
+    /* clients hanging up mid-reply must not take the daemon with them */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* stop signals go to the event loop, the workers never see them */
+    sigemptyset(&stops);
+    sigaddset(&stops, SIGINT);
+    sigaddset(&stops, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stops, &old);
+    if (workq_start(&srv.q, nthreads, serve, &srv) != 0) {
+        unlink(srv.socket_path);
+        return EXIT_FAILURE;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    event_loop(&srv);
+
+    /* let requests already handed out finish; connections still idle
+     * go with the process */
+    unlink(srv.socket_path);
+    close(srv.listen_fd);
+    workq_finish(&srv.q);
+    close(srv.epoll_fd);
+
+    if (verbose) {
+        fprintf(stderr, "minixd: %llu connections, %llu requests, %llu "
+            "file bytes served\n", (unsigned long long)srv.connections,
+            (unsigned long long)srv.requests,
+            (unsigned long long)srv.bytes);
+        fprintf(stderr, "images: %llu opened, %llu reused, %u open at "
+            "exit\n", (unsigned long long)srv.images.opens,
+            (unsigned long long)srv.images.hits, srv.images.count);
+    }
+    while (srv.images.head) {
+        image_drop(&srv.images, srv.images.head);
+    }
+    pthread_mutex_destroy(&srv.images.lock);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "minix.h"
+#include "extract.h"
+#include "listing.h"
+#include "partscan.h"
+#include "readahead.h"
+#include "workq.h"
+
+void print_usage() {
+    printf("Usage: minjobs [-v] [-j threads] [-C blocks] [-A kb] "
+        "[-f targetfile] -l|-i|-x dstdir target...\n");
+    printf("       a target is imagefile[:part[:sub]]; an image given "
+        "alone means every\n       MINIX filesystem in it\n");
+}
+
+enum job_mode {
+    MODE_LIST,        /* minls -R of each root */
+    MODE_INVENTORY,   /* minls -R -j, every record tagged with its fs */
+    MODE_EXTRACT      /* minget -r of each root into a directory of its own */
+};
+
+/* one filesystem to process */
+struct job {
+    char *image;
+    int partition;
+    int subpartition;
+    char *name;               /* image[:part[:sub]] */
+    char *dst;                /* where it is extracted to */
+    int status;
+    double seconds;
+    struct extract_stats stats;
+};
+
+struct driver {
+    enum job_mode mode;
+    const char *dstdir;
+    uint32_t cache_blocks;
+    int readahead_kb;
+    int extract_threads;      /* per job, 0 to extract on the job's thread */
+    int verbose;
+    struct job *jobs;
+    uint32_t count;
+    uint32_t cap;
+    pthread_mutex_t lock;     /* guards stdout and failed */
+    uint32_t failed;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* minix_target_fn adding a job for one filesystem */
+static int add_job(const char *image, int partition, int subpartition,
+    void *arg) {
+    struct driver *drv = arg;
+    struct job *job;
+    char name[PATH_MAX + 32];
+    const char *base = strrchr(image, '/');
+
+    if (drv->count == drv->cap) {
+        uint32_t cap = drv->cap ? drv->cap * 2 : 64;
+        struct job *grown = realloc(drv->jobs, cap * sizeof(*grown));
+
+        if (!grown) {
+            fprintf(stderr, "error: out of memory\n");
+            return -1;
+        }
+        drv->jobs = grown;
+        drv->cap = cap;
+    }
+    job = &drv->jobs[drv->count];
+    memset(job, 0, sizeof(*job));
+    job->partition = partition;
+    job->subpartition = subpartition;
+    if (subpartition >= 0) {
+        snprintf(name, sizeof(name), "%s:%d:%d", image, partition,
+            subpartition);
+    } else if (partition >= 0) {
+        snprintf(name, sizeof(name), "%s:%d", image, partition);
+    } else {
+        snprintf(name, sizeof(name), "%s", image);
+    }
+    if (!(job->image = strdup(image)) || !(job->name = strdup(name))) {
+        fprintf(stderr, "error: out of memory\n");
+        free(job->image);
+        return -1;
+    }
+
+    /* dstdir/image.p0.s1, named after the image file alone */
+    if (drv->mode == MODE_EXTRACT) {
+        base = base ? base + 1 : image;
+        if (subpartition >= 0) {
+            snprintf(name, sizeof(name), "%s/%s.p%d.s%d", drv->dstdir, base,
+                partition, subpartition);
+        } else if (partition >= 0) {
+            snprintf(name, sizeof(name), "%s/%s.p%d", drv->dstdir, base,
+                partition);
+        } else {
+            snprintf(name, sizeof(name), "%s/%s", drv->dstdir, base);
+        }
+        if (!(job->dst = strdup(name))) {
+            fprintf(stderr, "error: out of memory\n");
+            free(job->image);
+            free(job->name);
+            return -1;
+        }
+    }
+    drv->count++;
+    return 0;
+}
+
+/* two targets naming the same filesystem would extract over each other */
+static int check_destinations(const struct driver *drv) {
+    uint32_t i, j;
+
+    for (i = 0; i < drv->count; i++) {
+        for (j = i + 1; j < drv->count; j++) {
+            if (strcmp(drv->jobs[i].dst, drv->jobs[j].dst) == 0) {
+                fprintf(stderr, "error: %s and %s both extract to %s\n",
+                    drv->jobs[i].name, drv->jobs[j].name, drv->jobs[i].dst);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* copy what a job wrote to its own file onto stdout; called locked */
+static void emit(FILE *out) {
+    char buf[65536];
+    size_t n;
+
+    fflush(out);
+    rewind(out);
+    while ((n = fread(buf, 1, sizeof(buf), out)) > 0) {
+        fwrite(buf, 1, n, stdout);
+    }
+    fflush(stdout);
+}
+
+/* worker side: open the job's filesystem with caches of its own, run it,
+ * then print its output in one piece. Nothing is shared between jobs but
+ * stdout, so one bad image can't hold up or corrupt another. */
+static void run_job(void *item, void *ctx) {
+    struct job *job = item;
+    struct driver *drv = ctx;
+    struct minix_image img;
+    struct inode root;
+    FILE *out = NULL;
+    double start = now();
+
+    job->status = -1;
+    if (drv->mode != MODE_EXTRACT && !(out = tmpfile())) {
+        perror("tmpfile");
+    } else if ((drv->cache_blocks ? minix_open_cached(&img, job->image,
+        job->partition, job->subpartition, drv->cache_blocks) :
+        minix_open(&img, job->image, job->partition,
+        job->subpartition)) != 0) {
+        fprintf(stderr, "%s: cannot open filesystem\n", job->name);
+    } else {
+        if (minix_set_readahead(&img, drv->readahead_kb * 1024) != 0 ||
+            minix_read_inode(&img, ROOT_INODE, &root) != 0) {
+            fprintf(stderr, "%s: cannot read the root directory\n",
+                job->name);
+        } else if (drv->mode == MODE_LIST) {
+            fprintf(out, "==> %s <==\n", job->name);
+            list_tree(out, &img, ROOT_INODE, "/", 0);
+            fprintf(out, "\n");
+            job->status = ferror(out) ? -1 : 0;
+        } else if (drv->mode == MODE_INVENTORY) {
+            job->status = print_inventory(fileno(out), &img, ROOT_INODE,
+                &root, "/", 1, job->name);
+        } else {
+            job->status = minix_extract_tree(&img, ROOT_INODE, job->dst,
+                drv->extract_threads, 0, drv->verbose, NULL, &job->stats);
+        }
+        minix_close(&img);
+    }
+    job->seconds = now() - start;
+
+    pthread_mutex_lock(&drv->lock);
+    if (out && job->status == 0) {
+        emit(out);
+    }
+    if (job->status != 0) {
+        drv->failed++;
+    }
+    if (drv->verbose) {
+        fprintf(stderr, "%s: %s in %.3f s", job->name,
+            job->status == 0 ? "done" : "failed", job->seconds);
+        if (drv->mode == MODE_EXTRACT) {
+            fprintf(stderr, ", %u files, %u directories, %llu bytes",
+                job->stats.files, job->stats.dirs,
+                (unsigned long long)job->stats.bytes);
+        }
+        fprintf(stderr, "\n");
+    }
+    pthread_mutex_unlock(&drv->lock);
+    if (out) {
+        fclose(out);
+    }
+}
+
+/* list, inventory or extract many filesystems at once, each on its own
+ * thread from a bounded pool; output comes in the order jobs finish */
+int main(int argc, char *argv[]) {
+    struct driver drv;
+    struct workq q;
+    int nthreads = workq_default_threads();
+    const char *target_file = NULL;
+    char **targets = calloc(argc, sizeof(*targets));
+    int ntargets = 0, modes = 0, status = 0, pool, i;
+    double start;
+    uint32_t unqueued = 0, j;
+
+    memset(&drv, 0, sizeof(drv));
+    drv.readahead_kb = RA_DEFAULT_WINDOW / 1024;
+    if (!targets) {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            drv.verbose = 1;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            drv.mode = MODE_LIST;
+            modes++;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            drv.mode = MODE_INVENTORY;
+            modes++;
+        } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+            drv.mode = MODE_EXTRACT;
+            drv.dstdir = argv[++i];
+            modes++;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            drv.cache_blocks = atoi(argv[++i]);
+            if (atoi(argv[i]) <= 0) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) {
+            drv.readahead_kb = atoi(argv[++i]);
+            if (drv.readahead_kb < 0 || drv.readahead_kb > 1024 * 1024) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            target_file = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            print_usage();
+            return EXIT_FAILURE;
+        } else {
+            targets[ntargets++] = argv[i];
+        }
+    }
+    if (modes != 1 || nthreads < 1 || (!ntargets && !target_file)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    if (drv.mode == MODE_EXTRACT && mkdir(drv.dstdir, 0777) != 0 &&
+        errno != EEXIST) {
+        perror(drv.dstdir);
+        return EXIT_FAILURE;
+    }
+
+    /* bad targets are reported and the rest still get done */
+    for (i = 0; i < ntargets; i++) {
+        if (minix_expand_target(targets[i], add_job, &drv) != 0) {
+            status = -1;
+        }
+    }
+    free(targets);
+    if (target_file && minix_read_targets(target_file, add_job,
+        &drv) != 0) {
+        status = -1;
+    }
+    if (drv.mode == MODE_EXTRACT && check_destinations(&drv) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    /* a thread per filesystem up to the limit; with fewer filesystems
+     * than that, the rest of the threads help extract within them */
+    pool = drv.count < (uint32_t)nthreads ? (int)drv.count : nthreads;
+    if (pool > 0 && drv.mode == MODE_EXTRACT && nthreads / pool > 1) {
+        drv.extract_threads = nthreads / pool;
+    }
+    pthread_mutex_init(&drv.lock, NULL);
+    start = now();
+    if (pool > 0 && workq_start(&q, pool, run_job, &drv) == 0) {
+        for (j = 0; j < drv.count; j++) {
+            if (workq_push(&q, &drv.jobs[j]) != 0) {
+                unqueued++;
+            }
+        }
+        /* the workers count failures under the lock until they stop */
+        workq_finish(&q);
+        drv.failed += unqueued;
+    } else if (pool > 0) {
+        drv.failed = drv.count;
+    }
+
+    if (drv.verbose) {
+        fprintf(stderr, "minjobs: %u filesystems, %u failed, %d threads, "
+            "%.3f s\n", drv.count, drv.failed, pool, now() - start);
+    }
+    for (j = 0; j < drv.count; j++) {
+        free(drv.jobs[j].image);
+        free(drv.jobs[j].name);
+        free(drv.jobs[j].dst);
+    }
+    free(drv.jobs);
+    pthread_mutex_destroy(&drv.lock);
+    return status == 0 && drv.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,43 +2,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include "minls.h"
-
-#define S_ISDIR(mode) (((mode) & DIRECTORY) == DIRECTORY)
+#include <unistd.h>
+#include "minix.h"
+#include "jsonout.h"
+#include "listing.h"
+#include "sidecar.h"
+#include "readahead.h"
+#include "remote.h"
+#include "partscan.h"
 
 void print_usage() {
-    printf("Usage: minls [-v][-p part[-s sub]] imagefile [path]\n");
-}
-
-void read_superblock(FILE *file, struct superblock *sb, int partition_offset) {
-    long superblock_offset = partition_offset;
-
-    // First check at partition_offset
-    fseek(file, superblock_offset, SEEK_SET);
-    fread(sb, sizeof(struct superblock), 1, file);
-
-    if (sb->magic != MAGIC_NUM && sb->magic != R_MAGIC_NUM) {
-        // If no valid magic number, check partition_offset + 1024
-        superblock_offset = partition_offset + 1024;
-        fseek(file, superblock_offset, SEEK_SET);
-        fread(sb, sizeof(struct superblock), 1, file);
-    }
-
-    // Validate the superblock magic number
-    if (sb->magic != MAGIC_NUM && sb->magic != R_MAGIC_NUM) {
-        fprintf(stderr, "Bad magic number. (0x%x) at offset %ld\n",
-                sb->magic, superblock_offset);
-        fprintf(stderr, "This doesn’t look like a MINIX filesystem.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    printf("Superblock Magic: 0x%x at Offset: %ld\n", sb->magic, superblock_offset);
+    printf("Usage: minls [-v][-R][-j][-I][-C blocks][-A kb][-S socket]"
+        "[-p part[-s sub]] imagefile [path]\n");
+    printf("       minls -P [-j] imagefile\n");
 }
 
-
-
 /* self explanatory */
-void print_superblock(struct superblock *sb) {
+void print_superblock(const struct superblock *sb) {
     int zone_size = sb->blocksize * (1 << sb->log_zone_size);
     printf("\nSuperblock Contents:\nStored Fields:\n");
     printf("  ninodes %u\n", sb->ninodes);
@@ -54,124 +34,12 @@ void print_superblock(struct superblock *sb) {
     printf("  subversion %u\n", sb->subversion);
 }
 
-void read_inode(FILE *file, int inode_num, struct inode *inode,
-                struct superblock *sb) {
-    int inodes_per_block = sb->blocksize / INODE_SIZE;
-    int inode_start_block = 2 + sb->i_blocks + sb->z_blocks;
-    int inode_block = ((inode_num - 1) / inodes_per_block) + inode_start_block;
-    int inode_index = (inode_num - 1) % inodes_per_block;
-    long inode_offset = (inode_block * sb->blocksize) + 
-        (inode_index * INODE_SIZE);
-
-    /* seek calculated inode offset within file */
-    if (fseek(file, inode_offset, SEEK_SET) != 0) {
-        perror("Failed to seek to inode position");
-        return;
-    }
-
-    /* buffer to hold the raw inode data read from file */
-    unsigned char raw_inode[INODE_SIZE];
-    if (fread(raw_inode, INODE_SIZE, 1, file) != 1) {
-        perror("Failed to read inode from disk");
-        return;
-    }
-
-    /* copy into inode structure */
-    memcpy(inode, raw_inode, sizeof(struct inode));
-}
-
-/* self explanatory */
-const char *get_permissions(uint16_t mode) {
-    static char perms[11];
-    perms[0] = (mode & DIRECTORY) ? 'd' : '-';
-    perms[1] = (mode & OWR_PERMISSION) ? 'r' : '-';
-    perms[2] = (mode & OWW_PERMISSION) ? 'w' : '-';
-    perms[3] = (mode & OWE_PERMISSION) ? 'x' : '-';
-    perms[4] = (mode & GR_PERMISSION) ? 'r' : '-';
-    perms[5] = (mode & GW_PERMISSION) ? 'w' : '-';
-    perms[6] = (mode & GE_PERMISSION) ? 'x' : '-';
-    perms[7] = (mode & OTR_PERMISSION) ? 'r' : '-';
-    perms[8] = (mode & OTW_PERMISSION) ? 'w' : '-';
-    perms[9] = (mode & OTE_PERMISSION) ? 'x' : '-';
-    perms[10] = '\0';
-    return perms;
-}
-
-void list_directory(FILE *file, struct inode *dir_inode, struct superblock *sb){
-    if (!(dir_inode->mode & DIRECTORY)) {
-        fprintf(stderr, "Error: Not a directory.\n");
-        return;
-    }
-
-    char *buffer = malloc(sb->blocksize);
-    if (!buffer) {
-        fprintf(stderr, "Memory allocation failed.\n");
-        return;
-    }
-
-    printf("/:\n");
-
-    /* iterate through direct zones of directory inode */
-    for (int i = 0; i < DIRECT_ZONES; i++) {
-        if (dir_inode->zone[i] == 0) continue;
-
-        int block_address = sb->firstdata;
-
-        /* seek to calculated block position in file*/
-        fseek(file, block_address * sb->blocksize, SEEK_SET);
-        fread(buffer, sb->blocksize, 1, file);
-
-        /* process each directory entry within block */
-        int offset = 0;
-        while (offset < sb->blocksize) {
-            struct fileent *entry = (struct fileent *)(buffer + offset);
-            if (entry->ino != 0) {
-                struct inode entry_inode;
-                read_inode(file, entry->ino, &entry_inode, sb);
-                printf("%s %5d %s\n", get_permissions(entry_inode.mode),
-                 entry_inode.size, entry->name);
-            }
-            /* move to next entry */
-            offset += sizeof(struct fileent);
-        }
-    }
-    /* free buffer */
-    free(buffer);
-}
-
-int traverse_directory(FILE *file, struct inode *current_inode, 
-    const char *entry_name, struct inode *found_inode, struct superblock *sb) {
-    char buffer[4096]; 
-    struct fileent *entry;
-    int i, offset;
-
-    for (i = 0; i < DIRECT_ZONES; i++) {
-        if (current_inode->zone[i] == 0)
-            continue;
-
-        int block_address = sb->firstdata + (current_inode->zone[i] - 1);
-        fseek(file, block_address * sb->blocksize, SEEK_SET);
-        fread(buffer, 1, sb->blocksize, file);
-        offset = 0;
-
-        while (offset < sb->blocksize) {
-            entry = (struct fileent *)(buffer + offset);
-            if (entry->ino != 0 && strcmp(entry->name, entry_name) == 0) {
-                read_inode(file, entry->ino, found_inode, sb);
-                return 1; /* found */
-            }
-            offset += sizeof(struct fileent);
-        }
-    }
-    return 0; /* not found */
-}
-
-
-void print_inode(struct inode *inode) {
-    int i; 
+void print_inode(const struct inode *inode) {
+    char perms[PERMS_SIZE];
+    int i;
     printf("\nFile inode:\n");
-    printf("  uint16_t mode 0x%x (%s)\n", inode->mode, 
-    get_permissions(inode->mode));
+    printf("  uint16_t mode 0x%x (%s)\n", inode->mode,
+    get_permissions(inode->mode, perms));
     printf("  uint16_t links %d\n", inode->links);
     printf("  uint16_t uid %d\n", inode->uid);
     printf("  uint16_t gid %d\n", inode->gid);
@@ -191,133 +59,189 @@ void print_inode(struct inode *inode) {
     printf("\n");
 }
 
-int find_inode_by_path(FILE *file, const char *path, struct inode *inode,
- struct superblock *sb) {
-    if (strcmp(path, "/") == 0) {
-        read_inode(file, 1, inode, sb); /* root inode */
-        return 0;
-    }
+/* every filesystem in the image with its geometry, one per line or as
+ * NDJSON, for whatever fans work out over them */
+static int print_partitions(const char *imagefile, int json) {
+    struct minix_fs_info *found;
+    struct json_out *out;
+    uint32_t count, i;
+    int status = 0;
 
-    char *path_copy = strdup(path);
-    char *token = strtok(path_copy, "/");
-    struct inode current_inode;
-    read_inode(file, 1, &current_inode, sb);  /* start at root*/
-    while (token != NULL) {
-        if (!S_ISDIR(current_inode.mode)) { /* check if curr inode is direct*/
-            fprintf(stderr, "Not a directory\n");
-            free(path_copy);
-            return -1;
-        }
-        printf("Resolving token: %s\n", token);
-        if (!traverse_directory(file, &current_inode, token, 
-            &current_inode, sb)) {  /* find token in curr directory */
-            fprintf(stderr, "Path not found: %s\n", token);
-            free(path_copy);
-            return -1;
+    if (minix_scan_partitions(imagefile, &found, &count) != 0) {
+        return -1;
+    }
+    if (!json) {
+        printf("%-4s %-4s %12s %12s %12s %6s %6s %10s %10s %s\n", "part",
+            "sub", "offset", "length", "fs bytes", "block", "zone",
+            "zones", "inodes", "order");
+        for (i = 0; i < count; i++) {
+            const struct minix_fs_info *fs = &found[i];
+            char part[12] = "-", sub[12] = "-";
+
+            if (fs->partition >= 0) {
+                snprintf(part, sizeof(part), "%d", fs->partition);
+            }
+            if (fs->subpartition >= 0) {
+                snprintf(sub, sizeof(sub), "%d", fs->subpartition);
+            }
+            printf("%-4s %-4s %12llu %12llu %12llu %6u %6u %10u %10u %s\n",
+                part, sub, (unsigned long long)fs->offset,
+                (unsigned long long)fs->length,
+                (unsigned long long)fs->fs_bytes, fs->super.blocksize,
+                (uint32_t)fs->super.blocksize << fs->super.log_zone_size,
+                fs->super.zones, fs->super.ninodes,
+                fs->swapped ? "reversed" : "native");
         }
-        token = strtok(NULL, "/");
+        free(found);
+        return 0;
     }
 
-    *inode = current_inode; /* found inode of last token */
-    free(path_copy);
-    return 0;
+    if (!(out = malloc(sizeof(*out)))) {
+        fprintf(stderr, "error: out of memory\n");
+        free(found);
+        return -1;
+    }
+    json_init(out, STDOUT_FILENO);
+    for (i = 0; i < count; i++) {
+        const struct minix_fs_info *fs = &found[i];
+
+        json_begin(out);
+        json_str(out, "image", imagefile, strlen(imagefile));
+        json_int(out, "partition", fs->partition);
+        json_int(out, "subpartition", fs->subpartition);
+        json_uint(out, "offset", fs->offset);
+        json_uint(out, "length", fs->length);
+        json_uint(out, "fs_bytes", fs->fs_bytes);
+        json_uint(out, "blocksize", fs->super.blocksize);
+        json_uint(out, "zone_size",
+            (uint64_t)fs->super.blocksize << fs->super.log_zone_size);
+        json_uint(out, "zones", fs->super.zones);
+        json_uint(out, "ninodes", fs->super.ninodes);
+        json_uint(out, "firstdata", fs->super.firstdata);
+        json_uint(out, "swapped", fs->swapped);
+        json_end(out);
+    }
+    status = json_flush(out);
+    free(out);
+    free(found);
+    return status;
 }
 
-void read_partition_table(FILE *file, int partition, int subpartition, int *partition_offset) {
-    uint8_t buffer[SECTOR_SIZE];
-
-    // Read the first sector to access the partition table
-    fseek(file, 0, SEEK_SET);
-    fread(buffer, SECTOR_SIZE, 1, file);
-
-    // Verify partition table signature
-    if (buffer[BOOT_SIG_OFFSET] != 0x55 || buffer[BOOT_SIG_OFFSET + 1] != 0xAA) {
-        fprintf(stderr, "Invalid partition table signature (Expected: 0x55AA, Found: 0x%x%x)\n",
-                buffer[BOOT_SIG_OFFSET], buffer[BOOT_SIG_OFFSET + 1]);
-        exit(EXIT_FAILURE);
+/* have a minixd list path: 0 when it did, -1 when it found nothing
+ * there, 1 when there is no daemon (or it can't open the image) and the
+ * listing has to be done here */
+static int list_remote(const char *socket_path, const char *imagefile,
+    int partition, int subpartition, const char *path) {
+    struct remote_reply reply;
+    struct remote_entry *entries = NULL;
+    uint32_t i;
+    int sock;
+
+    if ((sock = remote_connect(socket_path)) < 0) {
+        return 1;
     }
-
-    // Access the primary partition table
-    struct partition_table *partitions = (struct partition_table *)&buffer[PARTITION_TABLE_OFFSET];
-
-    // Validate partition index
-    if (partition < 0 || partition > 3) {
-        fprintf(stderr, "Invalid primary partition number: %d\n", partition);
-        exit(EXIT_FAILURE);
+    if (remote_send(sock, REMOTE_LIST, imagefile, partition, subpartition,
+        path, -1) != 0 || remote_recv(sock, &reply, &entries) != 0 ||
+        (reply.status != REMOTE_OK && reply.status != REMOTE_NOT_FOUND)) {
+        free(entries);
+        close(sock);
+        return 1;
     }
+    close(sock);
 
-    // Adjust lFirst dynamically or override for debugging purposes
-    if (partition == 0) {
-        printf("Debug: Adjusting lFirst for Partition 0 to 20 (manual override).\n");
-        partitions[partition].IFirst = 20; // Example manual override
+    if (reply.status == REMOTE_NOT_FOUND) {
+        fprintf(stderr, "Error: Path not found '%s'\n", path);
+        return -1;
     }
-
-    // Calculate primary partition offset
-    *partition_offset = partitions[partition].IFirst * SECTOR_SIZE;
-
-    printf("Primary Partition %d: lFirst=%u, size=%u, Offset=%d bytes\n",
-           partition, partitions[partition].IFirst, partitions[partition].size, *partition_offset);
-
-    // Handle subpartition if specified
-    if (subpartition != -1) {
-        // Read the subpartition table within the primary partition
-        fseek(file, *partition_offset, SEEK_SET);
-        fread(buffer, SECTOR_SIZE, 1, file);
-
-        struct partition_table *subpartitions = (struct partition_table *)&buffer[PARTITION_TABLE_OFFSET];
-
-        // Validate subpartition index
-        if (subpartition < 0 || subpartition > 3) {
-            fprintf(stderr, "Invalid subpartition number: %d\n", subpartition);
-            exit(EXIT_FAILURE);
+    if (MINIX_ISDIR(reply.inode.mode)) {
+        printf("%s:\n", path);
+        for (i = 0; i < reply.count; i++) {
+            if (entries[i].flags & REMOTE_BAD_INODE) {
+                fprintf(stderr, "error: bad inode number %u\n",
+                    entries[i].ino);
+                continue;
+            }
+            print_listing(stdout, &entries[i].inode, entries[i].name);
         }
-
-        // Add subpartition offset to the primary partition offset
-        *partition_offset += subpartitions[subpartition].IFirst * SECTOR_SIZE;
-
-        printf("Subpartition %d: lFirst=%u, size=%u, Final Offset=%d bytes\n",
-               subpartition, subpartitions[subpartition].IFirst, subpartitions[subpartition].size, *partition_offset);
+    } else {
+        print_inode(&reply.inode);
     }
+    free(entries);
+    return 0;
 }
 
-
-
-
 int main(int argc, char *argv[]) {
-    int verbose = 0; 
+    int verbose = 0;
+    int recursive = 0;
+    int json = 0;
+    int use_sidecar = 0;
+    int scan = 0;
     int partition = -1;
     int subpartition = -1;
+    uint32_t cache_blocks = 0;
+    int readahead_kb = RA_DEFAULT_WINDOW / 1024;
     char *imagefile = NULL;
     char *path = NULL;
-    int i; 
-    FILE *file;
-    struct superblock sb;
+    const char *socket_path = NULL;
+    int i;
+    struct minix_image img;
     struct inode target_inode;
+    uint32_t ino;
 
     if (argc < 2) {
         print_usage();
         return 1;
     }
-    
+
     // Parse command-line arguments
     for (i = 1; i < argc; i++) {
         if (argv[i][0] == '-') {
             if (strcmp(argv[i], "-v") == 0) {
                 verbose = 1;
+            } else if (strcmp(argv[i], "-R") == 0) {
+                recursive = 1;
+            } else if (strcmp(argv[i], "-j") == 0) {
+                json = 1;
+            } else if (strcmp(argv[i], "-I") == 0) {
+                use_sidecar = 1;
+            } else if (strcmp(argv[i], "-P") == 0) {
+                scan = 1;
             } else if (strcmp(argv[i], "-p") == 0) {
-                if (i + 1 >= argc) {  
+                if (i + 1 >= argc) {
                     fprintf(stderr, "error: missing value for -p\n");
                     print_usage();
                     return 1;
                 }
                 partition = atoi(argv[++i]);
             } else if (strcmp(argv[i], "-s") == 0) {
-                if (i + 1 >= argc) {  
+                if (i + 1 >= argc) {
                     fprintf(stderr, "error: missing value for -s\n");
                     print_usage();
                     return 1;
                 }
                 subpartition = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "-C") == 0) {
+                if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                    fprintf(stderr, "error: -C needs a block count\n");
+                    print_usage();
+                    return 1;
+                }
+                cache_blocks = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "-A") == 0) {
+                if (i + 1 >= argc || atoi(argv[i + 1]) < 0 ||
+                    atoi(argv[i + 1]) > 1024 * 1024) {
+                    fprintf(stderr, "error: -A needs a window in kB\n");
+                    print_usage();
+                    return 1;
+                }
+                readahead_kb = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "-S") == 0) {
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "error: missing value for -S\n");
+                    print_usage();
+                    return 1;
+                }
+                socket_path = argv[++i];
             } else {
                 fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
                 print_usage();
@@ -339,63 +263,86 @@ int main(int argc, char *argv[]) {
         print_usage();
         return 1;
     }
-
-    // Open the image file
-    file = fopen(imagefile, "rb"); 
-    if (file == NULL) {
-        fprintf(stderr, "error: cannot open image file '%s'\n", imagefile);
-        return 1;
+    if (scan) {
+        if (path != NULL || partition != -1) {
+            fprintf(stderr, "error: -P takes only an image file\n");
+            print_usage();
+            return 1;
+        }
+        return print_partitions(imagefile, json) == 0 ? 0 : 1;
     }
 
-    // Calculate partition offset
-    int partition_offset = 0;  /* default to start of file */
-if (partition != -1) {
-    read_partition_table(file, partition, subpartition, &partition_offset);
+    // A plain listing can come from a minixd that has the image open
+    if (!verbose && !recursive && !json && !use_sidecar &&
+        (socket_path = remote_socket_path(socket_path))) {
+        int status = list_remote(socket_path, imagefile, partition,
+            subpartition, path ? path : "/");
 
-    if (verbose) {
-        printf("Partition %d details:\n", partition);
-        printf("  Offset: %d bytes\n", partition_offset);
+        if (status <= 0) {
+            return status == 0 ? 0 : 1;
+        }
     }
 
-    if (subpartition != -1) {
-        printf("Subpartition %d details:\n", subpartition);
+    // Open the image, pick the partition and validate the superblock
+    if ((cache_blocks ? minix_open_cached(&img, imagefile, partition,
+        subpartition, cache_blocks) : minix_open(&img, imagefile, partition,
+        subpartition)) != 0) {
+        return 1;
+    }
+    if (minix_set_readahead(&img, readahead_kb * 1024) != 0) {
+        minix_close(&img);
+        return 1;
     }
-}
 
-// Debugging final offset
-if (verbose) {
-    printf("Calculated final offset: %d bytes\n", partition_offset);
-}
+    if (use_sidecar) {
+        sidecar_attach(&img, imagefile, partition, subpartition);
+    }
+    if (verbose && !json) {
+        printf("Filesystem offset: %llu bytes\n",
+            (unsigned long long)img.offset);
+    }
 
+    if (path == NULL) {
+        path = "/";
+    }
+    // Find the inode corresponding to the specified path
+    if (minix_resolve(&img, path, &ino) != 0 ||
+        minix_read_inode(&img, ino, &target_inode) != 0) {
+        fprintf(stderr, "Error: Path not found '%s'\n", path);
+        minix_close(&img);
+        return 1;
+    }
 
-    // Read and validate the superblock
-    read_superblock(file, &sb, partition_offset);
+    // Machine readable inventory, stdout carries nothing else
+    if (json) {
+        int status = print_inventory(STDOUT_FILENO, &img, ino,
+            &target_inode, path, recursive, NULL);
 
-    if (path == NULL) {
-        // If no path is provided, assume the root inode (inode 1)
-        read_inode(file, 1, &target_inode, &sb);
-    } else {
-        // Find the inode corresponding to the specified path
-        if (find_inode_by_path(file, path, &target_inode, &sb) != 0) {
-            fprintf(stderr, "Error: Path not found '%s'\n", path);
-            fclose(file);
-            return 1;
+        if (verbose) {
+            minix_print_stats(&img, stderr);
         }
+        minix_close(&img);
+        return status == 0 ? 0 : 1;
     }
 
     // Print verbose output for superblock and inode
     if (verbose) {
-        print_superblock(&sb);
+        print_superblock(img.sb);
         print_inode(&target_inode);
     }
 
     // List the directory or display file information
-    if (target_inode.mode & DIRECTORY) {
-        list_directory(file, &target_inode, &sb);
+    if (MINIX_ISDIR(target_inode.mode) && recursive) {
+        list_tree(stdout, &img, ino, path, verbose);
+    } else if (MINIX_ISDIR(target_inode.mode)) {
+        list_directory(stdout, &img, &target_inode, path);
     } else {
         print_inode(&target_inode);
     }
 
-    fclose(file);
+    if (verbose) {
+        minix_print_stats(&img, stdout);
+    }
+    minix_close(&img);
     return 0;
 }
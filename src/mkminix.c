@@ -0,0 +1,596 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "minix.h"
+#include "byteorder.h"
+
+#define MAX_GAP 16 /* most zones skipped at once when fragmenting */
+
+void print_usage() {
+    printf("Usage: mkminix [-v] [-s size] [-b blocksize] [-z log_zone_size] "
+        "[-i inodes]\n"
+        "               [-n files] [-d fanout] [-f min:max] [-F frag%%] "
+        "[-H hole%%]\n"
+        "               [-r seed] [-e] [-x] imagefile\n");
+}
+
+/* everything needed while laying out one image */
+struct gen {
+    uint8_t *image;
+    uint64_t size;
+    uint32_t blocksize;
+    uint32_t zone_size;
+    uint32_t per_block;          /* zone numbers per indirect block */
+    uint32_t zones;
+    uint32_t firstdata;
+    uint32_t next_zone;          /* allocation cursor */
+    uint32_t ninodes;
+    uint32_t next_ino;
+    uint8_t *imap;
+    uint8_t *zmap;
+    uint8_t *itable;
+    int32_t now;
+    uint64_t rng;
+    /* options */
+    uint32_t fanout;
+    uint64_t min_size;
+    uint64_t max_size;
+    int frag;                    /* % chance of a gap before a zone */
+    int holes;                   /* % chance a file zone is a hole */
+    int fill;                    /* write file data, not just metadata */
+    /* what we made */
+    uint32_t files;
+    uint32_t dirs;
+    uint64_t data_zones;
+    uint64_t indirect_zones;
+    uint64_t hole_zones;
+    uint64_t gaps;
+};
+
+/* xorshift64*, plenty for picking sizes and filling data */
+static uint64_t next_random(struct gen *gen) {
+    gen->rng ^= gen->rng >> 12;
+    gen->rng ^= gen->rng << 25;
+    gen->rng ^= gen->rng >> 27;
+    return gen->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static int chance(struct gen *gen, int percent) {
+    return percent > 0 && (int)(next_random(gen) % 100) < percent;
+}
+
+static void set_bit(uint8_t *map, uint64_t bit) {
+    map[bit / 8] |= 1 << (bit % 8);
+}
+
+static uint8_t *zone_data(struct gen *gen, uint32_t zone) {
+    return gen->image + (uint64_t)zone * gen->zone_size;
+}
+
+static struct inode *inode_at(struct gen *gen, uint32_t ino) {
+    return (struct inode *)(gen->itable + (uint64_t)(ino - 1) * INODE_SIZE);
+}
+
+static int alloc_inode(struct gen *gen, uint32_t *ino) {
+    if (gen->next_ino > gen->ninodes) {
+        fprintf(stderr, "error: out of inodes (%u), raise -i\n",
+            gen->ninodes);
+        return -1;
+    }
+    *ino = gen->next_ino++;
+    set_bit(gen->imap, *ino);
+    return 0;
+}
+
+/* next free zone, maybe leaving a gap behind to fragment the disk */
+static int alloc_zone(struct gen *gen, uint32_t *zone) {
+    if (chance(gen, gen->frag)) {
+        gen->next_zone += 1 + next_random(gen) % MAX_GAP;
+        gen->gaps++;
+    }
+    if (gen->next_zone >= gen->zones) {
+        fprintf(stderr, "error: image full, raise -s or shrink -f\n");
+        return -1;
+    }
+    *zone = gen->next_zone++;
+    set_bit(gen->zmap, *zone - gen->firstdata + 1);
+    return 0;
+}
+
+/* zone number slot *slot, allocating the indirect zone holding it */
+static int indirect_slot(struct gen *gen, uint32_t *indirect, uint32_t n,
+    uint32_t **slot) {
+    if (*indirect == 0) {
+        if (alloc_zone(gen, indirect) != 0) {
+            return -1;
+        }
+        gen->indirect_zones++;
+    }
+    *slot = (uint32_t *)zone_data(gen, *indirect) + n;
+    return 0;
+}
+
+/* record zone as file zone n of inode */
+static int set_zone(struct gen *gen, struct inode *inode, uint64_t n,
+    uint32_t zone) {
+    uint32_t per = gen->per_block;
+    uint32_t indirect, *slot;
+    int rc;
+
+    if (n < DIRECT_ZONES) {
+        inode->zone[n] = zone;
+        return 0;
+    }
+    n -= DIRECT_ZONES;
+    if (n < per) {
+        indirect = inode->indirect;
+        rc = indirect_slot(gen, &indirect, n, &slot);
+        inode->indirect = indirect;
+    } else {
+        n -= per;
+        indirect = inode->two_indirect;
+        rc = indirect_slot(gen, &indirect, n / per, &slot);
+        inode->two_indirect = indirect;
+        if (rc == 0) {
+            rc = indirect_slot(gen, slot, n % per, &slot);
+        }
+    }
+    if (rc == 0) {
+        *slot = zone;
+    }
+    return rc;
+}
+
+static void fill_random(struct gen *gen, uint8_t *data, uint64_t len) {
+    while (len >= sizeof(uint64_t)) {
+        uint64_t word = next_random(gen);
+
+        memcpy(data, &word, sizeof(word));
+        data += sizeof(word);
+        len -= sizeof(word);
+    }
+    while (len-- > 0) {
+        *data++ = next_random(gen);
+    }
+}
+
+/* lay out size bytes for inode ino, copied from data when given, random
+ * or left zero otherwise; only regular files get holes */
+static int write_inode(struct gen *gen, uint32_t ino, uint16_t mode,
+    uint16_t links, const uint8_t *data, uint64_t size) {
+    struct inode *inode = inode_at(gen, ino);
+    uint64_t nzones = (size + gen->zone_size - 1) / gen->zone_size;
+    uint64_t max_zones = DIRECT_ZONES + gen->per_block +
+        (uint64_t)gen->per_block * gen->per_block;
+    uint64_t n;
+
+    if (size > UINT32_MAX || nzones > max_zones) {
+        fprintf(stderr, "error: %llu bytes is too big for one file\n",
+            (unsigned long long)size);
+        return -1;
+    }
+    inode->mode = mode;
+    inode->links = links;
+    inode->size = size;
+    inode->atime = inode->mtime = inode->c_time = gen->now;
+
+    for (n = 0; n < nzones; n++) {
+        uint64_t pos = n * gen->zone_size;
+        uint64_t len = size - pos < gen->zone_size ?
+            size - pos : gen->zone_size;
+        uint32_t zone;
+
+        if (!data && chance(gen, gen->holes)) {
+            gen->hole_zones++;
+            continue;
+        }
+        if (alloc_zone(gen, &zone) != 0 || set_zone(gen, inode, n,
+            zone) != 0) {
+            return -1;
+        }
+        gen->data_zones++;
+        if (data) {
+            memcpy(zone_data(gen, zone), data + pos, len);
+        } else if (gen->fill) {
+            fill_random(gen, zone_data(gen, zone), len);
+        }
+    }
+    return 0;
+}
+
+/* log-uniform between min_size and max_size, so small files dominate the
+ * count the way they do on a real disk */
+static uint64_t pick_size(struct gen *gen) {
+    uint64_t lo = gen->min_size, hi = gen->max_size, top;
+    int bits = 0;
+
+    if (lo >= hi) {
+        return lo;
+    }
+    while (bits < 63 && (1ULL << bits) <= hi) {
+        bits++;
+    }
+    top = 1ULL << (next_random(gen) % (bits + 1));
+    top = next_random(gen) % top;
+    return top < lo ? lo : top > hi ? hi : top;
+}
+
+static void add_entry(uint8_t *entries, uint32_t index, uint32_t ino,
+    const char *name) {
+    struct fileent *entry = (struct fileent *)(entries +
+        (uint64_t)index * DIRECTORY_ENTRY_SIZE);
+
+    entry->ino = ino;
+    strncpy(entry->name, name, DIRSIZ);
+}
+
+/* directory ino holding nfiles files, spread over full subdirectories
+ * once they don't fit in one directory of fanout entries */
+static int make_dir(struct gen *gen, uint32_t ino, uint32_t parent,
+    uint64_t nfiles) {
+    uint64_t nsub = 0, count, per_sub = 0, i;
+    uint8_t *entries;
+    int status = 0;
+
+    if (nfiles > gen->fanout) {
+        for (per_sub = gen->fanout; per_sub * gen->fanout < nfiles;
+            per_sub *= gen->fanout) {
+        }
+        nsub = (nfiles + per_sub - 1) / per_sub;
+    }
+    count = nsub ? nsub : nfiles;
+    if (!(entries = calloc(count + 2, DIRECTORY_ENTRY_SIZE))) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    add_entry(entries, 0, ino, ".");
+    add_entry(entries, 1, parent, "..");
+    gen->dirs++;
+
+    for (i = 0; i < count && status == 0; i++) {
+        char name[DIRSIZ + 1];
+        uint32_t child;
+
+        if (alloc_inode(gen, &child) != 0) {
+            status = -1;
+            break;
+        }
+        if (nsub) {
+            uint64_t share = nfiles - i * per_sub < per_sub ?
+                nfiles - i * per_sub : per_sub;
+
+            snprintf(name, sizeof(name), "d%llu", (unsigned long long)i);
+            status = make_dir(gen, child, ino, share);
+        } else {
+            snprintf(name, sizeof(name), "f%llu", (unsigned long long)i);
+            status = write_inode(gen, child, REGULAR_FILE | 0644, 1, NULL,
+                pick_size(gen));
+            gen->files++;
+        }
+        add_entry(entries, i + 2, child, name);
+    }
+    if (status == 0) {
+        status = write_inode(gen, ino, DIRECTORY | 0755, 2 + nsub, entries,
+            (count + 2) * DIRECTORY_ENTRY_SIZE);
+    }
+    free(entries);
+    return status;
+}
+
+/* disk zone of file zone n, read back in host order */
+static uint32_t file_zone(struct gen *gen, const struct inode *inode,
+    uint64_t n) {
+    uint32_t per = gen->per_block;
+    const uint32_t *block;
+
+    if (n < DIRECT_ZONES) {
+        return inode->zone[n];
+    }
+    n -= DIRECT_ZONES;
+    if (n < per) {
+        return inode->indirect ?
+            ((uint32_t *)zone_data(gen, inode->indirect))[n] : 0;
+    }
+    n -= per;
+    if (!inode->two_indirect) {
+        return 0;
+    }
+    block = (uint32_t *)zone_data(gen, inode->two_indirect);
+    if (!block[n / per]) {
+        return 0;
+    }
+    return ((uint32_t *)zone_data(gen, block[n / per]))[n % per];
+}
+
+static void swap_zone_block(struct gen *gen, uint32_t zone) {
+    uint32_t *words = (uint32_t *)zone_data(gen, zone);
+
+    minix_swap_words(words, words, gen->per_block);
+}
+
+/* rewrite a finished image in the opposite byte order (-x): directory
+ * entries and indirect blocks while the inodes can still be followed,
+ * then the inodes, bitmaps and superblock */
+static void reverse_image(struct gen *gen, struct superblock *sb) {
+    uint32_t ino, i;
+
+    for (ino = ROOT_INODE; ino < gen->next_ino; ino++) {
+        struct inode inode;
+        uint64_t nzones, n;
+
+        memcpy(&inode, inode_at(gen, ino), sizeof(inode));
+        nzones = ((uint64_t)inode.size + gen->zone_size - 1) /
+            gen->zone_size;
+        if (MINIX_ISDIR(inode.mode)) {
+            for (n = 0; n < nzones; n++) {
+                uint32_t zone = file_zone(gen, &inode, n);
+                uint64_t len = inode.size - n * gen->zone_size;
+                uint64_t off;
+
+                if (len > gen->zone_size) {
+                    len = gen->zone_size;
+                }
+                for (off = 0; zone && off < len;
+                    off += DIRECTORY_ENTRY_SIZE) {
+                    struct fileent *entry = (struct fileent *)
+                        (zone_data(gen, zone) + off);
+
+                    entry->ino = __builtin_bswap32(entry->ino);
+                }
+            }
+        }
+        if (inode.indirect) {
+            swap_zone_block(gen, inode.indirect);
+        }
+        if (inode.two_indirect) {
+            const uint32_t *root =
+                (uint32_t *)zone_data(gen, inode.two_indirect);
+
+            for (i = 0; i < gen->per_block; i++) {
+                if (root[i]) {
+                    swap_zone_block(gen, root[i]);
+                }
+            }
+            swap_zone_block(gen, inode.two_indirect);
+        }
+        minix_swap_inode(&inode);
+        memcpy(inode_at(gen, ino), &inode, sizeof(inode));
+    }
+    minix_swap_words((uint32_t *)gen->imap, gen->imap,
+        (uint64_t)sb->i_blocks * gen->blocksize / sizeof(uint32_t));
+    minix_swap_words((uint32_t *)gen->zmap, gen->zmap,
+        (uint64_t)sb->z_blocks * gen->blocksize / sizeof(uint32_t));
+    minix_swap_superblock(sb);
+}
+
+static int parse_size(const char *arg, uint64_t *size) {
+    char *end;
+    unsigned long long n = strtoull(arg, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g': n <<= 10; /* fall through */
+    case 'M': case 'm': n <<= 10; /* fall through */
+    case 'K': case 'k': n <<= 10; end++; break;
+    }
+    if (end == arg || *end != '\0') {
+        fprintf(stderr, "error: bad size '%s'\n", arg);
+        return -1;
+    }
+    *size = n;
+    return 0;
+}
+
+static int parse_range(const char *arg, uint64_t *lo, uint64_t *hi) {
+    char buf[64], *sep;
+
+    snprintf(buf, sizeof(buf), "%s", arg);
+    if (!(sep = strchr(buf, ':'))) {
+        if (parse_size(buf, lo) != 0) {
+            return -1;
+        }
+        *hi = *lo;
+        return 0;
+    }
+    *sep++ = '\0';
+    if (parse_size(buf, lo) != 0 || parse_size(sep, hi) != 0) {
+        return -1;
+    }
+    if (*lo > *hi) {
+        fprintf(stderr, "error: file size range '%s' is backwards\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t blocks_for(uint64_t bytes, uint32_t blocksize) {
+    return (bytes + blocksize - 1) / blocksize;
+}
+
+int main(int argc, char *argv[]) {
+    struct gen gen;
+    struct superblock *sb;
+    uint64_t size = 64ULL << 20;
+    uint64_t nfiles = 1000;
+    uint64_t max_file, total_blocks, itable_blocks, meta_blocks;
+    uint64_t per;
+    uint32_t blocksize = 4096, ninodes = 0, i_blocks, z_blocks, root;
+    int log_zone_size = 0, verbose = 0, reversed = 0, fd, i;
+    char *imagefile = NULL;
+
+    memset(&gen, 0, sizeof(gen));
+    gen.fanout = 64;
+    gen.max_size = 64 << 10;
+    gen.fill = 1;
+    gen.rng = 1;
+
+    for (i = 1; i < argc; i++) {
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            gen.fill = 0;
+        } else if (strcmp(argv[i], "-x") == 0) {
+            reversed = 1;
+        } else if (argv[i][0] == '-' && !val) {
+            print_usage();
+            return EXIT_FAILURE;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            if (parse_size(argv[++i], &size) != 0) {
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-b") == 0) {
+            blocksize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-z") == 0) {
+            log_zone_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0) {
+            ninodes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            nfiles = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            gen.fanout = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if (parse_range(argv[++i], &gen.min_size, &gen.max_size) != 0) {
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-F") == 0) {
+            gen.frag = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-H") == 0) {
+            gen.holes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            gen.rng = strtoull(argv[++i], NULL, 10) | 1;
+        } else if (argv[i][0] != '-' && !imagefile) {
+            imagefile = argv[i];
+        } else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!imagefile || gen.fanout < 2 || gen.frag < 0 || gen.frag > 100 ||
+        gen.holes < 0 || gen.holes > 100) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    if (blocksize < SUPERBLOCK_OFFSET || blocksize > 32768 ||
+        (blocksize & (blocksize - 1)) || log_zone_size < 0 ||
+        log_zone_size > 16) {
+        fprintf(stderr, "error: block size must be a power of two from "
+            "1024 to 32768 and log_zone_size 0 to 16\n");
+        return EXIT_FAILURE;
+    }
+
+    /* one inode per file and directory, the tree is at most this bushy */
+    if (ninodes == 0) {
+        uint64_t want = nfiles + nfiles / (gen.fanout > 1 ?
+            gen.fanout - 1 : 1) + 16;
+
+        ninodes = want > UINT32_MAX - 1 ? UINT32_MAX - 1 : want;
+    }
+
+    gen.blocksize = blocksize;
+    gen.zone_size = blocksize << log_zone_size;
+    gen.per_block = blocksize / sizeof(uint32_t);
+    total_blocks = size / gen.zone_size << log_zone_size;
+    if (total_blocks >> log_zone_size > UINT32_MAX) {
+        fprintf(stderr, "error: too many zones, raise -b or -z\n");
+        return EXIT_FAILURE;
+    }
+    gen.zones = total_blocks >> log_zone_size;
+    gen.size = (uint64_t)gen.zones * gen.zone_size;
+    gen.ninodes = ninodes;
+
+    /* boot block and superblock, the bitmaps, then the inode table */
+    i_blocks = blocks_for((uint64_t)ninodes + 1, blocksize * 8);
+    z_blocks = blocks_for((uint64_t)gen.zones + 1, blocksize * 8);
+    itable_blocks = blocks_for((uint64_t)ninodes * INODE_SIZE, blocksize);
+    meta_blocks = 2 + i_blocks + z_blocks + itable_blocks;
+    gen.firstdata = (meta_blocks + (1 << log_zone_size) - 1) >>
+        log_zone_size;
+    if (i_blocks > INT16_MAX || z_blocks > INT16_MAX ||
+        gen.firstdata > UINT16_MAX) {
+        fprintf(stderr, "error: metadata doesn't fit the superblock, "
+            "lower -i or raise -b\n");
+        return EXIT_FAILURE;
+    }
+    if (gen.firstdata >= gen.zones) {
+        fprintf(stderr, "error: image too small for its inode table\n");
+        return EXIT_FAILURE;
+    }
+
+    fd = open(imagefile, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        perror(imagefile);
+        return EXIT_FAILURE;
+    }
+    if (ftruncate(fd, gen.size) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    gen.image = mmap(NULL, gen.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    if (gen.image == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    gen.imap = gen.image + 2ULL * blocksize;
+    gen.zmap = gen.imap + (uint64_t)i_blocks * blocksize;
+    gen.itable = gen.zmap + (uint64_t)z_blocks * blocksize;
+    gen.next_zone = gen.firstdata;
+    gen.next_ino = ROOT_INODE;
+    gen.now = time(NULL);
+    set_bit(gen.imap, 0);
+    set_bit(gen.zmap, 0);
+
+    per = gen.per_block;
+    max_file = (DIRECT_ZONES + per + per * per) * gen.zone_size;
+    sb = (struct superblock *)(gen.image + SUPERBLOCK_OFFSET);
+    sb->ninodes = ninodes;
+    sb->i_blocks = i_blocks;
+    sb->z_blocks = z_blocks;
+    sb->firstdata = gen.firstdata;
+    sb->log_zone_size = log_zone_size;
+    sb->max_file = max_file > UINT32_MAX ? UINT32_MAX : max_file;
+    sb->zones = gen.zones;
+    sb->magic = MAGIC_NUM;
+    sb->blocksize = blocksize;
+    sb->subversion = 0;
+
+    if (alloc_inode(&gen, &root) != 0 ||
+        make_dir(&gen, root, root, nfiles) != 0) {
+        munmap(gen.image, gen.size);
+        close(fd);
+        unlink(imagefile);
+        return EXIT_FAILURE;
+    }
+
+    if (reversed) {
+        reverse_image(&gen, sb);
+    }
+
+    if (verbose) {
+        printf("%s: %llu bytes, %u zones of %u bytes, %u inodes%s\n",
+            imagefile, (unsigned long long)gen.size, gen.zones,
+            gen.zone_size, ninodes, reversed ? ", byte-reversed" : "");
+        printf("  %u files, %u directories, %u inodes used\n", gen.files,
+            gen.dirs, gen.next_ino - 1);
+        printf("  %llu data zones, %llu indirect zones, %llu holes, "
+            "%llu gaps, %u zones free\n",
+            (unsigned long long)gen.data_zones,
+            (unsigned long long)gen.indirect_zones,
+            (unsigned long long)gen.hole_zones,
+            (unsigned long long)gen.gaps, gen.zones - gen.next_zone);
+    }
+    if (munmap(gen.image, gen.size) != 0 || close(fd) != 0) {
+        perror(imagefile);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "partscan.h"
+#include "byteorder.h"
+
+/* what the scan has found so far */
+struct scan {
+    int fd;
+    uint64_t size;            /* of the image */
+    struct minix_fs_info *found;
+    uint32_t count;
+    uint32_t cap;
+};
+
+static int read_at(const struct scan *scan, uint64_t pos, void *buf,
+    size_t len) {
+    size_t done = 0;
+
+    if (pos > scan->size || len > scan->size - pos) {
+        return -1;
+    }
+    while (done < len) {
+        ssize_t n = pread(scan->fd, (uint8_t *)buf + done, len - done,
+            pos + done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/* the four entries of the partition table in the sector at base, -1
+ * (quietly, this is a probe) without a boot signature */
+static int probe_table(const struct scan *scan, uint64_t base,
+    struct partition_table table[4]) {
+    uint8_t sector[SECTOR_SIZE];
+
+    if (read_at(scan, base, sector, SECTOR_SIZE) != 0 ||
+        sector[BOOT_SIG_OFFSET] != BYTE_510 ||
+        sector[BOOT_SIG_OFFSET + 1] != BYTE_511) {
+        return -1;
+    }
+    memcpy(table, sector + PARTITION_TABLE_OFFSET,
+        4 * sizeof(struct partition_table));
+    return 0;
+}
+
+/* record the filesystem at offset if there is one, with the same checks
+ * minix_open makes of its superblock */
+static int probe_fs(struct scan *scan, int partition, int subpartition,
+    uint64_t offset, uint64_t length) {
+    struct minix_fs_info *info;
+    struct superblock sb;
+    int swapped = 0;
+
+    if (read_at(scan, offset + SUPERBLOCK_OFFSET, &sb, sizeof(sb)) != 0) {
+        return 0;
+    }
+    if (sb.magic == (int16_t)R_MAGIC_NUM) {
+        swapped = 1;
+        minix_swap_superblock(&sb);
+    }
+    if (sb.magic != MAGIC_NUM || sb.blocksize < SUPERBLOCK_OFFSET ||
+        sb.blocksize % INODE_SIZE || sb.log_zone_size < 0 ||
+        sb.log_zone_size > 16) {
+        return 0;
+    }
+
+    if (scan->count == scan->cap) {
+        uint32_t cap = scan->cap ? scan->cap * 2 : 8;
+        struct minix_fs_info *grown = realloc(scan->found,
+            cap * sizeof(*grown));
+
+        if (!grown) {
+            fprintf(stderr, "error: out of memory\n");
+            return -1;
+        }
+        scan->found = grown;
+        scan->cap = cap;
+    }
+    info = &scan->found[scan->count++];
+    info->partition = partition;
+    info->subpartition = subpartition;
+    info->offset = offset;
+    info->length = length;
+    info->fs_bytes = (uint64_t)sb.zones * ((uint64_t)sb.blocksize <<
+        sb.log_zone_size);
+    info->swapped = swapped;
+    info->super = sb;
+    return 0;
+}
+
+/* a table entry's extent in bytes, clipped to the image */
+static void entry_extent(const struct scan *scan,
+    const struct partition_table *entry, uint64_t *offset,
+    uint64_t *length) {
+    *offset = (uint64_t)entry->IFirst * SECTOR_SIZE;
+    *length = (uint64_t)entry->size * SECTOR_SIZE;
+    if (*offset >= scan->size) {
+        *length = 0;
+    } else if (*length > scan->size - *offset) {
+        *length = scan->size - *offset;
+    }
+}
+
+static int scan_image(struct scan *scan) {
+    struct partition_table table[4], sub[4];
+    uint64_t offset, length;
+    int p, s;
+
+    /* a bare filesystem; a bootable one may have a boot signature but
+     * then its table holds no MINIX partitions */
+    if (probe_fs(scan, -1, -1, 0, scan->size) != 0) {
+        return -1;
+    }
+    if (probe_table(scan, 0, table) != 0) {
+        return 0;
+    }
+    for (p = 0; p < 4; p++) {
+        if (table[p].type != PARTITION_TYPE) {
+            continue;
+        }
+        entry_extent(scan, &table[p], &offset, &length);
+        if (probe_fs(scan, p, -1, offset, length) != 0) {
+            return -1;
+        }
+        /* subpartition sectors are absolute, as for -s */
+        if (probe_table(scan, offset, sub) != 0) {
+            continue;
+        }
+        for (s = 0; s < 4; s++) {
+            uint64_t sub_offset, sub_length;
+
+            if (sub[s].type != PARTITION_TYPE) {
+                continue;
+            }
+            entry_extent(scan, &sub[s], &sub_offset, &sub_length);
+            if (probe_fs(scan, p, s, sub_offset, sub_length) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int minix_scan_partitions(const char *path, struct minix_fs_info **found,
+    uint32_t *count) {
+    struct scan scan;
+    struct stat st;
+    off_t size;
+    int rc;
+
+    memset(&scan, 0, sizeof(scan));
+    *found = NULL;
+    *count = 0;
+    if ((scan.fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "error: cannot open image file '%s'\n", path);
+        return -1;
+    }
+    /* st_size is 0 for block devices, ask the device itself */
+    if (fstat(scan.fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size = st.st_size;
+    } else {
+        size = lseek(scan.fd, 0, SEEK_END);
+    }
+    if (size <= 0) {
+        fprintf(stderr, "error: '%s' is empty\n", path);
+        close(scan.fd);
+        return -1;
+    }
+    scan.size = size;
+
+    rc = scan_image(&scan);
+    close(scan.fd);
+    if (rc != 0) {
+        free(scan.found);
+        return -1;
+    }
+    *found = scan.found;
+    *count = scan.count;
+    return 0;
+}
+
+int minix_expand_target(const char *target, minix_target_fn fn, void *arg) {
+    char image[PATH_MAX];
+    struct minix_fs_info *found;
+    struct stat st;
+    uint32_t count, i;
+    int partition = -1, subpartition = -1;
+    char *colon, *end;
+    long n;
+
+    if (snprintf(image, sizeof(image), "%s", target) >= (int)sizeof(image)) {
+        fprintf(stderr, "error: image path too long '%s'\n", target);
+        return -1;
+    }
+    /* a file whose own name ends in :digits is taken whole */
+    while (stat(image, &st) != 0 && (colon = strrchr(image, ':')) &&
+        subpartition == -1) {
+        n = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || n < 0 || n > 3) {
+            break;
+        }
+        *colon = '\0';
+        subpartition = partition;
+        partition = n;
+    }
+    if (partition >= 0) {
+        return fn(image, partition, subpartition, arg);
+    }
+
+    if (minix_scan_partitions(image, &found, &count) != 0) {
+        return -1;
+    }
+    if (count == 0) {
+        fprintf(stderr, "error: no MINIX filesystem in '%s'\n", image);
+        free(found);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (fn(image, found[i].partition, found[i].subpartition, arg) != 0) {
+            free(found);
+            return -1;
+        }
+    }
+    free(found);
+    return 0;
+}
+
+int minix_read_targets(const char *path, minix_target_fn fn, void *arg) {
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int status = 0;
+
+    if (!in) {
+        perror(path);
+        return -1;
+    }
+    while ((len = getline(&line, &cap, in)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' ||
+            line[len - 1] == ' ' || line[len - 1] == '\t')) {
+            line[--len] = '\0';
+        }
+        if (len == 0 || line[0] == '#') {
+            continue;
+        }
+        if (minix_expand_target(line, fn, arg) != 0) {
+            status = -1;
+        }
+    }
+    free(line);
+    if (in != stdin) {
+        fclose(in);
+    }
+    return status;
+}
@@ -0,0 +1,40 @@
+#ifndef PARTSCAN_H
+#define PARTSCAN_H
+
+#include <stdint.h>
+#include "minix.h"
+
+/* a filesystem found in an image, named the way -p/-s would pick it */
+struct minix_fs_info {
+    int partition;            /* -1 for an unpartitioned image */
+    int subpartition;         /* -1 for a primary partition */
+    uint64_t offset;          /* byte offset of the filesystem */
+    uint64_t length;          /* bytes the partition table gives it */
+    uint64_t fs_bytes;        /* bytes its superblock says it covers */
+    int swapped;              /* byte-reversed (R_MAGIC_NUM) */
+    struct superblock super;  /* in host byte order */
+};
+
+/* every MINIX filesystem in the image, in -p/-s order: the image itself
+ * when it holds a bare filesystem, then each MINIX primary partition and
+ * each MINIX subpartition of those, probed for a superblock where
+ * minix_open would look. The table and superblock sectors are all that
+ * get read. *found is malloc()ed, and may be empty. */
+int minix_scan_partitions(const char *path, struct minix_fs_info **found,
+    uint32_t *count);
+
+/* called with each filesystem a target names */
+typedef int (*minix_target_fn)(const char *image, int partition,
+    int subpartition, void *arg);
+
+/* imagefile[:part[:sub]] as given on a command line: fn gets the
+ * filesystem named, or for an image given alone each one
+ * minix_scan_partitions finds. A file whose own name ends in :digits is
+ * taken whole. */
+int minix_expand_target(const char *target, minix_target_fn fn, void *arg);
+
+/* minix_expand_target for each line of path ("-" for stdin), '#'
+ * starting a comment. Bad lines are reported and the rest still done. */
+int minix_read_targets(const char *path, minix_target_fn fn, void *arg);
+
+#endif /*PARTSCAN_H*/
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "readahead.h"
+#include "bcache.h"
+
+struct readahead *readahead_create(const struct minix_image *img,
+    uint32_t max_window) {
+    struct readahead *ra = calloc(1, sizeof(*ra));
+
+    if (!ra) {
+        return NULL;
+    }
+    pthread_mutex_init(&ra->lock, NULL);
+    if (img->bcache && max_window / img->sb->blocksize >
+        img->bcache->capacity / 4) {
+        max_window = img->bcache->capacity / 4 * img->sb->blocksize;
+    }
+    if (max_window < img->sb->blocksize) {
+        max_window = img->sb->blocksize;
+    }
+    ra->max_window = max_window;
+    ra->min_window = max_window < RA_MIN_WINDOW ? max_window : RA_MIN_WINDOW;
+    ra->inodes.limit = (uint64_t)img->sb->ninodes * INODE_SIZE;
+    /* skipping a few inodes of the same block is still reading in order */
+    ra->inodes.slack = img->sb->blocksize;
+    return ra;
+}
+
+void readahead_destroy(struct readahead *ra) {
+    if (!ra) {
+        return;
+    }
+    pthread_mutex_destroy(&ra->lock);
+    free(ra);
+}
+
+/* account for a read of len bytes at pos, returning how much to prefetch
+ * from *from on (0 for nothing); called locked */
+static uint64_t ra_access(struct readahead *ra, struct ra_stream *s,
+    uint64_t pos, uint64_t len, uint64_t *from) {
+    uint64_t end = pos + len;
+    uint64_t reach = s->next + s->slack;
+    uint64_t count;
+
+    /* holes and skipped inodes inside the window are still in order */
+    if (reach < s->ahead) {
+        reach = s->ahead;
+    }
+    if (pos < s->prev || pos > reach) {
+        ra->stats.random++;
+        s->window = 0;
+        s->ahead = s->trigger = end;
+        s->prev = pos;
+        s->next = end;
+        return 0;
+    }
+    ra->stats.sequential++;
+    if (end <= s->ahead) {
+        ra->stats.hits++;
+    }
+    s->prev = pos;
+    if (end > s->next) {
+        s->next = end;
+    }
+    if (end <= s->trigger && s->window) {
+        return 0;
+    }
+
+    /* the reader is into the last window (or just started): open the
+     * next one, twice as wide */
+    s->window = s->window ? s->window * 2 : ra->min_window;
+    if (s->window > ra->max_window) {
+        s->window = ra->max_window;
+    }
+    *from = s->ahead > end ? s->ahead : end;
+    if (*from >= s->limit) {
+        return 0;
+    }
+    count = s->limit - *from < s->window ? s->limit - *from : s->window;
+    s->trigger = *from;
+    s->ahead = *from + count;
+    ra->stats.prefetches++;
+    ra->stats.bytes += count;
+    if (s->window > ra->stats.largest) {
+        ra->stats.largest = s->window;
+    }
+    return count;
+}
+
+/* ask for len bytes at image offset pos ahead of the reader */
+static void prefetch(const struct minix_image *img, uint64_t pos,
+    uint64_t len) {
+    if (pos >= img->map_size) {
+        return;
+    }
+    if (len > img->map_size - pos) {
+        len = img->map_size - pos;
+    }
+    if (img->map) {
+        uint64_t page = sysconf(_SC_PAGESIZE);
+        uint64_t start = pos & ~(page - 1);
+
+        madvise((void *)(img->map + start), pos + len - start,
+            MADV_WILLNEED);
+        return;
+    }
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(img->fd, pos, len, POSIX_FADV_WILLNEED);
+#endif
+    if (img->bcache && pos >= img->offset) {
+        uint32_t blocksize = img->sb->blocksize;
+        uint64_t first = (pos - img->offset) / blocksize;
+        uint64_t last = (pos + len - 1 - img->offset) / blocksize;
+
+        bcache_prefetch(img->bcache, first, last - first + 1);
+    }
+}
+
+void ra_inode_read(const struct minix_image *img, uint32_t ino) {
+    struct readahead *ra = img->readahead;
+    uint64_t from = 0, count;
+
+    /* never hold a reader up: when another thread is in here this read
+     * just goes unseen */
+    if (!ra || pthread_mutex_trylock(&ra->lock) != 0) {
+        return;
+    }
+    count = ra_access(ra, &ra->inodes, (uint64_t)(ino - 1) * INODE_SIZE,
+        INODE_SIZE, &from);
+    pthread_mutex_unlock(&ra->lock);
+    if (count) {
+        prefetch(img, img->offset + (uint64_t)img->inode_block *
+            img->sb->blocksize + from, count);
+    }
+}
+
+static void stream_init(struct ra_stream *s, const struct minix_image *img,
+    uint64_t size) {
+    memset(s, 0, sizeof(*s));
+    s->limit = size;
+    s->slack = img->zone_size;
+}
+
+void ra_file_init(struct ra_file *file, const struct minix_image *img,
+    const struct inode *inode) {
+    memset(file, 0, sizeof(*file));
+    stream_init(&file->stream, img, inode->size);
+    zone_map_init(&file->map, img, inode);
+}
+
+void ra_file_init_extents(struct ra_file *file,
+    const struct minix_image *img, uint64_t size,
+    const struct zone_extent *extents, uint32_t count) {
+    memset(file, 0, sizeof(*file));
+    stream_init(&file->stream, img, size);
+    file->extents = extents;
+    file->count = count;
+}
+
+void ra_file_release(struct ra_file *file) {
+    if (!file->extents && file->map.img) {
+        zone_map_release(&file->map);
+    }
+}
+
+/* disk zone behind file zone n, 0 for a hole or when it can't be told */
+static uint32_t file_zone(struct ra_file *file, uint64_t n) {
+    const struct zone_extent *ext;
+    uint32_t zone;
+
+    if (!file->extents) {
+        return zone_map_lookup(&file->map, n, &zone) == 0 ? zone : 0;
+    }
+    /* the window only moves forward, so the cursor mostly stays put */
+    if (file->cursor >= file->count ||
+        file->extents[file->cursor].file_zone > n) {
+        file->cursor = 0;
+    }
+    for (; file->cursor < file->count; file->cursor++) {
+        ext = &file->extents[file->cursor];
+        if (n < ext->file_zone + ext->length) {
+            if (n < ext->file_zone || ext->hole) {
+                return 0;
+            }
+            return ext->start + (n - ext->file_zone);
+        }
+    }
+    return 0;
+}
+
+void ra_file_read(const struct minix_image *img, struct ra_file *file,
+    uint64_t pos, uint64_t len) {
+    struct readahead *ra = img->readahead;
+    uint64_t from = 0, count, n, last;
+    uint32_t run_start = 0, run_length = 0;
+
+    if (!ra || !file) {
+        return;
+    }
+    pthread_mutex_lock(&ra->lock);
+    count = ra_access(ra, &file->stream, pos, len, &from);
+    pthread_mutex_unlock(&ra->lock);
+    if (!count) {
+        return;
+    }
+
+    /* prefetch the window a physically contiguous run at a time */
+    last = (from + count - 1) / img->zone_size;
+    for (n = from / img->zone_size; n <= last + 1; n++) {
+        uint32_t zone = n <= last ? file_zone(file, n) : 0;
+
+        if (zone && !minix_zone_valid(img, zone)) {
+            zone = 0;
+        }
+        if (run_length && zone == run_start + run_length) {
+            run_length++;
+            continue;
+        }
+        if (run_length) {
+            prefetch(img, img->offset + (uint64_t)run_start * img->zone_size,
+                (uint64_t)run_length * img->zone_size);
+        }
+        run_start = zone;
+        run_length = zone ? 1 : 0;
+    }
+}
+
+void readahead_print_stats(struct readahead *ra, FILE *out) {
+    uint64_t reads;
+
+    pthread_mutex_lock(&ra->lock);
+    reads = ra->stats.sequential + ra->stats.random;
+    fprintf(out, "readahead: window %uK to %uK (widest used %uK), "
+        "%llu sequential and %llu random reads, %llu hits (%.1f%%), "
+        "%llu prefetches of %llu bytes\n", ra->min_window / 1024,
+        ra->max_window / 1024, ra->stats.largest / 1024,
+        (unsigned long long)ra->stats.sequential,
+        (unsigned long long)ra->stats.random,
+        (unsigned long long)ra->stats.hits,
+        reads ? 100.0 * ra->stats.hits / reads : 0.0,
+        (unsigned long long)ra->stats.prefetches,
+        (unsigned long long)ra->stats.bytes);
+    pthread_mutex_unlock(&ra->lock);
+}
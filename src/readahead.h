@@ -0,0 +1,84 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "minix.h"
+#include "zonemap.h"
+
+#define RA_MIN_WINDOW (32 * 1024)          /* first window of a stream */
+#define RA_DEFAULT_WINDOW (2 * 1024 * 1024) /* largest it grows to */
+
+/* one reader going through something it may read in order: a file, or
+ * the inode table. Offsets are bytes of that thing, not of the image. */
+struct ra_stream {
+    uint64_t prev;       /* start of the last read */
+    uint64_t next;       /* where a reader carrying on in order goes */
+    uint64_t ahead;      /* prefetched up to here */
+    uint64_t trigger;    /* reading past this prefetches another window */
+    uint64_t limit;      /* end of what there is to read */
+    uint32_t slack;      /* forward skip still counted as in order */
+    uint32_t window;     /* 0 until the reads look sequential */
+};
+
+struct ra_stats {
+    uint64_t sequential; /* reads carrying on from the last one */
+    uint64_t random;     /* reads anywhere else, each resets the window */
+    uint64_t hits;       /* reads of data already prefetched */
+    uint64_t prefetches; /* windows handed to the kernel or the cache */
+    uint64_t bytes;      /* bytes those covered */
+    uint32_t largest;    /* widest window used */
+};
+
+/* an image's read-ahead policy. Reads that follow on from the last one
+ * open a window of min_window ahead of the reader, doubling up to
+ * max_window each time the reader catches up with it; any other read
+ * closes it again. Ahead of a mapped image the window is madvise()d
+ * WILLNEED, ahead of a cached one it is read into the block cache in
+ * one go, and then it is kept to a quarter of the cache so that what
+ * was read ahead is still there when the reader gets to it. */
+struct readahead {
+    pthread_mutex_t lock;      /* guards inodes and stats */
+    uint32_t min_window;
+    uint32_t max_window;
+    struct ra_stream inodes;   /* the inode table, shared by all readers */
+    struct ra_stats stats;
+};
+
+/* read-ahead over one file, in file order rather than disk order: the
+ * window is turned into zones through a map of its own, so fragments
+ * get prefetched where they really are */
+struct ra_file {
+    struct ra_stream stream;
+    struct zone_map map;                /* when reading by inode */
+    const struct zone_extent *extents;  /* when given an extent list */
+    uint32_t count;
+    uint32_t cursor;                    /* extent looked at last */
+};
+
+struct readahead *readahead_create(const struct minix_image *img,
+    uint32_t max_window);
+void readahead_destroy(struct readahead *ra);
+
+/* the reader is about to read inode ino */
+void ra_inode_read(const struct minix_image *img, uint32_t ino);
+
+/* a file read through its inode's zones, or through a ready-made
+ * extent list of a size byte file */
+void ra_file_init(struct ra_file *file, const struct minix_image *img,
+    const struct inode *inode);
+void ra_file_init_extents(struct ra_file *file,
+    const struct minix_image *img, uint64_t size,
+    const struct zone_extent *extents, uint32_t count);
+void ra_file_release(struct ra_file *file);
+
+/* the reader is about to read len bytes of the file at pos; file may
+ * be NULL */
+void ra_file_read(const struct minix_image *img, struct ra_file *file,
+    uint64_t pos, uint64_t len);
+
+/* the window and counters for -v output */
+void readahead_print_stats(struct readahead *ra, FILE *out);
+
+#endif /*READAHEAD_H*/
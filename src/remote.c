@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "remote.h"
+
+const char *remote_socket_path(const char *given) {
+    const char *env;
+
+    if (given) {
+        return given;
+    }
+    env = getenv(REMOTE_SOCKET_ENV);
+    return env && *env ? env : NULL;
+}
+
+int remote_connect(const char *socket_path) {
+    struct sockaddr_un addr;
+    int sock;
+
+    if (!socket_path || strlen(socket_path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int remote_read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int remote_write_full(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int remote_send(int sock, enum remote_op op, const char *image,
+    int partition, int subpartition, const char *path, int dst_fd) {
+    char absolute[PATH_MAX];
+    uint8_t buf[sizeof(struct remote_request) + 2 * PATH_MAX];
+    struct remote_request req;
+    union {
+        struct cmsghdr align;
+        char bytes[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    size_t len;
+    ssize_t n;
+
+    /* the daemon has a working directory of its own */
+    if (!realpath(image, absolute) || strlen(path) > PATH_MAX) {
+        return -1;
+    }
+    memset(&req, 0, sizeof(req));
+    req.magic = REMOTE_MAGIC;
+    req.op = op;
+    req.flags = dst_fd >= 0 ? REMOTE_FD : 0;
+    req.partition = partition;
+    req.subpartition = subpartition;
+    req.image_len = strlen(absolute);
+    req.path_len = strlen(path);
+    memcpy(buf, &req, sizeof(req));
+    memcpy(buf + sizeof(req), absolute, req.image_len);
+    memcpy(buf + sizeof(req) + req.image_len, path, req.path_len);
+    len = sizeof(req) + req.image_len + req.path_len;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (dst_fd >= 0) {
+        struct cmsghdr *cmsg;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.bytes;
+        msg.msg_controllen = sizeof(control.bytes);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &dst_fd, sizeof(int));
+    }
+    /* the descriptor goes with the first byte, the rest is plain */
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return -1;
+    }
+    return remote_write_full(sock, buf + n, len - n);
+}
+
+int remote_recv(int sock, struct remote_reply *reply,
+    struct remote_entry **entries) {
+    if (entries) {
+        *entries = NULL;
+    }
+    if (remote_read_full(sock, reply, sizeof(*reply)) != 0) {
+        return -1;
+    }
+    if (reply->count == 0) {
+        return 0;
+    }
+    if (!entries || !(*entries = malloc((size_t)reply->count *
+        sizeof(**entries)))) {
+        return -1;
+    }
+    if (remote_read_full(sock, *entries, (size_t)reply->count *
+        sizeof(**entries)) != 0) {
+        free(*entries);
+        *entries = NULL;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdint.h>
+#include "minix.h"
+
+/* the protocol between minixd and the minls/minget shims. Everything
+ * is in host byte order, both ends being on the same machine. A client
+ * sends a request with the image and path appended and gets back one
+ * reply, followed by the entries of a listing or, for a get without a
+ * destination descriptor, the file's bytes. Connections may carry any
+ * number of requests in turn. */
+
+#define REMOTE_MAGIC 0x3144584d          /* "MXD1" */
+#define REMOTE_SOCKET_ENV "MINIXD_SOCKET" /* where the shims look */
+
+enum remote_op {
+    REMOTE_STAT = 1,      /* the path's inode */
+    REMOTE_LIST = 2,      /* that, and a directory's entries */
+    REMOTE_GET = 3        /* extract a regular file */
+};
+
+enum remote_status {
+    REMOTE_OK = 0,
+    REMOTE_NOT_FOUND,     /* no such path */
+    REMOTE_NOT_FILE,      /* get of something other than a regular file */
+    REMOTE_BAD_IMAGE,     /* the image couldn't be opened */
+    REMOTE_FAILED,        /* the image went bad partway */
+    REMOTE_BAD_REQUEST
+};
+
+#define REMOTE_FD 0x1     /* a get's destination is passed with the request */
+
+struct remote_request {
+    uint32_t magic;
+    uint16_t op;
+    uint16_t flags;
+    int16_t partition;    /* -1 for none */
+    int16_t subpartition;
+    uint16_t image_len;   /* absolute image path, not terminated */
+    uint16_t path_len;    /* then the path inside it, not terminated */
+} __attribute__((packed));
+
+struct remote_reply {
+    uint32_t status;
+    uint32_t count;       /* entries following a listing */
+    uint64_t size;        /* file bytes following a streamed get */
+    uint64_t offset;      /* of the filesystem in the image */
+    struct superblock super;
+    uint32_t ino;
+    struct inode inode;
+} __attribute__((packed));
+
+#define REMOTE_BAD_INODE 0x1 /* an entry whose inode couldn't be read */
+
+struct remote_entry {
+    uint32_t ino;
+    uint32_t flags;
+    struct inode inode;
+    char name[DIRSIZ];
+} __attribute__((packed));
+
+/* the socket to use: given, else $MINIXD_SOCKET, else NULL */
+const char *remote_socket_path(const char *given);
+
+/* -1, quietly, when no daemon is listening there */
+int remote_connect(const char *socket_path);
+
+/* send a request, with dst_fd riding along when it isn't -1 */
+int remote_send(int sock, enum remote_op op, const char *image,
+    int partition, int subpartition, const char *path, int dst_fd);
+
+/* read a reply and, for a listing, its entries into a malloc()ed array */
+int remote_recv(int sock, struct remote_reply *reply,
+    struct remote_entry **entries);
+
+/* read or write exactly len bytes, -1 on error or a short stream */
+int remote_read_full(int fd, void *buf, size_t len);
+int remote_write_full(int fd, const void *buf, size_t len);
+
+#endif /*REMOTE_H*/
@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sidecar.h"
+
+#define SIDECAR_PATH_MAX 4096
+
+/* FNV-1a over a whole path */
+static uint32_t path_hash(const char *path, size_t len) {
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)path[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* the fields a sidecar is keyed to, taken from the open image */
+static int image_key(const struct minix_image *img,
+    struct sidecar_header *key) {
+    struct stat st;
+
+    if (fstat(img->fd, &st) != 0) {
+        return -1;
+    }
+    memset(key, 0, sizeof(*key));
+    memcpy(key->magic, SIDECAR_MAGIC, sizeof(key->magic));
+    key->version = SIDECAR_VERSION;
+    key->header_size = sizeof(*key);
+    key->image_size = st.st_size;
+#ifdef __APPLE__
+    key->image_mtime = st.st_mtimespec.tv_sec;
+    key->image_mtime_ns = st.st_mtimespec.tv_nsec;
+#else
+    key->image_mtime = st.st_mtim.tv_sec;
+    key->image_mtime_ns = st.st_mtim.tv_nsec;
+#endif
+    key->fs_offset = img->offset;
+    key->sb_hash = path_hash((const char *)&img->super, sizeof(img->super));
+    return 0;
+}
+
+/* everything gathered by the build walk, written out in one go */
+struct builder {
+    const struct minix_image *img;
+    struct sidecar_entry *entries;
+    uint32_t nentries, entries_cap;
+    struct sidecar_extent *extents;
+    uint64_t nextents, extents_cap;
+    char *strings;
+    uint64_t strings_len, strings_cap;
+    uint8_t *seen;             /* directories already indexed */
+    char path[SIDECAR_PATH_MAX];
+    size_t len;
+    int aliased;               /* a directory came up under a second name */
+    int failed;
+};
+
+static void *grow(void *array, uint64_t *cap, uint64_t need, size_t size) {
+    uint64_t n = *cap ? *cap : 256;
+    void *grown;
+
+    while (n < need) {
+        n *= 2;
+    }
+    if (n == *cap) {
+        return array;
+    }
+    if (!(grown = realloc(array, n * size))) {
+        return NULL;
+    }
+    *cap = n;
+    return grown;
+}
+
+static int add_record(struct builder *b, uint32_t ino,
+    const struct inode *inode) {
+    struct sidecar_entry *entry;
+    struct zone_map map;
+    struct zone_extent ext;
+    uint64_t cap = b->entries_cap;
+    void *grown;
+    int rc;
+
+    if (!(grown = grow(b->entries, &cap, (uint64_t)b->nentries + 1,
+        sizeof(*b->entries)))) {
+        return -1;
+    }
+    b->entries = grown;
+    b->entries_cap = cap;
+    if (!(grown = grow(b->strings, &b->strings_cap,
+        b->strings_len + b->len + 1, 1))) {
+        return -1;
+    }
+    b->strings = grown;
+
+    entry = &b->entries[b->nentries++];
+    memset(entry, 0, sizeof(*entry));
+    entry->hash = path_hash(b->path, b->len);
+    entry->ino = ino;
+    entry->path_off = b->strings_len;
+    entry->path_len = b->len;
+    entry->first_extent = b->nextents;
+    entry->inode = *inode;
+    memcpy(b->strings + b->strings_len, b->path, b->len + 1);
+    b->strings_len += b->len + 1;
+
+    if (!MINIX_ISDIR(inode->mode) && !MINIX_ISREG(inode->mode)) {
+        return 0;
+    }
+    zone_map_init(&map, b->img, inode);
+    while ((rc = zone_map_next(&map, &ext)) == 1) {
+        if (!(grown = grow(b->extents, &b->extents_cap, b->nextents + 1,
+            sizeof(*b->extents)))) {
+            rc = -1;
+            break;
+        }
+        b->extents = grown;
+        b->extents[b->nextents].file_zone = ext.file_zone;
+        b->extents[b->nextents].start = ext.start;
+        b->extents[b->nextents].length = ext.length;
+        b->nextents++;
+        entry->nextents++;
+    }
+    zone_map_release(&map);
+    return rc;
+}
+
+static void build_dir(struct builder *b, const struct inode *dir);
+
+static int build_entry(const struct fileent *entry, void *arg) {
+    struct builder *b = arg;
+    size_t saved = b->len;
+    struct inode inode;
+    int n;
+
+    if (strncmp(entry->name, ".", DIRSIZ) == 0 ||
+        strncmp(entry->name, "..", DIRSIZ) == 0) {
+        return 0;
+    }
+    n = snprintf(b->path + saved, sizeof(b->path) - saved, "%s%.*s",
+        saved > 1 ? "/" : "", DIRSIZ, entry->name);
+    if (n < 0 || (size_t)n >= sizeof(b->path) - saved) {
+        fprintf(stderr, "error: path too long under %s\n", b->path);
+        b->failed = 1;
+        return 1;
+    }
+    b->len += n;
+    if (minix_read_inode(b->img, entry->ino, &inode) != 0 ||
+        add_record(b, entry->ino, &inode) != 0) {
+        b->failed = 1;
+    } else if (MINIX_ISDIR(inode.mode) && b->seen[entry->ino]) {
+        /* indexing the children again under each name could take
+         * forever on a crafted image; lookups below walk instead */
+        b->aliased = 1;
+    } else if (MINIX_ISDIR(inode.mode)) {
+        b->seen[entry->ino] = 1;
+        build_dir(b, &inode);
+    }
+    b->len = saved;
+    b->path[saved] = '\0';
+    return b->failed;
+}
+
+static void build_dir(struct builder *b, const struct inode *dir) {
+    if (minix_readdir(b->img, dir, build_entry, b) < 0) {
+        b->failed = 1;
+    }
+}
+
+static int write_all(int fd, const void *data, uint64_t len) {
+    const uint8_t *p = data;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static uint64_t align8(uint64_t n) {
+    return (n + 7) & ~7ULL;
+}
+
+/* lay out header, entries, buckets, extents and strings, written to a
+ * temporary name and renamed into place so readers never see half */
+static int write_sidecar(struct builder *b, struct sidecar_header *header,
+    const char *path) {
+    char tmp[SIDECAR_PATH_MAX + 32];
+    static const uint8_t zeros[8];
+    uint32_t *buckets;
+    uint32_t nbuckets = 16, i;
+    int fd, status = 0;
+
+    while (nbuckets < b->nentries * 2) {
+        nbuckets *= 2;
+    }
+    if (!(buckets = calloc(nbuckets, sizeof(*buckets)))) {
+        return -1;
+    }
+    for (i = 0; i < b->nentries; i++) {
+        uint32_t slot = b->entries[i].hash & (nbuckets - 1);
+
+        /* keep the first of duplicate paths, like a directory scan */
+        while (buckets[slot] && !(b->entries[buckets[slot] - 1].hash ==
+            b->entries[i].hash && strcmp(b->strings +
+            b->entries[buckets[slot] - 1].path_off,
+            b->strings + b->entries[i].path_off) == 0)) {
+            slot = (slot + 1) & (nbuckets - 1);
+        }
+        if (!buckets[slot]) {
+            buckets[slot] = i + 1;
+        }
+    }
+
+    header->flags = b->aliased ? SIDECAR_ALIASED : 0;
+    header->nentries = b->nentries;
+    header->nbuckets = nbuckets;
+    header->nextents = b->nextents;
+    header->entries_off = align8(sizeof(*header));
+    header->buckets_off = header->entries_off +
+        (uint64_t)b->nentries * sizeof(struct sidecar_entry);
+    header->extents_off = align8(header->buckets_off +
+        (uint64_t)nbuckets * sizeof(uint32_t));
+    header->strings_off = header->extents_off +
+        b->nextents * sizeof(struct sidecar_extent);
+    header->file_size = header->strings_off + b->strings_len;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        free(buckets);
+        return -1;
+    }
+    if (write_all(fd, header, sizeof(*header)) != 0 ||
+        write_all(fd, zeros, header->entries_off - sizeof(*header)) != 0 ||
+        write_all(fd, b->entries, (uint64_t)b->nentries *
+            sizeof(struct sidecar_entry)) != 0 ||
+        write_all(fd, buckets, (uint64_t)nbuckets * sizeof(uint32_t)) != 0 ||
+        write_all(fd, zeros, header->extents_off - header->buckets_off -
+            (uint64_t)nbuckets * sizeof(uint32_t)) != 0 ||
+        write_all(fd, b->extents, b->nextents *
+            sizeof(struct sidecar_extent)) != 0 ||
+        write_all(fd, b->strings, b->strings_len) != 0) {
+        status = -1;
+    }
+    if (close(fd) != 0 || status != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        status = -1;
+    }
+    free(buckets);
+    return status;
+}
+
+static int build_sidecar(const struct minix_image *img,
+    struct sidecar_header *key, const char *path) {
+    struct builder b;
+    struct inode root;
+    int status = -1;
+
+    memset(&b, 0, sizeof(b));
+    b.img = img;
+    b.seen = calloc((size_t)img->sb->ninodes + 1, 1);
+    if (b.seen && minix_read_inode(img, ROOT_INODE, &root) == 0) {
+        b.seen[ROOT_INODE] = 1;
+        strcpy(b.path, "/");
+        b.len = 1;
+        if (add_record(&b, ROOT_INODE, &root) == 0) {
+            build_dir(&b, &root);
+            if (!b.failed) {
+                status = write_sidecar(&b, key, path);
+            }
+        }
+    }
+    free(b.entries);
+    free(b.extents);
+    free(b.strings);
+    free(b.seen);
+    return status;
+}
+
+/* map path and check it belongs to the image described by key */
+static struct sidecar *map_sidecar(const char *path,
+    const struct sidecar_header *key) {
+    const struct sidecar_header *header;
+    struct sidecar *sc;
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(*header)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    header = map;
+    if (memcmp(header->magic, key->magic, sizeof(key->magic)) != 0 ||
+        header->version != key->version ||
+        header->header_size != key->header_size ||
+        header->image_size != key->image_size ||
+        header->image_mtime != key->image_mtime ||
+        header->image_mtime_ns != key->image_mtime_ns ||
+        header->fs_offset != key->fs_offset ||
+        header->sb_hash != key->sb_hash ||
+        header->file_size != (uint64_t)st.st_size ||
+        header->strings_off > header->file_size ||
+        header->extents_off + header->nextents *
+            sizeof(struct sidecar_extent) > header->strings_off ||
+        header->buckets_off + (uint64_t)header->nbuckets *
+            sizeof(uint32_t) > header->extents_off ||
+        header->entries_off + (uint64_t)header->nentries *
+            sizeof(struct sidecar_entry) > header->buckets_off ||
+        header->nbuckets == 0 ||
+        (header->nbuckets & (header->nbuckets - 1))) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    if (!(sc = calloc(1, sizeof(*sc)))) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    sc->map = map;
+    sc->size = st.st_size;
+    sc->header = header;
+    sc->entries = (const void *)(sc->map + header->entries_off);
+    sc->buckets = (const void *)(sc->map + header->buckets_off);
+    sc->extents = (const void *)(sc->map + header->extents_off);
+    sc->strings = (const char *)sc->map + header->strings_off;
+    return sc;
+}
+
+int sidecar_attach(struct minix_image *img, const char *imagefile,
+    int partition, int subpartition) {
+    struct sidecar_header key;
+    char path[SIDECAR_PATH_MAX];
+    int built = 0;
+
+    /* one sidecar per filesystem in the image */
+    if (partition < 0) {
+        snprintf(path, sizeof(path), "%s.idx", imagefile);
+    } else if (subpartition < 0) {
+        snprintf(path, sizeof(path), "%s.p%d.idx", imagefile, partition);
+    } else {
+        snprintf(path, sizeof(path), "%s.p%d.s%d.idx", imagefile, partition,
+            subpartition);
+    }
+    if (image_key(img, &key) != 0) {
+        return -1;
+    }
+    if (!(img->sidecar = map_sidecar(path, &key))) {
+        if (build_sidecar(img, &key, path) != 0) {
+            fprintf(stderr, "warning: couldn't write index %s\n", path);
+            return -1;
+        }
+        built = 1;
+        if (!(img->sidecar = map_sidecar(path, &key))) {
+            return -1;
+        }
+    }
+    img->sidecar->built = built;
+    return 0;
+}
+
+void sidecar_close(struct sidecar *sc) {
+    if (sc) {
+        munmap((void *)sc->map, sc->size);
+        free(sc);
+    }
+}
+
+/* rewrite path as "/a/b", 0 if a . or .. component rules that out */
+static int normalize(const char *path, char *out, size_t *len) {
+    size_t n = 0;
+
+    while (*path) {
+        size_t part;
+
+        while (*path == '/') {
+            path++;
+        }
+        part = strcspn(path, "/");
+        if (part == 0) {
+            break;
+        }
+        if ((part == 1 && path[0] == '.') ||
+            (part == 2 && path[0] == '.' && path[1] == '.') ||
+            n + part + 2 > SIDECAR_PATH_MAX) {
+            return 0;
+        }
+        out[n++] = '/';
+        memcpy(out + n, path, part);
+        n += part;
+        path += part;
+    }
+    if (n == 0) {
+        out[n++] = '/';
+    }
+    out[n] = '\0';
+    *len = n;
+    return 1;
+}
+
+const struct sidecar_entry *sidecar_find(struct sidecar *sc,
+    const char *path, int *known) {
+    char norm[SIDECAR_PATH_MAX];
+    uint32_t mask = sc->header->nbuckets - 1, hash, slot;
+    size_t len;
+
+    if (!normalize(path, norm, &len)) {
+        sc->fallbacks++;
+        *known = 0;
+        return NULL;
+    }
+    *known = 1;
+    hash = path_hash(norm, len);
+    for (slot = hash & mask; sc->buckets[slot]; slot = (slot + 1) & mask) {
+        const struct sidecar_entry *entry;
+
+        if (sc->buckets[slot] > sc->header->nentries) {
+            break;
+        }
+        entry = &sc->entries[sc->buckets[slot] - 1];
+        if (entry->hash == hash && entry->path_len == len &&
+            entry->path_off + len < sc->header->file_size -
+            sc->header->strings_off &&
+            memcmp(sc->strings + entry->path_off, norm, len) == 0) {
+            sc->hits++;
+            return entry;
+        }
+    }
+    /* below a second name there are paths the index doesn't have */
+    if (sc->header->flags & SIDECAR_ALIASED) {
+        sc->fallbacks++;
+        *known = 0;
+        return NULL;
+    }
+    sc->hits++;
+    return NULL;
+}
+
+struct zone_extent *sidecar_load_extents(const struct sidecar *sc,
+    const struct sidecar_entry *entry) {
+    struct zone_extent *ext;
+    uint32_t i;
+
+    if (entry->first_extent + entry->nextents > sc->header->nextents ||
+        !(ext = calloc(entry->nextents + 1, sizeof(*ext)))) {
+        return NULL;
+    }
+    for (i = 0; i < entry->nextents; i++) {
+        const struct sidecar_extent *src =
+            &sc->extents[entry->first_extent + i];
+
+        ext[i].file_zone = src->file_zone;
+        ext[i].start = src->start;
+        ext[i].length = src->length;
+        ext[i].hole = src->start == 0;
+    }
+    return ext;
+}
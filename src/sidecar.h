@@ -0,0 +1,84 @@
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include "minix.h"
+#include "zonemap.h"
+
+#define SIDECAR_MAGIC "MINIXIDX"
+#define SIDECAR_VERSION 2 /* 2: flags say when aliased paths are missing */
+
+/* header flags */
+#define SIDECAR_ALIASED 0x1 /* a directory has several names (or contains
+                             * itself); only the first is indexed below */
+
+/* on-disk sidecar index of one filesystem in an image: every path with
+ * its inode and extent list, hashed by path. The file is mapped and used
+ * in place. It is only trusted while the image size, mtime, filesystem
+ * offset and superblock all still match what it was built from. */
+struct sidecar_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t image_size;
+    int64_t image_mtime;       /* seconds */
+    int64_t image_mtime_ns;
+    uint64_t fs_offset;
+    uint32_t sb_hash;          /* FNV-1a of the superblock */
+    uint32_t nentries;
+    uint32_t nbuckets;         /* power of 2 */
+    uint32_t flags;
+    uint64_t nextents;
+    uint64_t entries_off;      /* byte offsets from the start of file */
+    uint64_t buckets_off;
+    uint64_t extents_off;
+    uint64_t strings_off;
+    uint64_t file_size;
+};
+
+struct sidecar_entry {
+    uint32_t hash;             /* of the path */
+    uint32_t ino;
+    uint64_t path_off;         /* into the string table, NUL terminated */
+    uint32_t path_len;
+    uint32_t nextents;
+    uint64_t first_extent;
+    struct inode inode;
+};
+
+struct sidecar_extent {
+    uint64_t file_zone;
+    uint32_t start;            /* 0 for a hole */
+    uint32_t length;
+};
+
+/* an attached sidecar. Buckets hold entry index + 1, 0 when empty. */
+struct sidecar {
+    const uint8_t *map;
+    uint64_t size;
+    const struct sidecar_header *header;
+    const struct sidecar_entry *entries;
+    const uint32_t *buckets;
+    const struct sidecar_extent *extents;
+    const char *strings;
+    int built;                 /* written by this run */
+    uint64_t hits;
+    uint64_t fallbacks;        /* lookups it couldn't answer */
+};
+
+/* use imagefile's sidecar for img's filesystem, building it first when
+ * missing or stale. Failing leaves img working without one. */
+int sidecar_attach(struct minix_image *img, const char *imagefile,
+    int partition, int subpartition);
+void sidecar_close(struct sidecar *sc);
+
+/* entry for path; NULL when it doesn't exist, with *known 0 when the
+ * path can't be answered from the index (. or .. components, or any
+ * miss in a SIDECAR_ALIASED index) */
+const struct sidecar_entry *sidecar_find(struct sidecar *sc,
+    const char *path, int *known);
+
+/* entry's extents as a malloc'd array for minix_extract_extents */
+struct zone_extent *sidecar_load_extents(const struct sidecar *sc,
+    const struct sidecar_entry *entry);
+
+#endif /*SIDECAR_H*/
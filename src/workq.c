@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "workq.h"
+
+int workq_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+
+static void *worker(void *arg) {
+    struct workq *q = arg;
+
+    for (;;) {
+        void *item;
+
+        pthread_mutex_lock(&q->lock);
+        while (q->count == 0 && !q->closing) {
+            pthread_cond_wait(&q->ready, &q->lock);
+        }
+        if (q->count == 0) {
+            pthread_mutex_unlock(&q->lock);
+            return NULL; /* closing and drained */
+        }
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        pthread_mutex_unlock(&q->lock);
+
+        q->fn(item, q->ctx);
+    }
+}
+
+int workq_start(struct workq *q, int nthreads, work_fn fn, void *ctx) {
+    int i;
+
+    memset(q, 0, sizeof(*q));
+    q->fn = fn;
+    q->ctx = ctx;
+    q->cap = 64;
+    q->items = malloc(q->cap * sizeof(void *));
+    q->threads = calloc(nthreads, sizeof(pthread_t));
+    if (!q->items || !q->threads) {
+        free(q->items);
+        free(q->threads);
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->ready, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&q->threads[i], NULL, worker, q) != 0) {
+            break;
+        }
+    }
+    q->nthreads = i;
+    if (i == 0) {
+        fprintf(stderr, "error: cannot start worker threads\n");
+        workq_finish(q);
+        return -1;
+    }
+    return 0;
+}
+
+int workq_push(struct workq *q, void *item) {
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->cap) {
+        /* unroll the ring into a buffer twice the size */
+        void **grown = malloc(q->cap * 2 * sizeof(void *));
+        unsigned i;
+
+        if (!grown) {
+            pthread_mutex_unlock(&q->lock);
+            fprintf(stderr, "error: out of memory\n");
+            return -1;
+        }
+        for (i = 0; i < q->count; i++) {
+            grown[i] = q->items[(q->head + i) % q->cap];
+        }
+        free(q->items);
+        q->items = grown;
+        q->head = 0;
+        q->cap *= 2;
+    }
+    q->items[(q->head + q->count) % q->cap] = item;
+    q->count++;
+    pthread_cond_signal(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+void workq_finish(struct workq *q) {
+    int i;
+
+    pthread_mutex_lock(&q->lock);
+    q->closing = 1;
+    pthread_cond_broadcast(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+
+    for (i = 0; i < q->nthreads; i++) {
+        pthread_join(q->threads[i], NULL);
+    }
+    pthread_cond_destroy(&q->ready);
+    pthread_mutex_destroy(&q->lock);
+    free(q->items);
+    free(q->threads);
+    q->items = NULL;
+    q->threads = NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include <pthread.h>
+
+/* called on a worker thread for each queued item */
+typedef void (*work_fn)(void *item, void *ctx);
+
+/* fixed pool of threads draining an unbounded FIFO of work items */
+struct workq {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;      /* items queued or closing */
+    void **items;              /* ring buffer */
+    unsigned head, count, cap;
+    int closing;
+    pthread_t *threads;
+    int nthreads;
+    work_fn fn;
+    void *ctx;
+};
+
+/* worker count to use when the user doesn't pick one */
+int workq_default_threads(void);
+
+int workq_start(struct workq *q, int nthreads, work_fn fn, void *ctx);
+int workq_push(struct workq *q, void *item);
+
+/* let the workers drain what is queued, then join and free them */
+void workq_finish(struct workq *q);
+
+#endif /*WORKQ_H*/
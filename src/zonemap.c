@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zonemap.h"
+#include "byteorder.h"
+
+int zone_map_init(struct zone_map *map, const struct minix_image *img,
+    const struct inode *inode) {
+    memset(map, 0, sizeof(*map));
+    map->img = img;
+    map->inode = inode;
+    map->per_block = img->sb->blocksize / sizeof(uint32_t);
+    map->nzones = ((uint64_t)inode->size + img->zone_size - 1) /
+        img->zone_size;
+    return 0;
+}
+
+static void release_block(const struct minix_image *img,
+    struct zone_block *block) {
+    minix_put_block(img, &block->buf);
+    free(block->copy);
+    block->copy = NULL;
+    block->zones = NULL;
+}
+
+void zone_map_release(struct zone_map *map) {
+    release_block(map->img, &map->indirect);
+    release_block(map->img, &map->two_indirect);
+    release_block(map->img, &map->leaf);
+}
+
+/* load the first block of an indirect zone, it holds the zone numbers */
+static int indirect_block(struct zone_map *map, uint32_t zone,
+    struct zone_block *block) {
+    const struct minix_image *img = map->img;
+
+    minix_put_block(img, &block->buf);
+    block->zones = NULL;
+    if (!minix_zone_valid(img, zone) || minix_get_block(img,
+        zone << img->sb->log_zone_size, &block->buf) != 0) {
+        fprintf(stderr, "error: bad indirect zone %u\n", zone);
+        return -1;
+    }
+    map->indirect_reads++;
+    if (!img->swapped) {
+        block->zones = (const uint32_t *)block->buf.data;
+        return 0;
+    }
+    /* decode the whole block once rather than every zone number read */
+    if (!block->copy && !(block->copy = malloc(img->sb->blocksize))) {
+        fprintf(stderr, "error: out of memory\n");
+        minix_put_block(img, &block->buf);
+        return -1;
+    }
+    minix_swap_words(block->copy, block->buf.data, map->per_block);
+    minix_put_block(img, &block->buf);
+    block->zones = block->copy;
+    return 0;
+}
+
+static uint32_t zone_at(const struct zone_block *block, uint64_t n) {
+    return block->zones[n];
+}
+
+int zone_map_lookup(struct zone_map *map, uint64_t n, uint32_t *zone) {
+    const struct inode *inode = map->inode;
+    uint64_t per = map->per_block;
+
+    if (n < DIRECT_ZONES) {
+        *zone = inode->zone[n];
+        return 0;
+    }
+    n -= DIRECT_ZONES;
+
+    if (n < per) {
+        if (inode->indirect == 0) {
+            *zone = 0;
+            return 0;
+        }
+        if (!map->indirect.zones &&
+            indirect_block(map, inode->indirect, &map->indirect) != 0) {
+            return -1;
+        }
+        *zone = zone_at(&map->indirect, n);
+        return 0;
+    }
+    n -= per;
+
+    if (n >= per * per) {
+        fprintf(stderr, "error: file zone beyond double indirect range\n");
+        return -1;
+    }
+    if (inode->two_indirect == 0) {
+        *zone = 0;
+        return 0;
+    }
+    if (!map->two_indirect.zones && indirect_block(map, inode->two_indirect,
+        &map->two_indirect) != 0) {
+        return -1;
+    }
+    /* only fetch a new leaf when we step into another root slot */
+    if (!map->leaf.zones || map->leaf_index != n / per) {
+        uint32_t leaf_zone = zone_at(&map->two_indirect, n / per);
+
+        if (leaf_zone == 0) {
+            *zone = 0;
+            return 0;
+        }
+        if (indirect_block(map, leaf_zone, &map->leaf) != 0) {
+            return -1;
+        }
+        map->leaf_index = n / per;
+    }
+    *zone = zone_at(&map->leaf, n % per);
+    return 0;
+}
+
+int zone_map_next(struct zone_map *map, struct zone_extent *ext) {
+    uint32_t zone;
+
+    if (map->next >= map->nzones) {
+        return 0;
+    }
+    if (zone_map_lookup(map, map->next, &zone) != 0) {
+        return -1;
+    }
+    if (zone != 0 && !minix_zone_valid(map->img, zone)) {
+        fprintf(stderr, "error: bad zone %u\n", zone);
+        return -1;
+    }
+
+    ext->file_zone = map->next;
+    ext->start = zone;
+    ext->length = 1;
+    ext->hole = zone == 0;
+    map->next++;
+
+    /* extend while the next zone continues the run */
+    while (map->next < map->nzones && ext->length < UINT32_MAX) {
+        uint32_t following;
+
+        if (zone_map_lookup(map, map->next, &following) != 0) {
+            return -1;
+        }
+        if (ext->hole ? following != 0 :
+            following != ext->start + ext->length) {
+            break;
+        }
+        if (following != 0 && !minix_zone_valid(map->img, following)) {
+            fprintf(stderr, "error: bad zone %u\n", following);
+            return -1;
+        }
+        ext->length++;
+        map->next++;
+    }
+    return 1;
+}
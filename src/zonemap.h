@@ -0,0 +1,51 @@
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+
+#include "minix.h"
+
+/* a run of consecutive file zones that are either physically contiguous
+ * on disk or all holes */
+struct zone_extent {
+    uint64_t file_zone;   /* index of the first zone within the file */
+    uint32_t start;       /* first disk zone, 0 for a hole */
+    uint32_t length;      /* number of zones in the run */
+    int hole;
+};
+
+/* an indirect block in use: pinned in place, or for a byte-reversed
+ * image decoded into a private copy */
+struct zone_block {
+    struct minix_buf buf;
+    const uint32_t *zones;        /* NULL until loaded */
+    uint32_t *copy;               /* swapped images only */
+};
+
+/* per-file iterator over the direct, indirect and double-indirect zones.
+ * The indirect blocks in use stay pinned so that a sequential walk
+ * resolves each indirect block exactly once; zone_map_release drops
+ * them. */
+struct zone_map {
+    const struct minix_image *img;
+    const struct inode *inode;
+    uint64_t next;                /* next file zone to resolve */
+    uint64_t nzones;              /* zones covered by inode->size */
+    uint32_t per_block;           /* zone numbers per indirect block */
+    struct zone_block indirect;   /* single indirect block */
+    struct zone_block two_indirect; /* double indirect root block */
+    struct zone_block leaf;       /* current double indirect leaf */
+    uint32_t leaf_index;          /* which root slot leaf came from */
+    uint32_t indirect_reads;      /* indirect blocks resolved so far */
+};
+
+int zone_map_init(struct zone_map *map, const struct minix_image *img,
+    const struct inode *inode);
+void zone_map_release(struct zone_map *map);
+
+/* disk zone backing file zone n, 0 for a hole, -1 on a corrupt map */
+int zone_map_lookup(struct zone_map *map, uint64_t n, uint32_t *zone);
+
+/* next extent in file order: 1 while there is one, 0 at the end of the
+ * file and -1 on a corrupt map */
+int zone_map_next(struct zone_map *map, struct zone_extent *ext);
+
+#endif /*ZONEMAP_H*/